@@ -0,0 +1,278 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+#include <map>
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+
+#if defined (_WIN32) || defined (_WIN64)
+#include <Windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "CacheSnapshot.h"
+
+static_assert(sizeof(CacheSnapshot::SNAPSHOTHEADER) == 40, "the file layout must not depend on the compiler");
+static_assert(sizeof(CacheSnapshot::SNAPSHOTENTRY) == 20, "the file layout must not depend on the compiler");
+
+CacheSnapshot::CacheSnapshot() : m_pData(nullptr), m_nSize(0), m_pHeader(nullptr), m_pEntries(nullptr), m_pNames(nullptr), m_pRData(nullptr)
+#if defined (_WIN32) || defined (_WIN64)
+    , m_hFile(INVALID_HANDLE_VALUE), m_hMapping(nullptr)
+#endif
+{
+}
+
+CacheSnapshot::~CacheSnapshot()
+{
+    Close();
+}
+
+bool CacheSnapshot::Open(const string& strFile)
+{
+    Close();
+
+#if defined (_WIN32) || defined (_WIN64)
+    m_hFile = CreateFileA(strFile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER liSize;
+    if (GetFileSizeEx(m_hFile, &liSize) == FALSE || liSize.QuadPart < static_cast<LONGLONG>(sizeof(SNAPSHOTHEADER)))
+    {
+        Close();
+        return false;
+    }
+    m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_hMapping == nullptr)
+    {
+        Close();
+        return false;
+    }
+    m_pData = static_cast<const unsigned char*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+    m_nSize = static_cast<size_t>(liSize.QuadPart);
+#else
+    const int fd = open(strFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    struct stat stFile;
+    if (fstat(fd, &stFile) == -1 || stFile.st_size < static_cast<off_t>(sizeof(SNAPSHOTHEADER)))
+    {
+        close(fd);
+        return false;
+    }
+    void* pMap = mmap(nullptr, static_cast<size_t>(stFile.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);      // the mapping stays valid
+    m_pData = pMap != MAP_FAILED ? static_cast<const unsigned char*>(pMap) : nullptr;
+    m_nSize = static_cast<size_t>(stFile.st_size);
+#endif
+    if (m_pData == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    m_pHeader = reinterpret_cast<const SNAPSHOTHEADER*>(m_pData);
+    const uint64_t nExpected = sizeof(SNAPSHOTHEADER) + uint64_t(m_pHeader->nEntries) * sizeof(SNAPSHOTENTRY) + m_pHeader->nNameBytes + m_pHeader->nRDataBytes;
+    if (memcmp(m_pHeader->szMagic, "mDnsSnap", 8) != 0 || m_pHeader->nVersion != VERSION || m_pHeader->nByteOrder != 0x01020304 || nExpected != m_nSize)
+    {
+        Close();
+        return false;
+    }
+
+    m_pEntries = reinterpret_cast<const SNAPSHOTENTRY*>(m_pData + sizeof(SNAPSHOTHEADER));
+    m_pNames = reinterpret_cast<const char*>(m_pEntries + m_pHeader->nEntries);
+    m_pRData = m_pNames + m_pHeader->nNameBytes;
+
+    // The wall clock time of the write translated to the steady clock, a write "in the future" counts as now
+    const auto tNowSys = chrono::system_clock::now();
+    const auto tWrittenSys = chrono::system_clock::time_point(chrono::seconds(m_pHeader->tWritten));
+    m_tWritten = chrono::steady_clock::now() - (tWrittenSys < tNowSys ? chrono::duration_cast<chrono::steady_clock::duration>(tNowSys - tWrittenSys) : chrono::steady_clock::duration::zero());
+    return true;
+}
+
+void CacheSnapshot::Close()
+{
+#if defined (_WIN32) || defined (_WIN64)
+    if (m_pData != nullptr)
+        UnmapViewOfFile(m_pData);
+    if (m_hMapping != nullptr)
+        CloseHandle(m_hMapping);
+    if (m_hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(m_hFile);
+    m_hMapping = nullptr;
+    m_hFile = INVALID_HANDLE_VALUE;
+#else
+    if (m_pData != nullptr)
+        munmap(const_cast<unsigned char*>(m_pData), m_nSize);
+#endif
+    m_pData = nullptr;
+    m_nSize = 0;
+    m_pHeader = nullptr;
+    m_pEntries = nullptr;
+}
+
+vector<RecordCache::ENTRY> CacheSnapshot::Lookup(const string& strName, unsigned short usType) const
+{
+    vector<RecordCache::ENTRY> vResult;
+    if (m_pHeader == nullptr)
+        return vResult;
+
+    auto fnLess = [this](const SNAPSHOTENTRY& Item, const pair<const string*, unsigned short>& Key)
+    {
+        const int iCmp = Item.nNameOffset + uint64_t(Item.nNameLen) <= m_pHeader->nNameBytes ? CompareName(m_pNames + Item.nNameOffset, Item.nNameLen, Key.first->c_str(), Key.first->size()) : -1;
+        return iCmp < 0 || (iCmp == 0 && Item.usType < Key.second);
+    };
+    const SNAPSHOTENTRY* pEnd = m_pEntries + m_pHeader->nEntries;
+    for (const SNAPSHOTENTRY* pItem = lower_bound(m_pEntries, pEnd, make_pair(&strName, usType), fnLess); pItem != pEnd && pItem->usType == usType; ++pItem)
+    {
+        RecordCache::ENTRY Entry;
+        if (MakeEntry(*pItem, Entry) == false || CompareName(Entry.strName.c_str(), Entry.strName.size(), strName.c_str(), strName.size()) != 0)
+            break;
+        if (Entry.tExpire > chrono::steady_clock::now())
+            vResult.push_back(move(Entry));
+    }
+    return vResult;
+}
+
+vector<RecordCache::ENTRY> CacheSnapshot::GetAll() const
+{
+    vector<RecordCache::ENTRY> vResult;
+    const auto tNow = chrono::steady_clock::now();
+    for (uint32_t n = 0; m_pHeader != nullptr && n < m_pHeader->nEntries; ++n)
+    {
+        RecordCache::ENTRY Entry;
+        if (MakeEntry(m_pEntries[n], Entry) == true && Entry.tExpire > tNow)
+            vResult.push_back(move(Entry));
+    }
+    return vResult;
+}
+
+bool CacheSnapshot::Write(const string& strFile, const vector<RecordCache::ENTRY>& vEntries)
+{
+    const auto tNow = chrono::steady_clock::now();
+
+    vector<const RecordCache::ENTRY*> vSorted;
+    for (const auto& Entry : vEntries)
+    {
+        if (Entry.tExpire > tNow + chrono::seconds(1) && Entry.strName.size() <= 0xffff && Entry.strRData.size() <= 0xffff)
+            vSorted.push_back(&Entry);
+    }
+    sort(begin(vSorted), end(vSorted), [](const RecordCache::ENTRY* p1, const RecordCache::ENTRY* p2)
+    {
+        const int iCmp = CompareName(p1->strName.c_str(), p1->strName.size(), p2->strName.c_str(), p2->strName.size());
+        return iCmp < 0 || (iCmp == 0 && p1->usType < p2->usType);
+    });
+
+    string strNames, strRData;
+    map<string, uint32_t> maNameOffsets;
+    vector<SNAPSHOTENTRY> vItems;
+    vItems.reserve(vSorted.size());
+    for (const auto pEntry : vSorted)
+    {
+        const auto& itName = maNameOffsets.emplace(pEntry->strName, static_cast<uint32_t>(strNames.size()));
+        if (itName.second == true)
+            strNames += pEntry->strName;
+
+        SNAPSHOTENTRY Item;
+        Item.nNameOffset = itName.first->second;
+        Item.nRDataOffset = static_cast<uint32_t>(strRData.size());
+        Item.nTtl = static_cast<uint32_t>(chrono::duration_cast<chrono::seconds>(pEntry->tExpire - tNow).count());
+        Item.nNameLen = static_cast<uint16_t>(pEntry->strName.size());
+        Item.nRDataLen = static_cast<uint16_t>(pEntry->strRData.size());
+        Item.usType = pEntry->usType;
+        Item.usClass = pEntry->usClass;
+        strRData += pEntry->strRData;
+        vItems.push_back(Item);
+    }
+
+    SNAPSHOTHEADER Header = {};
+    memcpy(Header.szMagic, "mDnsSnap", 8);
+    Header.nVersion = VERSION;
+    Header.nByteOrder = 0x01020304;
+    Header.nEntries = static_cast<uint32_t>(vItems.size());
+    Header.nNameBytes = static_cast<uint32_t>(strNames.size());
+    Header.nRDataBytes = static_cast<uint32_t>(strRData.size());
+    Header.tWritten = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+
+    // The data is on the disk before the rename, a crash leaves the old snapshot or the new one, never an empty file
+    const string strTmpFile = strFile + ".tmp";
+    FILE* pFile = fopen(strTmpFile.c_str(), "wb");
+    if (pFile == nullptr)
+        return false;
+    bool bOk = fwrite(&Header, sizeof(Header), 1, pFile) == 1;
+    if (vItems.empty() == false)
+        bOk = bOk == true && fwrite(vItems.data(), sizeof(SNAPSHOTENTRY), vItems.size(), pFile) == vItems.size();
+    bOk = bOk == true && fwrite(strNames.data(), 1, strNames.size(), pFile) == strNames.size();
+    bOk = bOk == true && fwrite(strRData.data(), 1, strRData.size(), pFile) == strRData.size();
+    bOk = bOk == true && fflush(pFile) == 0;
+#if defined (_WIN32) || defined (_WIN64)
+    bOk = bOk == true && _commit(_fileno(pFile)) == 0;
+#else
+    bOk = bOk == true && fsync(fileno(pFile)) == 0;
+#endif
+    bOk = fclose(pFile) == 0 && bOk == true;
+    if (bOk == false)
+    {
+        remove(strTmpFile.c_str());
+        return false;
+    }
+
+#if defined (_WIN32) || defined (_WIN64)
+    // MOVEFILE_WRITE_THROUGH returns after the rename is on the disk
+    return MoveFileExA(strTmpFile.c_str(), strFile.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+#else
+    if (rename(strTmpFile.c_str(), strFile.c_str()) != 0)
+        return false;
+
+    // The rename is an entry in the directory, it is on the disk with the directory only
+    const size_t nSlash = strFile.rfind('/');
+    const string strDir = nSlash == string::npos ? string(".") : (nSlash == 0 ? string("/") : strFile.substr(0, nSlash));
+    const int fdDir = open(strDir.c_str(), O_RDONLY);
+    if (fdDir < 0)
+        return false;
+    const bool bSynced = fsync(fdDir) == 0;
+    close(fdDir);
+    return bSynced;
+#endif
+}
+
+bool CacheSnapshot::MakeEntry(const SNAPSHOTENTRY& Item, RecordCache::ENTRY& Entry) const
+{
+    if (Item.nNameOffset + uint64_t(Item.nNameLen) > m_pHeader->nNameBytes || Item.nRDataOffset + uint64_t(Item.nRDataLen) > m_pHeader->nRDataBytes)
+        return false;
+
+    Entry.strName.assign(m_pNames + Item.nNameOffset, Item.nNameLen);
+    Entry.usType = Item.usType;
+    Entry.usClass = Item.usClass;
+    Entry.strRData.assign(m_pRData + Item.nRDataOffset, Item.nRDataLen);
+    Entry.nTtl = Item.nTtl;
+    Entry.tExpire = m_tWritten + chrono::seconds(Item.nTtl);
+    Entry.tReceived = m_tWritten;
+    Entry.nInterface = 0;
+    return true;
+}
+
+int CacheSnapshot::CompareName(const char* szName1, size_t nLen1, const char* szName2, size_t nLen2)
+{
+    for (size_t n = 0; n < nLen1 && n < nLen2; ++n)
+    {
+        const int c1 = tolower(static_cast<unsigned char>(szName1[n])), c2 = tolower(static_cast<unsigned char>(szName2[n]));
+        if (c1 != c2)
+            return c1 < c2 ? -1 : 1;
+    }
+    return nLen1 < nLen2 ? -1 : (nLen1 > nLen2 ? 1 : 0);
+}
@@ -0,0 +1,84 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include "RecordCache.h"
+
+using namespace std;
+
+// The record cache saved to a file, read back memory mapped after a restart.
+// Layout: SNAPSHOTHEADER, nEntries SNAPSHOTENTRY sorted by (lower case name, type), the name table, the RDATA table.
+// Opening only maps the file and checks the header, records are found by binary search, so the startup
+// does not depend on the size of the cache. TTLs are reduced by the time passed since the file was written.
+class CacheSnapshot
+{
+public:
+    static const uint32_t VERSION = 1;
+
+    typedef struct
+    {
+        char     szMagic[8];        // "mDnsSnap"
+        uint32_t nVersion;
+        uint32_t nByteOrder;        // 0x01020304 as written, the file is in host byte order
+        uint32_t nEntries;
+        uint32_t nNameBytes;
+        uint32_t nRDataBytes;
+        uint32_t nReserved;
+        int64_t  tWritten;          // seconds since 1970
+    }SNAPSHOTHEADER;
+
+    typedef struct
+    {
+        uint32_t nNameOffset;       // into the name table, names are stored once
+        uint32_t nRDataOffset;      // into the RDATA table
+        uint32_t nTtl;              // remaining when the file was written
+        uint16_t nNameLen;
+        uint16_t nRDataLen;
+        uint16_t usType;
+        uint16_t usClass;
+    }SNAPSHOTENTRY;
+
+public:
+    CacheSnapshot();
+    virtual ~CacheSnapshot();
+
+    bool Open(const string& strFile);
+    void Close();
+    vector<RecordCache::ENTRY> Lookup(const string& strName, unsigned short usType) const;
+    vector<RecordCache::ENTRY> GetAll() const;
+
+    // Writes to a temporary file and renames it, a crash never leaves a half written snapshot
+    static bool Write(const string& strFile, const vector<RecordCache::ENTRY>& vEntries);
+
+private:
+    bool MakeEntry(const SNAPSHOTENTRY& Item, RecordCache::ENTRY& Entry) const;
+    static int CompareName(const char* szName1, size_t nLen1, const char* szName2, size_t nLen2);
+
+private:
+    const unsigned char* m_pData;
+    size_t               m_nSize;
+    const SNAPSHOTHEADER* m_pHeader;
+    const SNAPSHOTENTRY* m_pEntries;
+    const char*          m_pNames;
+    const char*          m_pRData;
+    chrono::steady_clock::time_point m_tWritten;    // the write time on our clock
+#if defined (_WIN32) || defined (_WIN64)
+    void*                m_hFile;
+    void*                m_hMapping;
+#endif
+};
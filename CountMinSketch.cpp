@@ -0,0 +1,128 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+
+#include "CountMinSketch.h"
+
+CountMinSketch::CountMinSketch(size_t nWidth, size_t nDepth, size_t nTopK) : m_nWidth(max(nWidth, size_t(1))), m_nDepth(max(nDepth, size_t(1))), m_nTopK(nTopK), m_nTotal(0)
+{
+    m_vCounters.assign(m_nWidth * m_nDepth, 0);
+}
+
+CountMinSketch::~CountMinSketch()
+{
+}
+
+void CountMinSketch::Add(const string& strKey, uint64_t nCount)
+{
+    // One hash gives all rows their counter, h1 + i * h2 (Kirsch and Mitzenmacher)
+    const uint64_t nHash = Hash(strKey);
+    const uint64_t h1 = nHash & 0xffffffff, h2 = (nHash >> 32) | 1;
+    uint64_t nEstimate = UINT64_MAX;
+    for (size_t n = 0; n < m_nDepth; ++n)
+    {
+        uint64_t& nCounter = m_vCounters[n * m_nWidth + (h1 + n * h2) % m_nWidth];
+        nCounter += nCount;
+        nEstimate = min(nEstimate, nCounter);
+    }
+    m_nTotal += nCount;
+    Offer(strKey, nEstimate);
+}
+
+uint64_t CountMinSketch::Estimate(const string& strKey) const
+{
+    const uint64_t nHash = Hash(strKey);
+    const uint64_t h1 = nHash & 0xffffffff, h2 = (nHash >> 32) | 1;
+    uint64_t nEstimate = UINT64_MAX;
+    for (size_t n = 0; n < m_nDepth; ++n)
+        nEstimate = min(nEstimate, m_vCounters[n * m_nWidth + (h1 + n * h2) % m_nWidth]);
+    return nEstimate;
+}
+
+uint64_t CountMinSketch::Total() const
+{
+    return m_nTotal;
+}
+
+CountMinSketch::TOPLIST CountMinSketch::GetTop() const
+{
+    TOPLIST vTop;
+    for (auto it = m_setTop.rbegin(); it != m_setTop.rend(); ++it)
+        vTop.emplace_back(it->second, it->first);
+    return vTop;
+}
+
+bool CountMinSketch::Merge(const CountMinSketch& Other)
+{
+    if (Other.m_nWidth != m_nWidth || Other.m_nDepth != m_nDepth)
+        return false;
+
+    for (size_t n = 0; n < m_vCounters.size(); ++n)
+        m_vCounters[n] += Other.m_vCounters[n];
+    m_nTotal += Other.m_nTotal;
+
+    // The heavy hitters of the sum are among the ones of both, their estimates are taken again from the merged counters
+    vector<string> vCandidates;
+    for (const auto& item : m_maTop)
+        vCandidates.push_back(item.first);
+    for (const auto& item : Other.m_maTop)
+        vCandidates.push_back(item.first);
+    m_maTop.clear();
+    m_setTop.clear();
+    for (const auto& strKey : vCandidates)
+        Offer(strKey, Estimate(strKey));
+    return true;
+}
+
+void CountMinSketch::Clear()
+{
+    fill(begin(m_vCounters), end(m_vCounters), 0);
+    m_nTotal = 0;
+    m_maTop.clear();
+    m_setTop.clear();
+}
+
+void CountMinSketch::Offer(const string& strKey, uint64_t nEstimate)
+{
+    if (m_nTopK == 0)
+        return;
+
+    const auto& itKey = m_maTop.find(strKey);
+    if (itKey != end(m_maTop))
+    {
+        m_setTop.erase(make_pair(itKey->second, strKey));
+        itKey->second = nEstimate;
+        m_setTop.emplace(nEstimate, strKey);
+        return;
+    }
+
+    if (m_maTop.size() == m_nTopK)
+    {
+        if (nEstimate <= m_setTop.begin()->first)
+            return;
+        m_maTop.erase(m_setTop.begin()->second);
+        m_setTop.erase(m_setTop.begin());
+    }
+    m_maTop.emplace(strKey, nEstimate);
+    m_setTop.emplace(nEstimate, strKey);
+}
+
+uint64_t CountMinSketch::Hash(const string& strKey)
+{
+    uint64_t nHash = 0xcbf29ce484222325;    // FNV-1a
+    for (const auto c : strKey)
+        nHash = (nHash ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+    nHash ^= nHash >> 33;                   // mixes the upper half, it gives the step between the rows
+    nHash *= 0xff51afd7ed558ccd;
+    return nHash ^ (nHash >> 33);
+}
@@ -0,0 +1,56 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <cstdint>
+
+using namespace std;
+
+// Counts how often keys were seen, in memory fixed by the size and not by the number of keys. nDepth
+// rows of nWidth counters, a key adds to one counter in every row and its estimate is the smallest of
+// them: never below the true count, above it only by the keys sharing all its counters (Cormode and
+// Muthukrishnan). The nTopK keys with the highest estimates are kept by name. Two sketches of the same
+// size are merged by adding the counters. Not thread safe.
+class CountMinSketch
+{
+public:
+    typedef vector<pair<string, uint64_t>> TOPLIST;     // key, estimate, highest first
+
+    CountMinSketch(size_t nWidth = 1024, size_t nDepth = 4, size_t nTopK = 20);
+    virtual ~CountMinSketch();
+
+    void Add(const string& strKey, uint64_t nCount = 1);
+    uint64_t Estimate(const string& strKey) const;
+    uint64_t Total() const;
+    TOPLIST GetTop() const;
+    // False if the sketches differ in size, nothing is merged then
+    bool Merge(const CountMinSketch& Other);
+    void Clear();
+
+private:
+    void Offer(const string& strKey, uint64_t nEstimate);
+    static uint64_t Hash(const string& strKey);
+
+private:
+    size_t           m_nWidth;
+    size_t           m_nDepth;
+    size_t           m_nTopK;
+    vector<uint64_t> m_vCounters;       // m_nDepth rows one after the other
+    uint64_t         m_nTotal;
+    unordered_map<string, uint64_t> m_maTop;    // key -> estimate
+    set<pair<uint64_t, string>> m_setTop;       // the same ordered by estimate, the smallest first
+};
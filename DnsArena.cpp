@@ -0,0 +1,114 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+#include <cstdint>
+
+#include "DnsArena.h"
+
+static thread_local DnsArena* s_pCurrentArena = nullptr;
+
+DnsArena::Scope::Scope() : m_pPrevious(s_pCurrentArena)
+{
+    if (m_pPrevious == nullptr)
+        s_pCurrentArena = &DnsArena::ThreadArena();
+}
+
+DnsArena::Scope::~Scope()
+{
+    if (m_pPrevious == nullptr) // only the outermost scope releases the packet memory
+    {
+        s_pCurrentArena->Reset();
+        s_pCurrentArena = nullptr;
+    }
+}
+
+DnsArena::DnsArena(size_t nBlockSize/* = 16384*/) : m_nBlockSize(nBlockSize), m_nCurBlock(0), m_nCurOffset(0), m_Stats{}
+{
+    m_vBlocks.reserve(16);
+}
+
+DnsArena::~DnsArena()
+{
+}
+
+void* DnsArena::Allocate(size_t nBytes, size_t nAlign/* = alignof(max_align_t)*/)
+{
+    if (nBytes == 0)
+        nBytes = 1;
+
+    while (m_nCurBlock < m_vBlocks.size())
+    {
+        const uintptr_t nBase = reinterpret_cast<uintptr_t>(m_vBlocks[m_nCurBlock].first.get());
+        const size_t nStart = ((nBase + m_nCurOffset + nAlign - 1) & ~static_cast<uintptr_t>(nAlign - 1)) - nBase;
+        if (nStart + nBytes <= m_vBlocks[m_nCurBlock].second)
+        {
+            m_nCurOffset = nStart + nBytes;
+            m_Stats.nBytesInUse += nBytes;
+            ++m_Stats.nAllocations;
+            return m_vBlocks[m_nCurBlock].first.get() + nStart;
+        }
+        ++m_nCurBlock;
+        m_nCurOffset = 0;
+    }
+
+    AddBlock(nBytes + nAlign);
+    return Allocate(nBytes, nAlign);
+}
+
+void DnsArena::Reset()
+{
+    // If the last packet needed more than one block, we replace them by one block big enough for all,
+    // the next packet of the same size is then served without going to the heap again
+    if (m_vBlocks.size() > 1)
+    {
+        size_t nTotal = 0;
+        for (const auto& item : m_vBlocks)
+            nTotal += item.second;
+        m_vBlocks.clear();
+        AddBlock(nTotal);
+    }
+
+    m_nCurBlock = 0;
+    m_nCurOffset = 0;
+    m_Stats.nBytesInUse = 0;
+    ++m_Stats.nResets;
+}
+
+DnsArena::ARENASTATS DnsArena::GetStats() const
+{
+    ARENASTATS Stats = m_Stats;
+    Stats.nCapacity = 0;
+    for (const auto& item : m_vBlocks)
+        Stats.nCapacity += item.second;
+    return Stats;
+}
+
+DnsArena& DnsArena::ThreadArena()
+{
+    static thread_local DnsArena s_Arena;
+    return s_Arena;
+}
+
+DnsArena* DnsArena::Current()
+{
+    return s_pCurrentArena;
+}
+
+void DnsArena::AddBlock(size_t nMinSize)
+{
+    const size_t nSize = max(nMinSize, m_nBlockSize);
+    m_vBlocks.emplace_back(unique_ptr<char[]>(new char[nSize]), nSize);
+    m_nCurBlock = m_vBlocks.size() - 1;
+    m_nCurOffset = 0;
+    ++m_Stats.nHeapBlocks;
+}
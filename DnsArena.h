@@ -0,0 +1,145 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <new>
+#include <cstddef>
+
+using namespace std;
+
+// Bump allocator for everything that lives only as long as one packet.
+// Every thread has its own arena (ThreadArena). A DnsArena::Scope binds it to the
+// thread, the outermost scope resets it on exit. The memory blocks are kept, so
+// after the first few packets DnsProtokol decodes and encodes without touching the
+// global heap. That is all the arena covers, the receive path of mDnsServ still
+// allocates: the source address SocketLib reads into a std::string, the key of the
+// rate limiter, the records of the registry and the prepared answers, the canonical
+// RDATA for the cache and the log line. mDnsBench -bench <packets> counts the
+// allocations of decoding, answering and encoding a query.
+class DnsArena
+{
+public:
+    typedef struct
+    {
+        size_t nAllocations;    // Allocate() calls served by this arena
+        size_t nHeapBlocks;     // blocks requested from the global heap
+        size_t nResets;         // number of Reset() calls
+        size_t nBytesInUse;     // bytes handed out since the last Reset()
+        size_t nCapacity;       // total bytes owned by the arena
+    }ARENASTATS;
+
+    class Scope
+    {
+    public:
+        Scope();
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        DnsArena* m_pPrevious;
+    };
+
+public:
+    explicit DnsArena(size_t nBlockSize = 16384);
+    virtual ~DnsArena();
+    DnsArena(const DnsArena&) = delete;
+    DnsArena& operator=(const DnsArena&) = delete;
+
+    void* Allocate(size_t nBytes, size_t nAlign = alignof(max_align_t));
+    void Reset();
+    ARENASTATS GetStats() const;
+
+    static DnsArena& ThreadArena();     // the arena owned by the calling thread
+    static DnsArena* Current();         // the arena bound by a Scope, nullptr if none
+
+private:
+    void AddBlock(size_t nMinSize);
+
+private:
+    vector<pair<unique_ptr<char[]>, size_t>> m_vBlocks;
+    size_t      m_nBlockSize;
+    size_t      m_nCurBlock;
+    size_t      m_nCurOffset;
+    ARENASTATS  m_Stats;
+};
+
+// STL allocator drawing from the arena that was bound when the allocator was created.
+// Without a bound arena it falls back to the global heap, so the types stay usable outside a Scope.
+template<class T>
+class ArenaAllocator
+{
+    template<class U> friend class ArenaAllocator;
+public:
+    typedef T value_type;
+    typedef true_type propagate_on_container_copy_assignment;
+    typedef true_type propagate_on_container_move_assignment;
+    typedef true_type propagate_on_container_swap;
+
+    ArenaAllocator() noexcept : m_pArena(DnsArena::Current()) {}
+    template<class U> ArenaAllocator(const ArenaAllocator<U>& other) noexcept : m_pArena(other.m_pArena) {}
+
+    T* allocate(size_t nCount)
+    {
+        if (m_pArena != nullptr)
+            return static_cast<T*>(m_pArena->Allocate(nCount * sizeof(T), alignof(T)));
+        return static_cast<T*>(::operator new(nCount * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t) noexcept
+    {
+        if (m_pArena == nullptr)    // arena memory is released all together by Reset()
+            ::operator delete(p);
+    }
+
+    template<class U> bool operator==(const ArenaAllocator<U>& other) const noexcept { return m_pArena == other.m_pArena; }
+    template<class U> bool operator!=(const ArenaAllocator<U>& other) const noexcept { return m_pArena != other.m_pArena; }
+
+private:
+    DnsArena* m_pArena;
+};
+
+typedef basic_string<char, char_traits<char>, ArenaAllocator<char>> ARENASTRING;
+
+// Deleter for arrays created by MakeArenaArray, runs the destructors and returns heap memory if the array did not come from an arena
+template<class T>
+struct ArenaDelete
+{
+    DnsArena* pArena = nullptr;
+    size_t nCount = 0;
+
+    void operator()(T* p) const
+    {
+        for (size_t n = 0; n < nCount; ++n)
+            p[n].~T();
+        if (pArena == nullptr)
+            ::operator delete(p);
+    }
+};
+
+template<class T>
+using ARENAARRAY = unique_ptr<T[], ArenaDelete<T>>;
+
+// Counterpart to make_unique<T[]>, value initializes nCount elements in the currently bound arena
+template<class T>
+ARENAARRAY<T> MakeArenaArray(size_t nCount)
+{
+    ArenaDelete<T> Deleter;
+    Deleter.pArena = DnsArena::Current();
+    T* p = static_cast<T*>(Deleter.pArena != nullptr ? Deleter.pArena->Allocate(nCount * sizeof(T), alignof(T)) : ::operator new(nCount * sizeof(T)));
+    for (; Deleter.nCount < nCount; ++Deleter.nCount)
+        new (p + Deleter.nCount) T();
+    return ARENAARRAY<T>(p, Deleter);
+}
@@ -0,0 +1,359 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+#include <cctype>
+
+#include "DnsProtokol.h"
+#include "DnsGateway.h"
+
+using namespace std::placeholders;
+
+DnsGateway::DnsGateway(RecordCache& Cache, QUERYSENDER fnSendQuery, LOCALRECORDS fnLocalRecords) : m_Cache(Cache), m_fnSendQuery(fnSendQuery), m_fnLocalRecords(fnLocalRecords), m_tWait(500), m_nCallbackId(0), m_bStop(true), m_nReceiving(0)
+    , m_MulticastLimiter(10, 20, 1), m_ClientLimiter(5, 10, 1024)
+    , m_nQueries(0), m_nAnsweredAtOnce(0), m_nMulticastQueries(0), m_nTimeouts(0), m_nDropped(0), m_nRateLimited(0)
+{
+}
+
+DnsGateway::~DnsGateway()
+{
+    Stop();
+}
+
+bool DnsGateway::Start(unsigned short nPort, chrono::milliseconds tWait)
+{
+    m_tWait = tWait;
+    m_bStop = false;
+    m_nCallbackId = m_Cache.AddChangeCallback(bind(&DnsGateway::RecordChanged, this, _1, _2));
+    m_thWorker = thread(&DnsGateway::Worker, this);
+
+    for (const char* szAddr : { "0.0.0.0", "::" })
+    {
+        unique_ptr<UdpSocket> pUdpSocket = make_unique<UdpSocket>();
+        pUdpSocket->BindFuncBytesReceived(static_cast<function<void(UdpSocket* const)>>(bind(&DnsGateway::DatenEmpfangen, this, _1)));
+        if (pUdpSocket->Create(szAddr, nPort) == true)
+            m_vSockets.push_back(move(pUdpSocket));
+    }
+    return m_vSockets.empty() == false;
+}
+
+void DnsGateway::Stop()
+{
+    for (auto& pUdpSocket : m_vSockets)
+        pUdpSocket->Close();
+
+    // A packet read before the close may still be answered on its socket
+    unique_lock<mutex> lock(m_mxPending);
+    m_bStop = true;
+    m_cvPending.notify_all();
+    m_cvPending.wait(lock, [&]() { return m_nReceiving == 0; });
+    lock.unlock();
+    if (m_thWorker.joinable() == true)
+        m_thWorker.join();
+
+    if (m_nCallbackId != 0)
+        m_Cache.RemoveChangeCallback(m_nCallbackId);
+    m_nCallbackId = 0;
+
+    m_vSockets.clear();
+    m_maPending.clear();
+    m_maLastQuery.clear();
+}
+
+DnsGateway::STATISTICS DnsGateway::GetStatistics() const
+{
+    return { m_nQueries, m_nAnsweredAtOnce, m_nMulticastQueries, m_nTimeouts, m_nDropped, m_nRateLimited };
+}
+
+void DnsGateway::DatenEmpfangen(UdpSocket* pUdpSocket)
+{
+    {
+        lock_guard<mutex> lock(m_mxPending);
+        if (m_bStop == true)
+            return;
+        ++m_nReceiving;
+    }
+
+    Receive(pUdpSocket);
+
+    lock_guard<mutex> lock(m_mxPending);
+    if (--m_nReceiving == 0)
+        m_cvPending.notify_all();
+}
+
+void DnsGateway::Receive(UdpSocket* pUdpSocket)
+{
+    DnsArena::Scope ArenaScope;
+    size_t nAvalible = pUdpSocket->GetBytesAvailible();
+
+    auto spBuffer = MakeArenaArray<unsigned char>(nAvalible + 1);
+
+    string strFrom;
+    size_t nRead = pUdpSocket->Read(spBuffer.get(), nAvalible, strFrom);
+    if (nRead < 12 || nRead >= 9999)
+        return;
+
+    ++m_nQueries;
+    DnsProtokol dnsProto(spBuffer.get(), nRead);
+    if (dnsProto.m_strLastErrMsg.empty() == false || dnsProto.m_DnsHeader.QR != 0 || dnsProto.m_DnsHeader.Opcode != 0 || dnsProto.m_DnsHeader.QDCOUNT != 1)
+    {
+        ++m_nDropped;
+        return;
+    }
+
+    const auto& Question = dnsProto.m_pQuestions.get()[0];
+    REQUEST Request = { pUdpSocket, strFrom, dnsProto.m_DnsHeader.ID, dnsProto.m_DnsHeader.RD == 1, Question.LABEL.c_str(), Question.QTYPE, Question.QCLASS, chrono::steady_clock::now() + m_tWait };
+
+    // Only the link local names are ours to answer
+    const string strDomain = MakeKey(Request.strName, 0).first;
+    if (strDomain.size() < 6 || strDomain.compare(strDomain.size() - 6, 6, ".local") != 0)
+    {
+        ++m_nDropped;
+        SendAnswer(Request, true);  // REFUSED
+        return;
+    }
+
+    // A name whose owner told us by NSEC it has no such record gets the empty answer without asking again
+    if (SendAnswer(Request, false) == true || (m_Cache.IsNegative(Request.strName, Request.usType) == true && SendAnswer(Request, true) == true))
+    {
+        ++m_nAnsweredAtOnce;
+        return;
+    }
+
+    // Not known yet, the request waits for the answer to a multicast query. The port is left out, a client may use a new one for every query
+    if (m_ClientLimiter.Allow(strFrom.substr(0, strFrom.rfind(':'))) == false)
+    {
+        ++m_nRateLimited;
+        SendAnswer(Request, true);
+        return;
+    }
+
+    const KEY Key = MakeKey(Request.strName, Request.usType);
+    bool bSendQuery = false;
+    bool bLimited = false;
+    {
+        lock_guard<mutex> lock(m_mxPending);
+        if (m_maPending.size() >= MAXPENDING)
+        {
+            ++m_nDropped;
+            return;
+        }
+
+        const auto tNow = chrono::steady_clock::now();
+        auto itLast = m_maLastQuery.find(Key);
+        if (itLast == end(m_maLastQuery) || tNow - itLast->second >= chrono::seconds(1))
+        {
+            bSendQuery = m_MulticastLimiter.Allow(string());
+            bLimited = bSendQuery == false;
+            if (bSendQuery == true)
+                m_maLastQuery[Key] = tNow;
+        }
+        if (bLimited == false)
+        {
+            m_maPending.emplace(Key, Request);
+            m_cvPending.notify_all();
+        }
+    }
+
+    if (bLimited == true)
+    {
+        ++m_nRateLimited;
+        SendAnswer(Request, true);
+        return;
+    }
+
+    if (bSendQuery == true)
+    {
+        ++m_nMulticastQueries;
+        m_fnSendQuery(Request.strName, Request.usType);
+    }
+}
+
+bool DnsGateway::SendAnswer(const REQUEST& Request, bool bFinal)
+{
+    const string strDomain = MakeKey(Request.strName, 0).first;
+    const bool bRefused = strDomain.size() < 6 || strDomain.compare(strDomain.size() - 6, 6, ".local") != 0;
+
+    vector<ServiceRegistry::RECORD> vLocal, vAnswers, vAdditional;
+    if (bRefused == false)
+    {
+        m_fnLocalRecords(vLocal);
+        Collect(vLocal, Request.strName, Request.usType, vAnswers);
+    }
+    if (vAnswers.empty() == true && bFinal == false)
+        return false;
+
+    // Additional records as for DNS-SD over multicast, RFC 6763 12. PTR -> SRV and TXT of the instance, SRV -> addresses of the host
+    for (const auto& Record : vAnswers)
+    {
+        if (Record.usType == 12)
+        {
+            Collect(vLocal, Record.PtrData.second, 33, vAdditional);
+            Collect(vLocal, Record.PtrData.second, 16, vAdditional);
+        }
+    }
+    vector<string> vHosts;
+    for (const auto& Record : vAnswers)
+    {
+        if (Record.usType == 33)
+            vHosts.push_back(Record.SrvData.strHost.second);
+    }
+    for (const auto& Record : vAdditional)
+    {
+        if (Record.usType == 33)
+            vHosts.push_back(Record.SrvData.strHost.second);
+    }
+    for (size_t n = 0; n < vHosts.size(); ++n)
+    {
+        if (find_if(begin(vHosts), begin(vHosts) + n, [&](const string& strHost) { return ServiceRegistry::IsSameName(strHost, vHosts[n]); }) != begin(vHosts) + n)
+            continue;
+        Collect(vLocal, vHosts[n], 1, vAdditional);
+        Collect(vLocal, vHosts[n], 28, vAdditional);
+    }
+
+    DnsArena::Scope ArenaScope;
+    vector<DnsProtokol::QUESTIONITEM> QdList = { { { 0, Request.strName }, Request.usType, Request.usClass } };
+    vector<DnsProtokol::ANSWERITEM> AnList, NsList, ArList;
+    for (auto& Record : vAnswers)
+        AnList.push_back(ServiceRegistry::AsAnswer(Record, false, Record.iTtl));
+    for (auto& Record : vAdditional)
+        ArList.push_back(ServiceRegistry::AsAnswer(Record, false, Record.iTtl));
+
+    // A plain DNS answer has to fit into 512 bytes, the additional records go first, then the client is told to retry over TCP
+    bool bTruncated = false;
+    size_t nBufLen = 0;
+    for (int iTry = 0; iTry < 3; ++iTry)
+    {
+        nBufLen = 0;
+        DnsProtokol().BuildAnswer(Request.nId, QdList, AnList, NsList, ArList, nullptr, nBufLen);
+        if (nBufLen <= 512)
+            break;
+        if (ArList.empty() == false)
+            ArList.clear();
+        else
+        {
+            AnList.clear();
+            bTruncated = true;
+        }
+    }
+
+    DnsProtokol dnsProto;
+    auto pBuffer = MakeArenaArray<char>(nBufLen);
+    size_t nSendSize = dnsProto.BuildAnswer(Request.nId, QdList, AnList, NsList, ArList, &pBuffer[0], nBufLen);
+    DnsProtokol::SetUnicastFlags(&pBuffer[0], Request.bRecursionDesired, bTruncated, bRefused == true ? 5 : 0);
+    Request.pUdpSocket->Write(&pBuffer[0], nSendSize, Request.strFrom);
+    return true;
+}
+
+void DnsGateway::Collect(const vector<ServiceRegistry::RECORD>& vLocal, const string& strName, unsigned short usType, vector<ServiceRegistry::RECORD>& vRecords)
+{
+    // Addresses only valid on one link are of no use to a client somewhere else
+    for (const auto& Record : vLocal)
+    {
+        if ((Record.usType == usType || usType == 255) && ServiceRegistry::IsSameName(Record.strName, strName) == true && IsLinkLocal(Record) == false)
+            vRecords.push_back(Record);
+    }
+
+    const auto tNow = chrono::steady_clock::now();
+    const vector<unsigned short> vTypes = usType == 255 ? vector<unsigned short>{ 1, 28, 12, 16, 33 } : vector<unsigned short>{ usType };
+    for (const auto usCacheType : vTypes)
+    {
+        for (const auto& Entry : m_Cache.Lookup(strName, usCacheType))
+        {
+            ServiceRegistry::RECORD Record;
+            if (ServiceRegistry::FromCanonicalRData(Entry.strName, Entry.usType, Entry.strRData, Record) == false || IsLinkLocal(Record) == true)
+                continue;
+            Record.bUnique = false;
+            Record.iTtl = max(1, static_cast<int>(chrono::duration_cast<chrono::seconds>(Entry.tExpire - tNow).count()));
+            const string strRData = ServiceRegistry::GetCanonicalRData(Record);
+            if (none_of(begin(vRecords), end(vRecords), [&](const ServiceRegistry::RECORD& item) { return item.usType == Record.usType && ServiceRegistry::IsSameName(item.strName, Record.strName) == true && ServiceRegistry::GetCanonicalRData(item) == strRData; }))
+                vRecords.push_back(Record);
+        }
+    }
+}
+
+void DnsGateway::RecordChanged(const RecordCache::ENTRY& Entry, bool bAdded)
+{
+    if (bAdded == false)
+        return;
+
+    vector<REQUEST> vReady;
+    {
+        lock_guard<mutex> lock(m_mxPending);
+        for (const unsigned short usType : { Entry.usType, static_cast<unsigned short>(255) })
+        {
+            const auto& itRange = m_maPending.equal_range(MakeKey(Entry.strName, usType));
+            for (auto it = itRange.first; it != itRange.second; ++it)
+                vReady.push_back(it->second);
+            m_maPending.erase(itRange.first, itRange.second);
+        }
+    }
+
+    for (const auto& Request : vReady)
+        SendAnswer(Request, true);
+}
+
+void DnsGateway::Worker()
+{
+    unique_lock<mutex> lock(m_mxPending);
+    while (m_bStop == false)
+    {
+        auto tWakeUp = chrono::steady_clock::now() + chrono::seconds(1);
+        for (const auto& item : m_maPending)
+            tWakeUp = min(tWakeUp, item.second.tDeadline);
+        m_cvPending.wait_until(lock, tWakeUp);
+        if (m_bStop == true)
+            break;
+
+        const auto tNow = chrono::steady_clock::now();
+        vector<REQUEST> vTimedOut;
+        for (auto it = begin(m_maPending); it != end(m_maPending);)
+        {
+            if (it->second.tDeadline <= tNow)
+            {
+                vTimedOut.push_back(it->second);
+                it = m_maPending.erase(it);
+            }
+            else
+                ++it;
+        }
+        for (auto it = begin(m_maLastQuery); it != end(m_maLastQuery);)
+            it = tNow - it->second >= chrono::seconds(1) ? m_maLastQuery.erase(it) : next(it);
+
+        // Whatever arrived until now, maybe nothing
+        lock.unlock();
+        for (const auto& Request : vTimedOut)
+        {
+            ++m_nTimeouts;
+            SendAnswer(Request, true);
+        }
+        lock.lock();
+    }
+}
+
+DnsGateway::KEY DnsGateway::MakeKey(const string& strName, unsigned short usType)
+{
+    KEY Key(strName, usType);
+    transform(begin(Key.first), end(Key.first), begin(Key.first), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+    if (Key.first.empty() == false && Key.first.back() == '.')
+        Key.first.pop_back();
+    return Key;
+}
+
+bool DnsGateway::IsLinkLocal(const ServiceRegistry::RECORD& Record)
+{
+    if (Record.usType == 1)
+        return Record.Addr[0] == 169 && Record.Addr[1] == 254;              // 169.254.0.0/16
+    if (Record.usType == 28)
+        return Record.Addr[0] == 0xfe && (Record.Addr[1] & 0xc0) == 0x80;   // fe80::/10
+    return false;
+}
@@ -0,0 +1,116 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include "socketlib/SocketLib.h"
+#include "RecordCache.h"
+#include "ServiceRegistry.h"
+#include "RateLimiter.h"
+
+using namespace std;
+
+// Answers conventional unicast DNS queries for ".local" names on a UDP port, for clients that can not
+// reach the multicast group. Answers come from the record cache and our own records. A name not known
+// yet is asked for by multicast, the request waits a short time for the answer. All requests waiting
+// for the same name and type share one multicast query, and that query is not repeated within a second.
+// Names never asked for before would each cost a multicast, so the multicast queries together and the
+// requests of each client not answered at once are rate limited. Over the limit the empty answer goes
+// out at once and nothing waits.
+class DnsGateway
+{
+public:
+    typedef function<void(const string& strName, unsigned short usType)> QUERYSENDER;     // multicasts one question on all interfaces
+    typedef function<void(vector<ServiceRegistry::RECORD>& vRecords)> LOCALRECORDS;       // our own records of all interfaces
+
+    typedef struct
+    {
+        uint64_t nQueries;
+        uint64_t nAnsweredAtOnce;       // from the cache or our own records
+        uint64_t nMulticastQueries;     // sent for requests we could not answer at once
+        uint64_t nTimeouts;             // answered empty after the wait
+        uint64_t nDropped;              // malformed, refused or too many waiting
+        uint64_t nRateLimited;          // answered empty at once, the client or all together asked too much
+    }STATISTICS;
+
+    static const size_t MAXPENDING = 4096;
+
+public:
+    DnsGateway(RecordCache& Cache, QUERYSENDER fnSendQuery, LOCALRECORDS fnLocalRecords);
+    virtual ~DnsGateway();
+
+    bool Start(unsigned short nPort, chrono::milliseconds tWait);
+    void Stop();
+    STATISTICS GetStatistics() const;
+
+private:
+    typedef pair<string, unsigned short> KEY;   // lower case name, type
+
+    typedef struct
+    {
+        UdpSocket* pUdpSocket;
+        string strFrom;
+        unsigned short nId;
+        bool bRecursionDesired;
+        string strName;             // as asked, it is repeated in the answer
+        unsigned short usType;
+        unsigned short usClass;
+        chrono::steady_clock::time_point tDeadline;
+    }REQUEST;
+
+private:
+    void DatenEmpfangen(UdpSocket* pUdpSocket);
+    void Receive(UdpSocket* pUdpSocket);
+    bool SendAnswer(const REQUEST& Request, bool bFinal);
+    void Collect(const vector<ServiceRegistry::RECORD>& vLocal, const string& strName, unsigned short usType, vector<ServiceRegistry::RECORD>& vRecords);
+    void RecordChanged(const RecordCache::ENTRY& Entry, bool bAdded);
+    void Worker();
+
+    static KEY MakeKey(const string& strName, unsigned short usType);
+    static bool IsLinkLocal(const ServiceRegistry::RECORD& Record);
+
+private:
+    RecordCache&         m_Cache;
+    QUERYSENDER          m_fnSendQuery;
+    LOCALRECORDS         m_fnLocalRecords;
+    chrono::milliseconds m_tWait;
+    size_t               m_nCallbackId;
+    vector<unique_ptr<UdpSocket>> m_vSockets;
+
+    mutex                m_mxPending;       // guards the members below
+    condition_variable   m_cvPending;
+    thread               m_thWorker;
+    bool                 m_bStop;
+    size_t               m_nReceiving;      // DatenEmpfangen calls running, Stop waits for them before the sockets go
+    multimap<KEY, REQUEST> m_maPending;
+    map<KEY, chrono::steady_clock::time_point> m_maLastQuery;
+    RateLimiter          m_MulticastLimiter;    // all multicast queries together, 10 a second, bursts up to 20
+    RateLimiter          m_ClientLimiter;       // per client address, requests not answered at once, 5 a second, bursts up to 10
+
+    atomic<uint64_t>     m_nQueries;
+    atomic<uint64_t>     m_nAnsweredAtOnce;
+    atomic<uint64_t>     m_nMulticastQueries;
+    atomic<uint64_t>     m_nTimeouts;
+    atomic<uint64_t>     m_nDropped;
+    atomic<uint64_t>     m_nRateLimited;
+};
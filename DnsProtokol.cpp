@@ -10,10 +10,8 @@
    Email:   Thomas@fam-hauck.de
 */
 
-#include <sstream>
-#include <regex>
-#include <iomanip>
-#include <map>
+#include <cstdio>
+#include <algorithm>
 #include <memory>
 
 #if defined (_WIN32) || defined (_WIN64)
@@ -24,7 +22,7 @@
 #include "DnsProtokol.h"
 
 
-DnsProtokol::DnsProtokol(unsigned char* szBuffer, size_t nBytInBuf)
+DnsProtokol::DnsProtokol(unsigned char* szBuffer, size_t nBytInBuf) : m_pMemoBuffer(nullptr), m_nMemoSize(0)
 {
     copy(&szBuffer[0], &szBuffer[sizeof(DNSHEADER)], reinterpret_cast<unsigned char*>(&m_DnsHeader));
     m_DnsHeader.ID = ntohs(m_DnsHeader.ID);
@@ -42,25 +40,25 @@ DnsProtokol::DnsProtokol(unsigned char* szBuffer, size_t nBytInBuf)
 
         if (m_DnsHeader.QDCOUNT > 0)
         {
-            m_pQuestions = make_unique<QUESTTION[]>(m_DnsHeader.QDCOUNT);
+            m_pQuestions = MakeArenaArray<QUESTTION>(m_DnsHeader.QDCOUNT);
             pBufPointer += ExtractQuestion(pBufPointer, szBuffer, nBytInBuf, m_DnsHeader.QDCOUNT, m_pQuestions.get());
         }
 
         if (m_DnsHeader.ANCOUNT > 0)
         {
-            m_pAnswers = make_unique<RRECORDS[]>(m_DnsHeader.ANCOUNT);
+            m_pAnswers = MakeArenaArray<RRECORDS>(m_DnsHeader.ANCOUNT);
             pBufPointer += ExtractRRecords(pBufPointer, szBuffer, nBytInBuf, m_DnsHeader.ANCOUNT, m_pAnswers.get());
         }
 
         if (m_DnsHeader.NSCOUNT > 0)
         {
-            m_pNameServ = make_unique<RRECORDS[]>(m_DnsHeader.NSCOUNT);
+            m_pNameServ = MakeArenaArray<RRECORDS>(m_DnsHeader.NSCOUNT);
             pBufPointer += ExtractRRecords(pBufPointer, szBuffer, nBytInBuf, m_DnsHeader.NSCOUNT, m_pNameServ.get());
         }
 
         if (m_DnsHeader.ARCOUNT > 0)
         {
-            m_pExtraRec = make_unique<RRECORDS[]>(m_DnsHeader.ARCOUNT);
+            m_pExtraRec = MakeArenaArray<RRECORDS>(m_DnsHeader.ARCOUNT);
             pBufPointer += ExtractRRecords(pBufPointer, szBuffer, nBytInBuf, m_DnsHeader.ARCOUNT, m_pExtraRec.get());
         }
 
@@ -104,9 +102,28 @@ size_t DnsProtokol::BuildSearch(const string& strQuestion, char* szBuffer, size_
 }
 
 size_t DnsProtokol::BuildAnswer(vector<ANSWERITEM>& AnList, vector<ANSWERITEM>& NsList, vector<ANSWERITEM>& ArList, char* szBuffer, size_t& nBuflen)
+{
+    vector<QUESTIONITEM> QdList;
+    return BuildPacket(true, 0, QdList, AnList, NsList, ArList, szBuffer, nBuflen);
+}
+
+size_t DnsProtokol::BuildAnswer(unsigned short nId, vector<QUESTIONITEM>& QdList, vector<ANSWERITEM>& AnList, vector<ANSWERITEM>& NsList, vector<ANSWERITEM>& ArList, char* szBuffer, size_t& nBuflen)
+{
+    return BuildPacket(true, nId, QdList, AnList, NsList, ArList, szBuffer, nBuflen);
+}
+
+size_t DnsProtokol::BuildQuery(vector<QUESTIONITEM>& QdList, vector<ANSWERITEM>& AnList, vector<ANSWERITEM>& NsList, char* szBuffer, size_t& nBuflen)
+{
+    vector<ANSWERITEM> ArList;
+    return BuildPacket(false, 0, QdList, AnList, NsList, ArList, szBuffer, nBuflen);
+}
+
+size_t DnsProtokol::BuildPacket(bool bResponse, unsigned short nId, vector<QUESTIONITEM>& QdList, vector<ANSWERITEM>& AnList, vector<ANSWERITEM>& NsList, vector<ANSWERITEM>& ArList, char* szBuffer, size_t& nBuflen)
 {
     // Build the Label reference table
     OFFSETLIST lstOffsetListe;
+    for (auto& item : QdList)
+        item.strLabel.first = BuildLabelReferenc(item.strLabel.second, lstOffsetListe);
     auto fnExtractLabels = [&lstOffsetListe, this](vector<ANSWERITEM>& theList)
     {
         for (auto& item : theList)
@@ -114,7 +131,7 @@ size_t DnsProtokol::BuildAnswer(vector<ANSWERITEM>& AnList, vector<ANSWERITEM>&
             item.strLabel.first = BuildLabelReferenc(item.strLabel.second, lstOffsetListe);
             if (item.usType == 12)  // PTR
                 item.rData.ptrData->first = BuildLabelReferenc(item.rData.ptrData->second, lstOffsetListe);
-            if (item.usType == 33)  // PTR
+            if (item.usType == 33)  // SRV
                 item.rData.svData->strHost.first = BuildLabelReferenc(item.rData.svData->strHost.second, lstOffsetListe);
         }
     };
@@ -136,6 +153,12 @@ size_t DnsProtokol::BuildAnswer(vector<ANSWERITEM>& AnList, vector<ANSWERITEM>&
         }
     };
     size_t nBufLenNeeded = 0;
+    for (const auto& item : QdList)
+    {
+        size_t nQLen = 0;
+        BuildQuestion(lstOffsetListe, item.strLabel.first, item.usType, item.usClass, nullptr, nQLen, nullptr);
+        nBufLenNeeded += nQLen;
+    }
     fnCalcBufferSize(AnList, nBufLenNeeded);
     fnCalcBufferSize(NsList, nBufLenNeeded);
     fnCalcBufferSize(ArList, nBufLenNeeded);
@@ -161,17 +184,20 @@ size_t DnsProtokol::BuildAnswer(vector<ANSWERITEM>& AnList, vector<ANSWERITEM>&
         }
         return pPtrBuffer;
     };
+    for (const auto& item : QdList)
+        pPtrBuffer = BuildQuestion(lstOffsetListe, item.strLabel.first, item.usType, item.usClass, pPtrBuffer, nBuflen, szBuffer);
     pPtrBuffer = fnBuildRecords(AnList, pPtrBuffer, nBuflen, szBuffer);
     pPtrBuffer = fnBuildRecords(NsList, pPtrBuffer, nBuflen, szBuffer);
     pPtrBuffer = fnBuildRecords(ArList, pPtrBuffer, nBuflen, szBuffer);
 
     // Set the DNS header data
     DNSHEADER* pDnsHeader = reinterpret_cast<DNSHEADER*>(szBuffer);
-    pDnsHeader->ID = 0;
+    pDnsHeader->ID = htons(nId);
     pDnsHeader->Opcode = 0;
-    pDnsHeader->QR = 1;
+    pDnsHeader->QR = bResponse == true ? 1 : 0;
     pDnsHeader->RD = 0;
-    pDnsHeader->AA = 0;
+    pDnsHeader->AA = bResponse == true ? 1 : 0;  // mDNS responses are always authoritative (RFC 6762 18.4)
+    pDnsHeader->QDCOUNT = htons(static_cast<unsigned short>(QdList.size()));
     pDnsHeader->ANCOUNT = htons(static_cast<unsigned short>(AnList.size()));
     pDnsHeader->NSCOUNT = htons(static_cast<unsigned short>(NsList.size()));
     pDnsHeader->ARCOUNT = htons(static_cast<unsigned short>(ArList.size()));
@@ -179,36 +205,174 @@ size_t DnsProtokol::BuildAnswer(vector<ANSWERITEM>& AnList, vector<ANSWERITEM>&
     return pPtrBuffer - szBuffer;
 }
 
-size_t DnsProtokol::ExtractLabels(const unsigned char* pLabel, const unsigned char* pBuffer, size_t nBytInBuf, string& strLabel)
+void DnsProtokol::SetUnicastFlags(char* szBuffer, bool bRecursionDesired, bool bTruncated, unsigned char nRCode)
+{
+    DNSHEADER* pDnsHeader = reinterpret_cast<DNSHEADER*>(szBuffer);
+    pDnsHeader->RD = bRecursionDesired == true ? 1 : 0;
+    pDnsHeader->TC = bTruncated == true ? 1 : 0;
+    pDnsHeader->RCODE = nRCode & 0x0f;
+}
+
+bool DnsProtokol::IsUnwantedQuery(const unsigned char* szBuffer, size_t nBytInBuf, const function<bool(const char*, size_t, unsigned short)>& fnAccept)
+{
+    if (nBytInBuf < sizeof(DNSHEADER))
+        return false;
+    if ((szBuffer[2] & 0x80) != 0 || (szBuffer[2] & 0x78) != 0) // QR bit set (response) or Opcode not QUERY
+        return false;
+
+    const unsigned short nQdCount = static_cast<unsigned short>((szBuffer[4] << 8) | szBuffer[5]);
+    const unsigned char* pCurPointer = szBuffer + sizeof(DNSHEADER);
+    const unsigned char* pBufEnd = szBuffer + nBytInBuf;
+    char szName[256];
+
+    for (unsigned short n = 0; n < nQdCount; ++n)
+    {
+        const unsigned char* pLabel = pCurPointer;
+        const unsigned char* pAfterName = nullptr;
+        size_t nNameLen = 0;
+        int iHops = 0;
+
+        for (;;)
+        {
+            if (pLabel >= pBufEnd)
+                return false;
+            const unsigned char iTokenLen = *pLabel;
+            if ((iTokenLen & 0xc0) == 0xc0)
+            {
+                if (pLabel + 1 >= pBufEnd || ++iHops > MAXHOPS)
+                    return false;
+                const unsigned char* pTarget = szBuffer + (((iTokenLen & 0x3f) << 8) | pLabel[1]);
+                if (pTarget >= pLabel)  // compression pointers must point backwards
+                    return false;
+                if (pAfterName == nullptr)
+                    pAfterName = pLabel + 2;
+                pLabel = pTarget;
+                continue;
+            }
+            if (iTokenLen > 63)
+                return false;
+            ++pLabel;
+            if (iTokenLen == 0)
+                break;
+            if (pLabel + iTokenLen > pBufEnd || nNameLen + iTokenLen + 1 >= sizeof(szName))
+                return false;
+            if (nNameLen > 0)
+                szName[nNameLen++] = '.';
+            copy(pLabel, pLabel + iTokenLen, szName + nNameLen);
+            nNameLen += iTokenLen;
+            pLabel += iTokenLen;
+        }
+
+        if (pAfterName == nullptr)
+            pAfterName = pLabel;
+        if (pAfterName + 4 > pBufEnd)
+            return false;
+
+        if (fnAccept(szName, nNameLen, static_cast<unsigned short>((pAfterName[0] << 8) | pAfterName[1])) == true)
+            return false;
+        pCurPointer = pAfterName + 4;
+    }
+
+    return true;
+}
+
+size_t DnsProtokol::ExtractLabels(const unsigned char* pLabel, const unsigned char* pBuffer, size_t nBytInBuf, ARENASTRING& strLabel)
 {
+    // Records of a datagram share their suffixes (the service type, "local"). Every label decoded is remembered
+    // with the text of the name from there on, a pointer to it or a name starting at it copies that text
+    if (m_pMemoBuffer != pBuffer || m_nMemoSize != nBytInBuf)
+    {
+        m_pNameMemo = MakeArenaArray<NAMEMEMO>(nBytInBuf);
+        m_strMemoNames.clear();
+        m_pMemoBuffer = pBuffer;
+        m_nMemoSize = nBytInBuf;
+    }
+
+    typedef struct
+    {
+        size_t nOffset;
+        size_t nTextStart;          // in strLabel
+        size_t nInPlace;
+    }VISITED;
+    VISITED arVisited[128];         // a name of 255 bytes has at most 127 labels
+    size_t nVisited = 0;
+    size_t nRunFirst = 0;           // the first label read since the last pointer
+
     const unsigned char* pStart = pLabel;
-    char iTokenLen = *pLabel++;
-    while (iTokenLen != 0)
+    const unsigned char* pBufEnd = pBuffer + nBytInBuf;
+    const unsigned char* pRunStart = pLabel;    // a pointer must lead before the labels read since the last one, or it loops
+    const unsigned char* pAfterName = nullptr;
+    size_t nWireLen = 1;            // the root label
+    int iHops = 0;
+
+    auto fnEndRun = [&](const unsigned char* pRunEnd)
     {
-        if ((iTokenLen & 0xc0) == 0xc0)
+        for (; nRunFirst < nVisited; ++nRunFirst)
+            arVisited[nRunFirst].nInPlace = (pRunEnd - pBuffer) - arVisited[nRunFirst].nOffset;
+        if (pAfterName == nullptr)
+            pAfterName = pRunEnd;
+    };
+
+    for (;;)
+    {
+        if (pLabel >= pBufEnd)
+            throw DnsProtoException("Invalid buffer content");  // In case we recieved a corupted datagram
+
+        const NAMEMEMO& Memo = m_pNameMemo[pLabel - pBuffer];
+        if (Memo.nLen != 0)
         {
-            size_t nOffset = ntohs(*((short*)--pLabel)) & 0x3fff;
-            if (nOffset > static_cast<size_t>(pLabel - pBuffer))
+            nWireLen += Memo.nLen + 1;
+            if (nWireLen > 255)
                 throw DnsProtoException("Error extraction label");
-            ExtractLabels(pBuffer + nOffset, pBuffer, nBytInBuf, strLabel);
-            pLabel += 2;
+            if (strLabel.empty() == false)
+                strLabel += ".";
+            strLabel.append(m_strMemoNames, Memo.nStart, Memo.nLen);
+            fnEndRun(pLabel + Memo.nInPlace);
             break;
         }
-        else
+
+        const unsigned char iTokenLen = *pLabel;
+        if ((iTokenLen & 0xc0) == 0xc0)
         {
-            if (iTokenLen > 64)
+            if (pLabel + 1 >= pBufEnd || ++iHops > MAXHOPS)
                 throw DnsProtoException("Error extraction label");
-            if (pLabel + iTokenLen > pBuffer + nBytInBuf)
-                throw DnsProtoException("Invalid buffer content");  // In case we recieved a corupted datagram
-            if (strLabel.empty() == false)
-                strLabel += ".";
-            strLabel += string(reinterpret_cast<const char*>(pLabel), iTokenLen);
-            pLabel += iTokenLen;
+            const unsigned char* pTarget = pBuffer + (((iTokenLen & 0x3f) << 8) | pLabel[1]);
+            if (pTarget >= pRunStart)
+                throw DnsProtoException("Error extraction label");
+            fnEndRun(pLabel + 2);
+            pLabel = pRunStart = pTarget;
+            continue;
+        }
+        if (iTokenLen > 63)
+            throw DnsProtoException("Error extraction label");
+        if (iTokenLen == 0)
+        {
+            fnEndRun(pLabel + 1);
+            break;
         }
-        iTokenLen = *pLabel++;
+        if (pLabel + 1 + iTokenLen > pBufEnd)
+            throw DnsProtoException("Invalid buffer content");  // In case we recieved a corupted datagram
+        nWireLen += iTokenLen + 1;
+        if (nWireLen > 255)
+            throw DnsProtoException("Error extraction label");
+
+        if (strLabel.empty() == false)
+            strLabel += ".";
+        arVisited[nVisited++] = { static_cast<size_t>(pLabel - pBuffer), strLabel.size(), 0 };
+        strLabel.append(reinterpret_cast<const char*>(pLabel + 1), iTokenLen);
+        pLabel += iTokenLen + 1;
+    }
+
+    if (nVisited > 0)
+    {
+        const size_t nTextStart = arVisited[0].nTextStart;
+        const size_t nMemoStart = m_strMemoNames.size();
+        m_strMemoNames.append(strLabel, nTextStart, string::npos);
+        for (size_t n = 0; n < nVisited; ++n)
+            m_pNameMemo[arVisited[n].nOffset] = { static_cast<uint32_t>(nMemoStart + arVisited[n].nTextStart - nTextStart), static_cast<uint16_t>(strLabel.size() - arVisited[n].nTextStart), static_cast<uint16_t>(arVisited[n].nInPlace) };
     }
 
-    return pLabel - pStart;
+    return pAfterName - pStart;
 }
 
 size_t DnsProtokol::ExtractQuestion(const unsigned char* pCurPointer, const unsigned char* pBuffer, size_t nBytInBuf, short nNoQuestion, QUESTTION* pQuestion)
@@ -219,6 +383,8 @@ size_t DnsProtokol::ExtractQuestion(const unsigned char* pCurPointer, const unsi
         pCurPointer += ExtractLabels(pCurPointer, pBuffer, nBytInBuf, pQuestion[n].LABEL);
         pQuestion[n].QTYPE = ntohs(*(short*)pCurPointer);
         pQuestion[n].QCLASS = ntohs(*(short*)(pCurPointer + 2));
+        pQuestion[n].QU = (pQuestion[n].QCLASS & 0x8000) != 0;
+        pQuestion[n].QCLASS &= 0x7fff;
         pCurPointer += 4;
 
         if (pCurPointer > pBuffer + nBytInBuf)
@@ -241,6 +407,7 @@ size_t DnsProtokol::ExtractRRecords(const unsigned char* pCurPointer, const unsi
         pRRecord[n].TTL = ntohl(*reinterpret_cast<const unsigned int*>(pCurPointer + 4));
         pRRecord[n].RDLENGTH = ntohs(*reinterpret_cast<const unsigned short*>(pCurPointer + 8));
         pCurPointer += 10;
+        pRRecord[n].RDOFFSET = pCurPointer - pBuffer;
 
         if (pCurPointer + pRRecord[n].RDLENGTH > pBuffer + nBytInBuf)
             throw DnsProtoException("Invalid buffer content");  // In case we recieved a corupted datagram
@@ -249,9 +416,9 @@ size_t DnsProtokol::ExtractRRecords(const unsigned char* pCurPointer, const unsi
         {
         case 1:     // A    (IPv4)
         {
-            stringstream ss;
-            ss << static_cast<unsigned int>(*pCurPointer) << "." << static_cast<unsigned int>(*(pCurPointer + 1)) << "." << static_cast<unsigned int>(*(pCurPointer + 2)) << "." << static_cast<unsigned int>(*(pCurPointer + 3));
-            pRRecord[n].RDATA = ss.str();
+            char szTmp[16];
+            int nLen = snprintf(szTmp, sizeof(szTmp), "%u.%u.%u.%u", static_cast<unsigned int>(*pCurPointer), static_cast<unsigned int>(*(pCurPointer + 1)), static_cast<unsigned int>(*(pCurPointer + 2)), static_cast<unsigned int>(*(pCurPointer + 3)));
+            pRRecord[n].RDATA.assign(szTmp, nLen);
         }
         break;
         case 12:    // PTR
@@ -267,7 +434,9 @@ size_t DnsProtokol::ExtractRRecords(const unsigned char* pCurPointer, const unsi
                 {
                     if (nTxtOff != 0)
                         pRRecord[n].RDATA += ",";
-                    pRRecord[n].RDATA += "\"" + string(reinterpret_cast<const char*>(pCurPointer + nTxtOff + 1), nTxtLen) + "\"";
+                    pRRecord[n].RDATA += "\"";
+                    pRRecord[n].RDATA.append(reinterpret_cast<const char*>(pCurPointer + nTxtOff + 1), nTxtLen);
+                    pRRecord[n].RDATA += "\"";
                 }
                 nTxtOff += nTxtLen + 1;
             }
@@ -275,52 +444,51 @@ size_t DnsProtokol::ExtractRRecords(const unsigned char* pCurPointer, const unsi
         break;
         case 28:    // AAAA (IPv6)
         {
-            stringstream ss;
+            char szTmp[4];
+            pRRecord[n].RDATA.reserve(pRRecord[n].RDLENGTH * 5 / 2);
             for (int i = 0; i < pRRecord[n].RDLENGTH; ++i)
             {
-                if (i > 0 && i % 2 == 0) ss << ":";
-                ss << setfill('0') << hex << setw(2) << static_cast<unsigned int>(*(pCurPointer + i));
+                if (i > 0 && i % 2 == 0) pRRecord[n].RDATA += ":";
+                pRRecord[n].RDATA.append(szTmp, snprintf(szTmp, sizeof(szTmp), "%02x", static_cast<unsigned int>(*(pCurPointer + i))));
             }
-            pRRecord[n].RDATA = ss.str();
         }
         break;
         case 33:    // SRV
         {
-            stringstream ss;
-            ss << ntohs(*(unsigned short*)pCurPointer) << " " << ntohs(*(unsigned short*)(pCurPointer + 2)) << " " << ntohs(*(unsigned short*)(pCurPointer + 4)) << " ";
-            string strTemp;
+            char szTmp[24];
+            int nLen = snprintf(szTmp, sizeof(szTmp), "%u %u %u ", ntohs(*(unsigned short*)pCurPointer), ntohs(*(unsigned short*)(pCurPointer + 2)), ntohs(*(unsigned short*)(pCurPointer + 4)));
+            pRRecord[n].RDATA.assign(szTmp, nLen);
             if (pRRecord[n].RDLENGTH > 6)
+            {
+                ARENASTRING strTemp;
                 ExtractLabels(pCurPointer + 6, pBuffer, nBytInBuf, strTemp);
-            ss << strTemp;
-            pRRecord[n].RDATA = ss.str();
+                pRRecord[n].RDATA += strTemp;
+            }
         }
         break;
         case 41:    // EDNS (Extending DNS)
         {
             short sOptionCode = ntohs(*(unsigned short*)pCurPointer);
             short sOptionLen = ntohs(*(unsigned short*)pCurPointer + 2);
-            stringstream ss;
-            ss << "OptCode: " << sOptionCode << ", OptLen: " << sOptionLen << " -> ";
+            char szTmp[48];
+            pRRecord[n].RDATA.assign(szTmp, snprintf(szTmp, sizeof(szTmp), "OptCode: %d, OptLen: %d -> ", sOptionCode, sOptionLen));
             for (int i = 0; i < pRRecord[n].RDLENGTH - 4; ++i)
             {
-                if (i > 0) ss << " ";
-                ss << "0x" << setfill('0') << hex << setw(2) << static_cast<unsigned int>(*(pCurPointer + 4 + i));
+                if (i > 0) pRRecord[n].RDATA += " ";
+                pRRecord[n].RDATA.append(szTmp, snprintf(szTmp, sizeof(szTmp), "0x%02x", static_cast<unsigned int>(*(pCurPointer + 4 + i))));
             }
-            pRRecord[n].RDATA = ss.str();
         }
         break;
-        case 47:    // NSEC
+        case 47:    // NSEC, "next.name.local 1 16 33"
         {
             size_t iLabelSize = ExtractLabels(pCurPointer, pBuffer, nBytInBuf, pRRecord[n].RDATA);
-            if (pRRecord[n].RDLENGTH > iLabelSize)
+            vector<unsigned short> vTypes;
+            if (pRRecord[n].RDLENGTH >= iLabelSize)
+                DecodeTypeBitmaps(pCurPointer + iLabelSize, pRRecord[n].RDLENGTH - iLabelSize, vTypes);
+            for (const auto usType : vTypes)
             {
-                stringstream ss;
-                for (size_t i = 0; i < pRRecord[n].RDLENGTH - iLabelSize; ++i)
-                {
-                    if (i > 0) ss << "|";
-                    ss << setfill('0') << hex << setw(2) << static_cast<unsigned int>(*(pCurPointer + iLabelSize + i));
-                }
-                pRRecord[n].RDATA += ", " + ss.str();
+                char szTmp[8];
+                pRRecord[n].RDATA.append(szTmp, snprintf(szTmp, sizeof(szTmp), " %u", static_cast<unsigned int>(usType)));
             }
         }
         break;
@@ -334,15 +502,158 @@ size_t DnsProtokol::ExtractRRecords(const unsigned char* pCurPointer, const unsi
     return pCurPointer - pStart;
 }
 
+string DnsProtokol::GetCanonicalRData(const unsigned char* szBuffer, size_t nBytInBuf, const RRECORDS& Record)
+{
+    const unsigned char* pRData = szBuffer + Record.RDOFFSET;
+    if (Record.RDOFFSET + Record.RDLENGTH > nBytInBuf)
+        return string();
+
+    ARENASTRING strName;
+    switch (Record.TYPE)
+    {
+    case 2:     // NS
+    case 5:     // CNAME
+    case 12:    // PTR
+        ExtractLabels(pRData, szBuffer, nBytInBuf, strName);
+        return EncodeName(string(begin(strName), end(strName)));
+    case 33:    // SRV
+        if (Record.RDLENGTH <= 6)
+            break;
+        ExtractLabels(pRData + 6, szBuffer, nBytInBuf, strName);
+        return string(reinterpret_cast<const char*>(pRData), 6) + EncodeName(string(begin(strName), end(strName)));
+    case 47:    // NSEC, the next domain name followed by the type bitmaps
+        try
+        {
+            // The decoder did not look into the RDATA of this type, it may be broken
+            const size_t nNameLen = ExtractLabels(pRData, szBuffer, nBytInBuf, strName);
+            if (nNameLen > Record.RDLENGTH)
+                break;
+            return EncodeName(string(begin(strName), end(strName))) + string(reinterpret_cast<const char*>(pRData) + nNameLen, Record.RDLENGTH - nNameLen);
+        }
+        catch (DnsProtoException&)
+        {
+        }
+        break;
+    default:
+        break;
+    }
+    return string(reinterpret_cast<const char*>(pRData), Record.RDLENGTH);
+}
+
+template<class STR>
+void DnsProtokol::AppendName(const string& strName, STR& strOut)
+{
+    strOut.reserve(strOut.size() + strName.size() + 2);
+    size_t nStart = 0;
+    for (size_t nPos = strName.find('.'); nPos != string::npos; nStart = nPos + 1, nPos = strName.find('.', nStart))
+    {
+        strOut += static_cast<char>(nPos - nStart);
+        strOut.append(strName.c_str() + nStart, nPos - nStart);
+    }
+    if (nStart < strName.size())
+    {
+        strOut += static_cast<char>(strName.size() - nStart);
+        strOut.append(strName.c_str() + nStart, strName.size() - nStart);
+    }
+    strOut += '\0';
+}
+
+template<class STR>
+void DnsProtokol::AppendTypeBitmaps(const vector<unsigned short>& vTypes, STR& strOut)
+{
+    // Per window of 256 types: window number, length of the bit map, the bit map without trailing zero bytes
+    vector<unsigned short, ArenaAllocator<unsigned short>> vSorted(begin(vTypes), end(vTypes));
+    sort(begin(vSorted), end(vSorted));
+    for (size_t n = 0; n < vSorted.size();)
+    {
+        const unsigned char nWindow = static_cast<unsigned char>(vSorted[n] >> 8);
+        unsigned char Bitmap[32] = { 0 };
+        size_t nLen = 0;
+        for (; n < vSorted.size() && (vSorted[n] >> 8) == nWindow; ++n)
+        {
+            const unsigned char nBit = static_cast<unsigned char>(vSorted[n] & 0xff);
+            Bitmap[nBit / 8] |= 0x80 >> (nBit % 8);
+            nLen = max(nLen, static_cast<size_t>(nBit / 8 + 1));
+        }
+        strOut += static_cast<char>(nWindow);
+        strOut += static_cast<char>(nLen);
+        strOut.append(reinterpret_cast<const char*>(Bitmap), nLen);
+    }
+}
+
+string DnsProtokol::EncodeName(const string& strName)
+{
+    string strEncoded;
+    AppendName(strName, strEncoded);
+    return strEncoded;
+}
+
+string DnsProtokol::DecodeName(const string& strEncoded, size_t& nOffset)
+{
+    string strName;
+    while (nOffset < strEncoded.size())
+    {
+        const size_t nLen = static_cast<unsigned char>(strEncoded[nOffset++]);
+        if (nLen == 0)
+            return strName;
+        if (nLen > 63 || nOffset + nLen > strEncoded.size())
+            break;
+        if (strName.empty() == false)
+            strName += '.';
+        strName.append(strEncoded, nOffset, nLen);
+        nOffset += nLen;
+    }
+    nOffset = strEncoded.size();
+    return string();
+}
+
+string DnsProtokol::EncodeTypeBitmaps(vector<unsigned short> vTypes)
+{
+    string strBitmaps;
+    AppendTypeBitmaps(vTypes, strBitmaps);
+    return strBitmaps;
+}
+
+bool DnsProtokol::DecodeTypeBitmaps(const unsigned char* pData, size_t nLen, vector<unsigned short>& vTypes)
+{
+    vTypes.clear();
+    for (size_t nPos = 0; nPos < nLen;)
+    {
+        if (nPos + 2 > nLen || pData[nPos + 1] == 0 || pData[nPos + 1] > 32 || nPos + 2 + pData[nPos + 1] > nLen)
+            return false;
+        const unsigned short nWindow = pData[nPos];
+        for (size_t i = 0; i < pData[nPos + 1]; ++i)
+        {
+            for (int iBit = 0; iBit < 8; ++iBit)
+            {
+                if ((pData[nPos + 2 + i] & (0x80 >> iBit)) != 0)
+                    vTypes.push_back(static_cast<unsigned short>((nWindow << 8) | (i * 8 + iBit)));
+            }
+        }
+        nPos += 2 + pData[nPos + 1];
+    }
+    return true;
+}
+
+bool DnsProtokol::ParseNsec(const string& strRData, string& strNextName, vector<unsigned short>& vTypes)
+{
+    size_t nOffset = 0;
+    strNextName = DecodeName(strRData, nOffset);
+    if (strNextName.empty() == true && (strRData.empty() == true || strRData[0] != 0))
+        return false;
+    return DecodeTypeBitmaps(reinterpret_cast<const unsigned char*>(strRData.data()) + nOffset, strRData.size() - nOffset, vTypes);
+}
+
 size_t DnsProtokol::BuildLabelReferenc(const string& strLabel, OFFSETLIST& OffListe)
 {
     LABELLIST vLabelTokens;
-    regex seperator("\\.");
-    sregex_token_iterator token(begin(strLabel), end(strLabel), seperator, -1);
-    while (token != sregex_token_iterator())
-        vLabelTokens.emplace_back(0, *token++);
+    size_t nStart = 0;
+    for (size_t nPos = strLabel.find('.'); nPos != string::npos; nStart = nPos + 1, nPos = strLabel.find('.', nStart))
+        vLabelTokens.emplace_back(0, ARENASTRING(strLabel.c_str() + nStart, nPos - nStart));
+    if (nStart < strLabel.size())
+        vLabelTokens.emplace_back(0, ARENASTRING(strLabel.c_str() + nStart, strLabel.size() - nStart));
 
-    map<size_t, size_t> mFound;
+    size_t nFoundLen = 0, nFoundRef = 0;    // longest suffix we already have somewhere and where it is
     for (size_t n = 0; n < OffListe.size(); ++n)
     {
         for (size_t i = 0; i < vLabelTokens.size(); ++i)
@@ -357,15 +668,19 @@ size_t DnsProtokol::BuildLabelReferenc(const string& strLabel, OFFSETLIST& OffLi
 
                     // wie write in the string how already exist somewhere else the Item ( + 1) and Index where it starts
                     // the + 1 to different in the first label with zero index
-                    mFound.emplace(vLabelTokens.size() - i, ((n + 1) << 16) | m);
+                    if (vLabelTokens.size() - i > nFoundLen)
+                    {
+                        nFoundLen = vLabelTokens.size() - i;
+                        nFoundRef = ((n + 1) << 16) | m;
+                    }
                 }
             }
         }
     }
 
     OffListe.emplace_back(0, vLabelTokens);
-    if (mFound.size() > 0)
-        OffListe.back().second[vLabelTokens.size() - mFound.rbegin()->first].first = mFound.rbegin()->second;
+    if (nFoundLen > 0)
+        OffListe.back().second[vLabelTokens.size() - nFoundLen].first = nFoundRef;
     return OffListe.size();
 }
 
@@ -538,6 +853,22 @@ char* DnsProtokol::BuildRData(unsigned short TYPE, RDATA rData, char* pBufPointe
             nBufLen += 6;
         }
         break;
+    case 47:    // NSEC -> the next domain name goes uncompressed, not every decoder expects a pointer in there
+    {
+        ARENASTRING strRData;
+        AppendName(rData.nsData->strNextName.second, strRData);
+        AppendTypeBitmaps(rData.nsData->vTypes, strRData);
+        if (nBufLen < strRData.size())
+        {
+            nBufLen = strRData.size();
+            break;
+        }
+        copy(begin(strRData), end(strRData), pBufPointer);
+        pBufPointer += strRData.size();
+        nBufLen -= strRData.size();
+        *pRdataLen = htons(static_cast<uint16_t>(strRData.size()));
+    }
+    break;
     default:
         break;
     }
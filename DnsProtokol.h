@@ -14,6 +14,10 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <functional>
+
+#include "DnsArena.h"
 
 using namespace std;
 
@@ -22,14 +26,16 @@ class DnsProtokol
     typedef struct
     {
         unsigned short ID;          // A 16 bit identifier assigned by the program that generates any kind of query
-        unsigned short QR : 1;      // 0 = query, 1 = response
-        unsigned short Opcode : 4;  // 0 = a standard query(QUERY), 1 = an inverse query(IQUERY), 2 = a server status request(STATUS), 3-15 = reserved for future use
-        unsigned short AA : 1;      // Authoritative Answer
-        unsigned short TC : 1;      // TrunCation
+        // The flags are copied unswapped from the datagram, on little endian machines the bit fields are filled
+        // from the lowest bit of the first byte. That is why the order is the reverse of the one in RFC 1035
         unsigned short RD : 1;      // Recursion Desired
-        unsigned short RA : 1;      // Recursion Available
-        unsigned short Z : 3;       // Reserved for future use
+        unsigned short TC : 1;      // TrunCation
+        unsigned short AA : 1;      // Authoritative Answer
+        unsigned short Opcode : 4;  // 0 = a standard query(QUERY), 1 = an inverse query(IQUERY), 2 = a server status request(STATUS), 3-15 = reserved for future use
+        unsigned short QR : 1;      // 0 = query, 1 = response
         unsigned short RCODE : 4;   // Response code
+        unsigned short Z : 3;       // Reserved for future use
+        unsigned short RA : 1;      // Recursion Available
         unsigned short QDCOUNT;     // number of entries in the question section
         unsigned short ANCOUNT;     // number of resource records in the answer section
         unsigned short NSCOUNT;     // number of name server resource records in the authority records section
@@ -38,17 +44,28 @@ class DnsProtokol
 
     typedef struct
     {
-        string LABEL;
+        ARENASTRING LABEL;
         unsigned short QTYPE;
-        unsigned short QCLASS;
+        unsigned short QCLASS;      // without the top bit, that one is in QU
+        bool QU;                    // unicast response requested, RFC 6762 5.4
     }QUESTTION;
 
-    typedef pair<size_t, string> LABELENTRY;
-    typedef vector<LABELENTRY> LABELLIST;
+    typedef pair<size_t, ARENASTRING> LABELENTRY;
+    typedef vector<LABELENTRY, ArenaAllocator<LABELENTRY>> LABELLIST;
     typedef pair<size_t, LABELLIST> OFFSETLABELLIST;
-    typedef vector<OFFSETLABELLIST> OFFSETLIST;
+    typedef vector<OFFSETLABELLIST, ArenaAllocator<OFFSETLABELLIST>> OFFSETLIST;
 
-    class DnsProtoException : exception
+    // A name decoded before in the same datagram, the text of the name starting at a label offset
+    typedef struct
+    {
+        uint32_t nStart;            // in m_strMemoNames
+        uint16_t nLen;              // 0 = not decoded yet
+        uint16_t nInPlace;          // bytes of the name at the offset itself, up to the first pointer or the root label
+    }NAMEMEMO;
+
+    static const int MAXHOPS = 16;  // compression pointers followed for one name
+
+    class DnsProtoException : public exception     // public, or the decoder's catch (exception&) does not see it
     {
     public:
         explicit DnsProtoException(const char* szMsg) : strError(szMsg) {}
@@ -69,12 +86,19 @@ public:
         IDxSTRING strHost;
     }SRVDATA;
 
+    typedef struct
+    {
+        IDxSTRING strNextName;      // in mDNS the name of the record itself, RFC 6762 6.1
+        vector<unsigned short> vTypes;
+    }NSECDATA;
+
     typedef union
     {
         void* pVoid;
         IDxSTRING* ptrData;
         vector<string>* txtData;
         SRVDATA* svData;
+        NSECDATA* nsData;
         const char* szAddr;
     }RDATA;
 
@@ -89,24 +113,55 @@ public:
 
     typedef struct
     {
-        string LABEL;
+        ARENASTRING LABEL;
         unsigned short TYPE;
         unsigned short CLASS;
         unsigned int TTL;
         unsigned short RDLENGTH;
-        string RDATA;
+        ARENASTRING RDATA;
+        size_t RDOFFSET;            // offset of the raw RDATA in the datagram
     }RRECORDS;
 
+    typedef struct
+    {
+        IDxSTRING strLabel;
+        unsigned short usType;
+        unsigned short usClass;     // the top bit requests a unicast response (QU) in mDNS
+    }QUESTIONITEM;
+
 public:
-    DnsProtokol() {};
+    DnsProtokol() : m_pMemoBuffer(nullptr), m_nMemoSize(0) {};
     DnsProtokol(unsigned char* szBuffer, size_t nBytInBuf);
     virtual ~DnsProtokol();
 
     size_t BuildSearch(const string& strQuestion, char* szBuffer, size_t& nBuflen);
     size_t BuildAnswer(vector<ANSWERITEM>& AnList, vector<ANSWERITEM>& NsList, vector<ANSWERITEM>& ArList, char* szBuffer, size_t& nBuflen);
+    // Answer to a legacy unicast query, the query ID and the questions are repeated, RFC 6762 6.7
+    size_t BuildAnswer(unsigned short nId, vector<QUESTIONITEM>& QdList, vector<ANSWERITEM>& AnList, vector<ANSWERITEM>& NsList, vector<ANSWERITEM>& ArList, char* szBuffer, size_t& nBuflen);
+    size_t BuildQuery(vector<QUESTIONITEM>& QdList, vector<ANSWERITEM>& AnList, vector<ANSWERITEM>& NsList, char* szBuffer, size_t& nBuflen);
+
+    // Header bits of an answer to a conventional unicast DNS query, applied to a built packet
+    static void SetUnicastFlags(char* szBuffer, bool bRecursionDesired, bool bTruncated, unsigned char nRCode);
+
+    // RDATA of a decoded record as raw bytes with all names uncompressed, the form RFC 6762 compares records in
+    string GetCanonicalRData(const unsigned char* szBuffer, size_t nBytInBuf, const RRECORDS& Record);
+    static string EncodeName(const string& strName);
+    // Reverse of EncodeName for uncompressed names, nOffset is moved behind the name. Returns an empty string on bad data
+    static string DecodeName(const string& strEncoded, size_t& nOffset);
+    // The type bit maps of an NSEC record, RFC 4034 4.1.2
+    static string EncodeTypeBitmaps(vector<unsigned short> vTypes);
+    static bool DecodeTypeBitmaps(const unsigned char* pData, size_t nLen, vector<unsigned short>& vTypes);
+    // Splits the canonical RDATA of an NSEC record, false if it is malformed
+    static bool ParseNsec(const string& strRData, string& strNextName, vector<unsigned short>& vTypes);
+
+    // Fast path, reads only the header and the questions without allocating anything. Returns true if the datagram
+    // is a standard query and fnAccept refused every question in it, such a query can be dropped without decoding.
+    // Malformed datagrams and responses return false and are left to the full decoder.
+    static bool IsUnwantedQuery(const unsigned char* szBuffer, size_t nBytInBuf, const function<bool(const char*, size_t, unsigned short)>& fnAccept);
 
 private:
-    size_t ExtractLabels(const unsigned char* pLabel, const unsigned char* pBuffer, size_t nBytInBuf, string& strLabel);
+    size_t BuildPacket(bool bResponse, unsigned short nId, vector<QUESTIONITEM>& QdList, vector<ANSWERITEM>& AnList, vector<ANSWERITEM>& NsList, vector<ANSWERITEM>& ArList, char* szBuffer, size_t& nBuflen);
+    size_t ExtractLabels(const unsigned char* pLabel, const unsigned char* pBuffer, size_t nBytInBuf, ARENASTRING& strLabel);
     size_t ExtractQuestion(const unsigned char* pCurPointer, const unsigned char* pBuffer, size_t nBytInBuf, short nNoQuestion, QUESTTION* pQuestion);
     size_t ExtractRRecords(const unsigned char* pCurPointer, const unsigned char* pBuffer, size_t nBytInBuf, short nNoRecords, RRECORDS* pRRecord);
     size_t BuildLabelReferenc(const string& strLabel, OFFSETLIST& OffListe);
@@ -114,14 +169,23 @@ private:
     char* BuildQuestion(OFFSETLIST& lstOffsetListe, size_t iLabelIndex, short QTYPE, short QCLASS, char* pBufPointer, size_t& nBufLen, const char* pBufStart);
     char* BuildRRecord(OFFSETLIST& OffListe, size_t iLabelIndex, unsigned short TYPE, unsigned short CLASS, int TTL, char* pBufPointer, size_t& nBufLen, const char* pBufStart);
     char* BuildRData(unsigned short TYPE, RDATA rData, char* pBufPointer, size_t& nBufLen, OFFSETLIST& OffListe, const char* pBufStart);
+    // EncodeName and EncodeTypeBitmaps appending to a string of any allocator, BuildRData uses an ARENASTRING
+    template<class STR> static void AppendName(const string& strName, STR& strOut);
+    template<class STR> static void AppendTypeBitmaps(const vector<unsigned short>& vTypes, STR& strOut);
 
 public:
     DNSHEADER               m_DnsHeader;
-    unique_ptr<QUESTTION[]> m_pQuestions;
-    unique_ptr<RRECORDS[]>  m_pAnswers;
-    unique_ptr<RRECORDS[]>  m_pNameServ;
-    unique_ptr<RRECORDS[]>  m_pExtraRec;
+    ARENAARRAY<QUESTTION>   m_pQuestions;     // Decoded data lives in the arena bound by DnsArena::Scope (if any),
+    ARENAARRAY<RRECORDS>    m_pAnswers;       // the object must not outlive that scope
+    ARENAARRAY<RRECORDS>    m_pNameServ;
+    ARENAARRAY<RRECORDS>    m_pExtraRec;
     string                  m_strLastErrMsg;
     size_t                  m_nBytesDecodet;
+
+private:
+    const unsigned char*    m_pMemoBuffer;    // the datagram the memo belongs to
+    size_t                  m_nMemoSize;
+    ARENAARRAY<NAMEMEMO>    m_pNameMemo;      // one entry per byte offset
+    ARENASTRING             m_strMemoNames;
 };
 
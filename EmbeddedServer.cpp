@@ -0,0 +1,421 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#if defined (_WIN32) || defined (_WIN64)
+#include <WinSock2.h>
+#include <Ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "DnsArena.h"
+#include "InterfaceSource.h"
+#include "EmbeddedServer.h"
+
+using namespace std::placeholders;
+
+namespace
+{
+    // "192.168.1.2:5353" or "[fe80::1%4]:5353", as UdpSocket::Read reports the sender
+    string AddressToString(const sockaddr_storage& saAddr)
+    {
+        char szAddr[INET6_ADDRSTRLEN] = { 0 };
+        if (saAddr.ss_family == AF_INET)
+        {
+            const sockaddr_in& saIn = reinterpret_cast<const sockaddr_in&>(saAddr);
+            inet_ntop(AF_INET, const_cast<in_addr*>(&saIn.sin_addr), szAddr, sizeof(szAddr));
+            return string(szAddr) + ":" + to_string(ntohs(saIn.sin_port));
+        }
+        const sockaddr_in6& saIn6 = reinterpret_cast<const sockaddr_in6&>(saAddr);
+        inet_ntop(AF_INET6, const_cast<in6_addr*>(&saIn6.sin6_addr), szAddr, sizeof(szAddr));
+        return "[" + string(szAddr) + (saIn6.sin6_scope_id != 0 ? "%" + to_string(saIn6.sin6_scope_id) : string()) + "]:" + to_string(ntohs(saIn6.sin6_port));
+    }
+
+    // The reverse, the scope id must be numeric
+    bool StringToAddress(const string& strAddr, sockaddr_storage& saAddr, socklen_t& nLen)
+    {
+        memset(&saAddr, 0, sizeof(saAddr));
+        const size_t nColon = strAddr.rfind(':');
+        if (nColon == string::npos)
+            return false;
+        const unsigned short nPort = static_cast<unsigned short>(atoi(strAddr.c_str() + nColon + 1));
+        if (strAddr[0] != '[')
+        {
+            sockaddr_in& saIn = reinterpret_cast<sockaddr_in&>(saAddr);
+            saIn.sin_family = AF_INET;
+            saIn.sin_port = htons(nPort);
+            nLen = sizeof(sockaddr_in);
+            return inet_pton(AF_INET, strAddr.substr(0, nColon).c_str(), &saIn.sin_addr) == 1;
+        }
+        const string strHost = strAddr.substr(1, strAddr.find(']') - 1);
+        const size_t nPercent = strHost.find('%');
+        sockaddr_in6& saIn6 = reinterpret_cast<sockaddr_in6&>(saAddr);
+        saIn6.sin6_family = AF_INET6;
+        saIn6.sin6_port = htons(nPort);
+        saIn6.sin6_scope_id = nPercent != string::npos ? static_cast<uint32_t>(strtoul(strHost.c_str() + nPercent + 1, nullptr, 10)) : 0;
+        nLen = sizeof(sockaddr_in6);
+        return inet_pton(AF_INET6, strHost.substr(0, nPercent).c_str(), &saIn6.sin6_addr) == 1;
+    }
+
+#if defined (_WIN32) || defined (_WIN64)
+    const EmbeddedServer::DESCRIPTOR NOSOCKET = INVALID_SOCKET;
+#else
+    const EmbeddedServer::DESCRIPTOR NOSOCKET = -1;
+#endif
+}
+
+EmbeddedServer::EmbeddedServer() : m_Registry(false), m_Cache(false), m_QueryLimiter(20.0, 40.0, 1024, false)
+    , m_Responder(m_Registry, bind(&EmbeddedServer::SendPacket, this, _1, _2, _3, _4, _5), [this](const string&, const string& strNewName) { if (strNewName.empty() == false) m_NameFilter.Add(strNewName); }, nullptr, false)
+    , m_tNow(chrono::steady_clock::now()), m_tCacheExpire(TIMEPOINT::max()), m_Rng(random_device()()), m_nPacketsReceived(0), m_nPrefilterRejects(0), m_nRateLimited(0)
+{
+#if defined (_WIN32) || defined (_WIN64)
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+}
+
+EmbeddedServer::~EmbeddedServer()
+{
+    Stop();
+#if defined (_WIN32) || defined (_WIN64)
+    WSACleanup();
+#endif
+}
+
+ServiceRegistry& EmbeddedServer::GetRegistry()
+{
+    return m_Registry;
+}
+
+RecordCache& EmbeddedServer::GetCache()
+{
+    return m_Cache;
+}
+
+void EmbeddedServer::SetSearchNames(const vector<string>& vSearchNames)
+{
+    m_vSearchNames = vSearchNames;
+    const TIMEPOINT tNow = chrono::steady_clock::now();
+    for (auto& Socket : m_vSockets)
+    {
+        Socket.vNextSearch.clear();
+        for (size_t n = 0; n < m_vSearchNames.size(); ++n)
+            Socket.vNextSearch.push_back(RandomTime(tNow, 5000, 10000));
+    }
+    for (const auto& strName : m_vSearchNames)
+        m_NameFilter.Add(strName);
+}
+
+void EmbeddedServer::SetServices(const vector<ServiceRegistry::SERVICE>& vServices)
+{
+    ServiceRegistry::CHANGES Changes = m_Registry.SetServices(vServices);
+    for (const auto& strName : m_Registry.GetOwnedNames())
+        m_NameFilter.Add(strName);
+    m_Responder.ServicesChanged(Changes, vServices);
+}
+
+void EmbeddedServer::Start()
+{
+    // Queries not asking for one of these names are dropped before they are decoded
+    m_NameFilter.Clear();
+    for (const auto& strName : m_Registry.GetOwnedNames())
+        m_NameFilter.Add(strName);
+    for (const auto& strName : m_vSearchNames)
+        m_NameFilter.Add(strName);
+
+    m_Responder.Start();
+}
+
+void EmbeddedServer::Stop()
+{
+    m_Responder.Stop();     // the goodbyes go out on the sockets still open
+
+    for (const auto& Socket : m_vSockets)
+        CloseSocket(Socket.fdSocket);
+    m_vSockets.clear();
+}
+
+bool EmbeddedServer::AddInterface(int adrFamily, const string& strIpAddr, uint32_t nInterface)
+{
+    const DESCRIPTOR fdSocket = OpenSocket(adrFamily, strIpAddr, nInterface);
+    if (fdSocket == NOSOCKET)
+        return false;
+
+    const TIMEPOINT tNow = chrono::steady_clock::now();
+    m_vSockets.push_back({ fdSocket, make_tuple(adrFamily, strIpAddr, nInterface), {} });
+    for (size_t n = 0; n < m_vSearchNames.size(); ++n)
+        m_vSockets.back().vNextSearch.push_back(RandomTime(tNow, 5000, 10000));
+
+    m_Responder.AddSocket(static_cast<Responder::SOCKETID>(fdSocket), m_vSockets.back().Info);
+    return true;
+}
+
+void EmbeddedServer::RemoveInterface(int adrFamily, const string& strIpAddr)
+{
+    const auto& itSocket = find_if(begin(m_vSockets), end(m_vSockets), [&](const SOCKETINFO& Socket) { return get<0>(Socket.Info) == adrFamily && get<1>(Socket.Info) == strIpAddr; });
+    if (itSocket == end(m_vSockets))
+        return;
+    const DESCRIPTOR fdSocket = itSocket->fdSocket;
+    m_vSockets.erase(itSocket);
+
+    m_Responder.RemoveSocket(static_cast<Responder::SOCKETID>(fdSocket));
+    CloseSocket(fdSocket);
+}
+
+void EmbeddedServer::AddCurrentInterfaces()
+{
+    EnumIpInterfaceSource().Start([this](bool bAdded, int adrFamily, const string& strIpAddr, int nInterfaceIndex)
+    {
+        if (bAdded == true)
+            AddInterface(adrFamily, strIpAddr, static_cast<uint32_t>(nInterfaceIndex));
+    });
+}
+
+void EmbeddedServer::SendQuestion(const string& strName, unsigned short usType)
+{
+    m_Responder.SendQuestion(strName, usType);
+}
+
+vector<EmbeddedServer::DESCRIPTOR> EmbeddedServer::GetDescriptors() const
+{
+    vector<DESCRIPTOR> vDescriptors;
+    for (const auto& Socket : m_vSockets)
+        vDescriptors.push_back(Socket.fdSocket);
+    return vDescriptors;
+}
+
+EmbeddedServer::TIMEPOINT EmbeddedServer::NextDeadline() const
+{
+    TIMEPOINT tNext = min(m_Responder.NextStep(), m_tCacheExpire);
+    for (const auto& Socket : m_vSockets)
+    {
+        for (const auto& tSearch : Socket.vNextSearch)
+            tNext = min(tNext, tSearch);
+    }
+    return tNext;
+}
+
+void EmbeddedServer::Process(TIMEPOINT tNow)
+{
+    m_tNow = tNow;
+    for (auto& Socket : m_vSockets)
+        Receive(Socket);
+
+    if (m_Responder.NextStep() <= tNow)
+        m_Responder.Step(tNow);
+
+    for (auto& Socket : m_vSockets)
+    {
+        for (size_t n = 0; n < Socket.vNextSearch.size(); ++n)
+        {
+            if (Socket.vNextSearch[n] <= tNow)
+            {
+                SendSearch(Socket, m_vSearchNames[n]);
+                Socket.vNextSearch[n] = RandomTime(tNow, 10000, 100000);
+            }
+        }
+    }
+
+    if (m_tCacheExpire <= tNow)
+        m_tCacheExpire = m_Cache.Expire();
+}
+
+EmbeddedServer::STATISTICS EmbeddedServer::GetStatistics() const
+{
+    return { m_nPacketsReceived, m_nPrefilterRejects, m_nRateLimited, m_Responder.GetMulticastSuppressed() };
+}
+
+void EmbeddedServer::Receive(SOCKETINFO& Socket)
+{
+    unsigned char Buffer[9000];     // the largest mDNS packet, RFC 6762 17
+    for (size_t n = 0; n < MAXPACKETSPERCALL; ++n)
+    {
+        sockaddr_storage saFrom;
+        socklen_t nFromLen = sizeof(saFrom);
+        const auto nRead = recvfrom(Socket.fdSocket, reinterpret_cast<char*>(Buffer), sizeof(Buffer), 0, reinterpret_cast<sockaddr*>(&saFrom), &nFromLen);
+        if (nRead <= 0)
+            break;      // nothing more waiting, an error shows up again on the next call
+        HandlePacket(Socket, Buffer, static_cast<size_t>(nRead), AddressToString(saFrom));
+    }
+}
+
+void EmbeddedServer::HandlePacket(SOCKETINFO& Socket, unsigned char* pBuffer, size_t nRead, const string& strFrom)
+{
+    DnsArena::Scope ArenaScope;     // everything for this packet comes from the thread arena, released when we leave
+    ++m_nPacketsReceived;
+
+    if (DnsProtokol::IsUnwantedQuery(pBuffer, nRead, [this](const char* szName, size_t nLen, unsigned short) { return m_NameFilter.MayContain(szName, nLen); }) == true)
+    {
+        ++m_nPrefilterRejects;
+        return;
+    }
+
+    // Every query costs us work and maybe a multicast, no single source gets more than its share
+    if (nRead > 2 && (pBuffer[2] & 0x80) == 0 && m_QueryLimiter.Allow(Responder::SourceAddress(strFrom)) == false)
+    {
+        ++m_nRateLimited;
+        return;
+    }
+
+    DnsProtokol dnsProto(pBuffer, nRead);
+    if (dnsProto.m_strLastErrMsg.empty() == false)
+        return;
+
+    // Our own multicasts come back to us, they are not cached
+    const bool bOwnPacket = m_Responder.IsOwnAddress(strFrom);
+
+    if (dnsProto.m_DnsHeader.QR == 1 && bOwnPacket == false)
+    {
+        auto fnAdd = [&](const DnsProtokol::RRECORDS* pRecords, unsigned short nCount)
+        {
+            for (unsigned short n = 0; n < nCount; ++n)
+            {
+                if (pRecords[n].TYPE == 41)     // OPT is no record
+                    continue;
+                m_Cache.Add(pRecords[n].LABEL.c_str(), pRecords[n].TYPE, pRecords[n].CLASS, dnsProto.GetCanonicalRData(pBuffer, nRead, pRecords[n]), pRecords[n].TTL, get<2>(Socket.Info));
+                m_tCacheExpire = min(m_tCacheExpire, m_tNow + chrono::seconds(max(pRecords[n].TTL, 1u)));   // a goodbye stays one more second
+            }
+        };
+        fnAdd(dnsProto.m_pAnswers.get(), dnsProto.m_DnsHeader.ANCOUNT);
+        fnAdd(dnsProto.m_pExtraRec.get(), dnsProto.m_DnsHeader.ARCOUNT);
+    }
+
+    m_Responder.HandlePacket(dnsProto, pBuffer, nRead, static_cast<Responder::SOCKETID>(Socket.fdSocket), Socket.Info, strFrom, bOwnPacket);
+}
+
+void EmbeddedServer::SendSearch(const SOCKETINFO& Socket, const string& strName)
+{
+    DnsArena::Scope ArenaScope;
+    DnsProtokol dnsProto;
+    size_t nBufLen = 0;
+    if (dnsProto.BuildSearch(strName, nullptr, nBufLen) != 0)
+        return;
+
+    auto pBuffer = MakeArenaArray<char>(nBufLen);
+    const size_t nSendSize = dnsProto.BuildSearch(strName, &pBuffer[0], nBufLen);
+    SendPacket(static_cast<Responder::SOCKETID>(Socket.fdSocket), Socket.Info, &pBuffer[0], nSendSize, string());
+}
+
+void EmbeddedServer::SendPacket(Responder::SOCKETID nSocket, const Responder::SOCKETINFO& Info, const char* pBuffer, size_t nSize, const string& strTo)
+{
+    const DESCRIPTOR fdSocket = static_cast<DESCRIPTOR>(nSocket);
+    if (strTo.empty() == false)
+        SendTo(fdSocket, pBuffer, nSize, strTo);
+    else if (get<0>(Info) == AF_INET)
+        SendTo(fdSocket, pBuffer, nSize, "224.0.0.251:5353");
+    else if (get<0>(Info) == AF_INET6)
+        SendTo(fdSocket, pBuffer, nSize, "[FF02::FB%" + to_string(get<2>(Info)) + "]:5353");
+}
+
+void EmbeddedServer::SendTo(DESCRIPTOR fdSocket, const char* pBuffer, size_t nSize, const string& strTo)
+{
+    sockaddr_storage saTo;
+    socklen_t nToLen = 0;
+    if (StringToAddress(strTo, saTo, nToLen) == true)
+        sendto(fdSocket, pBuffer, static_cast<int>(nSize), 0, reinterpret_cast<const sockaddr*>(&saTo), nToLen);    // a full send buffer loses the packet, as any multicast can get lost
+}
+
+EmbeddedServer::TIMEPOINT EmbeddedServer::RandomTime(TIMEPOINT tFrom, int iMinMilliSeconds, int iMaxMilliSeconds)
+{
+    return tFrom + chrono::milliseconds(uniform_int_distribution<int>(iMinMilliSeconds, iMaxMilliSeconds)(m_Rng));
+}
+
+EmbeddedServer::DESCRIPTOR EmbeddedServer::OpenSocket(int adrFamily, const string& strIpAddr, uint32_t nInterface)
+{
+    if (adrFamily != AF_INET && adrFamily != AF_INET6)
+        return NOSOCKET;
+
+    const DESCRIPTOR fdSocket = socket(adrFamily, SOCK_DGRAM, IPPROTO_UDP);
+    if (fdSocket == NOSOCKET)
+        return NOSOCKET;
+
+    // Every interface address has its own socket on port 5353, next to other mDNS responders of the machine
+    const int iOn = 1;
+    bool bOk = setsockopt(fdSocket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&iOn), sizeof(iOn)) == 0;
+#if defined(SO_REUSEPORT)
+    setsockopt(fdSocket, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const char*>(&iOn), sizeof(iOn));
+#endif
+
+    if (adrFamily == AF_INET)
+    {
+        in_addr Addr;
+        bOk &= inet_pton(AF_INET, strIpAddr.c_str(), &Addr) == 1;
+
+        sockaddr_in saBind = {};
+        saBind.sin_family = AF_INET;
+        saBind.sin_port = htons(5353);
+        saBind.sin_addr.s_addr = htonl(INADDR_ANY);
+        bOk &= ::bind(fdSocket, reinterpret_cast<const sockaddr*>(&saBind), sizeof(saBind)) == 0;
+
+        ip_mreq mreq = {};
+        inet_pton(AF_INET, "224.0.0.251", &mreq.imr_multiaddr);
+        mreq.imr_interface = Addr;
+        bOk &= setsockopt(fdSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, reinterpret_cast<const char*>(&mreq), sizeof(mreq)) == 0;
+        bOk &= setsockopt(fdSocket, IPPROTO_IP, IP_MULTICAST_IF, reinterpret_cast<const char*>(&Addr), sizeof(Addr)) == 0;
+        const int iTtl = 255;   // RFC 6762 11
+        setsockopt(fdSocket, IPPROTO_IP, IP_MULTICAST_TTL, reinterpret_cast<const char*>(&iTtl), sizeof(iTtl));
+#if defined(IP_MULTICAST_ALL)
+        const int iOff = 0;     // only the group joined on this interface, not the ones of the other sockets
+        setsockopt(fdSocket, IPPROTO_IP, IP_MULTICAST_ALL, reinterpret_cast<const char*>(&iOff), sizeof(iOff));
+#endif
+    }
+    else
+    {
+        setsockopt(fdSocket, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast<const char*>(&iOn), sizeof(iOn));
+
+        sockaddr_in6 saBind = {};
+        saBind.sin6_family = AF_INET6;
+        saBind.sin6_port = htons(5353);
+        saBind.sin6_addr = in6addr_any;
+        bOk &= ::bind(fdSocket, reinterpret_cast<const sockaddr*>(&saBind), sizeof(saBind)) == 0;
+
+        ipv6_mreq mreq = {};
+        inet_pton(AF_INET6, "FF02::FB", &mreq.ipv6mr_multiaddr);
+        mreq.ipv6mr_interface = nInterface;
+        bOk &= setsockopt(fdSocket, IPPROTO_IPV6, IPV6_JOIN_GROUP, reinterpret_cast<const char*>(&mreq), sizeof(mreq)) == 0;
+        bOk &= setsockopt(fdSocket, IPPROTO_IPV6, IPV6_MULTICAST_IF, reinterpret_cast<const char*>(&nInterface), sizeof(nInterface)) == 0;
+        const int iHops = 255;
+        setsockopt(fdSocket, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, reinterpret_cast<const char*>(&iHops), sizeof(iHops));
+    }
+
+    // Process reads until the socket has nothing more, it must never block
+#if defined (_WIN32) || defined (_WIN64)
+    u_long nNonBlocking = 1;
+    bOk &= ioctlsocket(fdSocket, FIONBIO, &nNonBlocking) == 0;
+#else
+    bOk &= fcntl(fdSocket, F_SETFL, fcntl(fdSocket, F_GETFL) | O_NONBLOCK) == 0;
+#endif
+
+    if (bOk == false)
+    {
+        CloseSocket(fdSocket);
+        return NOSOCKET;
+    }
+    return fdSocket;
+}
+
+void EmbeddedServer::CloseSocket(DESCRIPTOR fdSocket)
+{
+#if defined (_WIN32) || defined (_WIN64)
+    closesocket(fdSocket);
+#else
+    close(fdSocket);
+#endif
+}
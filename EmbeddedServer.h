@@ -0,0 +1,126 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdint>
+
+#include "ServiceRegistry.h"
+#include "RecordCache.h"
+#include "NameFilter.h"
+#include "RateLimiter.h"
+#include "Responder.h"
+
+using namespace std;
+
+// The responder and the record cache of mDnsServer for an application with its own event loop. There
+// are no threads and no callbacks from elsewhere: the application polls the descriptors for reading and
+// calls Process when one is readable or the deadline has come. Process reads the packets waiting, hands
+// them to the Responder, and runs its steps and the searches that are due, all on the calling thread.
+// Every member must be called from that one thread, the registry, the cache, the rate limiter and the
+// responder are made without their locks.
+//
+//     Server.GetRegistry().SetHostName("host.local");
+//     Server.Start();
+//     Server.AddCurrentInterfaces();
+//     for (;;) { poll(Server.GetDescriptors(), until Server.NextDeadline()); Server.Process(steady_clock::now()); }
+class EmbeddedServer
+{
+public:
+#if defined (_WIN32) || defined (_WIN64)
+    typedef uintptr_t DESCRIPTOR;       // SOCKET
+#else
+    typedef int DESCRIPTOR;
+#endif
+    typedef chrono::steady_clock::time_point TIMEPOINT;
+
+    typedef struct
+    {
+        uint64_t nPacketsReceived;
+        uint64_t nPrefilterRejects;     // queries for names we do not own, dropped undecoded
+        uint64_t nRateLimited;          // queries dropped because their source sent too many
+        uint64_t nMulticastSuppressed;  // records not multicast again within the minimum interval
+    }STATISTICS;
+
+    static const size_t MAXPACKETSPERCALL = 64;     // per socket and Process call, a busy link can not hold up the timers
+
+public:
+    EmbeddedServer();
+    virtual ~EmbeddedServer();
+
+    // The host name and the services go into the registry before Start
+    ServiceRegistry& GetRegistry();
+    RecordCache& GetCache();
+    // Asked for on every interface from time to time, as mDnsServer does
+    void SetSearchNames(const vector<string>& vSearchNames);
+    // Replaces the services while running, see ServiceRegistry::SetServices. The records gone get a goodbye, the
+    // changed ones two announcements a second apart and the new instances are probed on all interfaces before they are answered for
+    void SetServices(const vector<ServiceRegistry::SERVICE>& vServices);
+
+    void Start();
+    // Goodbye packets for our records, the sockets are closed
+    void Stop();
+
+    // One socket for each address, it is probed and announced on from the next Process. The application
+    // reports the addresses coming and going, or takes the ones there are now with AddCurrentInterfaces
+    bool AddInterface(int adrFamily, const string& strIpAddr, uint32_t nInterface);
+    void RemoveInterface(int adrFamily, const string& strIpAddr);
+    void AddCurrentInterfaces();
+    void SendQuestion(const string& strName, unsigned short usType);
+
+    // To poll for reading, they change with the interfaces
+    vector<DESCRIPTOR> GetDescriptors() const;
+    // The time Process has something to do without a packet coming in, TIMEPOINT::max() if never
+    TIMEPOINT NextDeadline() const;
+    void Process(TIMEPOINT tNow);
+    STATISTICS GetStatistics() const;
+
+private:
+    typedef struct
+    {
+        DESCRIPTOR fdSocket;
+        Responder::SOCKETINFO Info;     // address family, address, interface index
+        vector<TIMEPOINT> vNextSearch;  // per search name
+    }SOCKETINFO;
+
+private:
+    void Receive(SOCKETINFO& Socket);
+    void HandlePacket(SOCKETINFO& Socket, unsigned char* pBuffer, size_t nRead, const string& strFrom);
+    void SendSearch(const SOCKETINFO& Socket, const string& strName);
+    // The Responder::SENDER
+    void SendPacket(Responder::SOCKETID nSocket, const Responder::SOCKETINFO& Info, const char* pBuffer, size_t nSize, const string& strTo);
+    void SendTo(DESCRIPTOR fdSocket, const char* pBuffer, size_t nSize, const string& strTo);
+    TIMEPOINT RandomTime(TIMEPOINT tFrom, int iMinMilliSeconds, int iMaxMilliSeconds);
+
+    static DESCRIPTOR OpenSocket(int adrFamily, const string& strIpAddr, uint32_t nInterface);
+    static void CloseSocket(DESCRIPTOR fdSocket);
+
+private:
+    ServiceRegistry    m_Registry;
+    RecordCache        m_Cache;
+    NameFilter         m_NameFilter;
+    RateLimiter        m_QueryLimiter;      // per source address, 20 queries a second, bursts up to 40
+    Responder          m_Responder;
+    vector<string>     m_vSearchNames;
+    vector<SOCKETINFO> m_vSockets;
+    TIMEPOINT          m_tNow;              // of the Process call running
+    TIMEPOINT          m_tCacheExpire;
+    mt19937            m_Rng;
+
+    uint64_t           m_nPacketsReceived;
+    uint64_t           m_nPrefilterRejects;
+    uint64_t           m_nRateLimited;
+};
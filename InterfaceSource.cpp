@@ -0,0 +1,234 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include "socketlib/SocketLib.h"
+#include "InterfaceSource.h"
+
+#if defined(__linux__)
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+bool EnumIpInterfaceSource::Start(ADDRCALLBACK fnCallback)
+{
+    BaseSocket::EnumIpAddresses([&](int adrFamily, const string& strIpAddr, int nInterfaceIndex, void*) -> int
+    {
+        fnCallback(true, adrFamily, strIpAddr, nInterfaceIndex);
+        return 0;
+    }, 0);
+    return true;
+}
+
+void EnumIpInterfaceSource::Stop()
+{
+}
+
+#if defined(__linux__)
+NetlinkInterfaceSource::NetlinkInterfaceSource() : m_fdNetlink(-1), m_bStop(false)
+{
+}
+
+NetlinkInterfaceSource::~NetlinkInterfaceSource()
+{
+    Stop();
+}
+
+bool NetlinkInterfaceSource::Start(ADDRCALLBACK fnCallback)
+{
+    m_fdNetlink = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (m_fdNetlink == -1)
+        return false;
+
+    // Subscribe first and read the current state afterwards, so no change can get lost in between
+    struct sockaddr_nl saLocal = {};
+    saLocal.nl_family = AF_NETLINK;
+    saLocal.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if (::bind(m_fdNetlink, reinterpret_cast<struct sockaddr*>(&saLocal), sizeof(saLocal)) == -1)
+    {
+        close(m_fdNetlink);
+        m_fdNetlink = -1;
+        return false;
+    }
+
+    m_fnCallback = fnCallback;
+    m_bStop = false;
+    m_setKnown.clear();
+    Resync();
+    m_thWatch = thread(&NetlinkInterfaceSource::WatchThread, this);
+    return true;
+}
+
+void NetlinkInterfaceSource::Stop()
+{
+    m_bStop = true;
+    if (m_thWatch.joinable() == true)
+        m_thWatch.join();
+    if (m_fdNetlink != -1)
+        close(m_fdNetlink);
+    m_fdNetlink = -1;
+}
+
+void NetlinkInterfaceSource::WatchThread()
+{
+    char szBuffer[16384];
+
+    while (m_bStop == false)
+    {
+        struct pollfd pfd = { m_fdNetlink, POLLIN, 0 };
+        if (poll(&pfd, 1, 250) <= 0)
+            continue;
+
+        const ssize_t nRead = recv(m_fdNetlink, szBuffer, sizeof(szBuffer), 0);
+        if (nRead < 0)
+        {
+            if (errno == ENOBUFS)   // the kernel dropped notifications, we have to read the whole state again
+                Resync();
+            continue;
+        }
+
+        int nLen = static_cast<int>(nRead);
+        for (const struct nlmsghdr* pHdr = reinterpret_cast<const struct nlmsghdr*>(szBuffer); NLMSG_OK(pHdr, nLen); pHdr = NLMSG_NEXT(pHdr, nLen))
+        {
+            if (pHdr->nlmsg_type != RTM_NEWADDR && pHdr->nlmsg_type != RTM_DELADDR)
+                continue;
+
+            ADDRESS Address;
+            bool bUsable;
+            if (ParseAddress(pHdr, Address, bUsable) == false)
+                continue;
+
+            if (pHdr->nlmsg_type == RTM_NEWADDR && bUsable == true)
+            {
+                if (m_setKnown.insert(Address).second == true)
+                    m_fnCallback(true, get<0>(Address), get<1>(Address), get<2>(Address));
+            }
+            else if (m_setKnown.erase(Address) > 0)     // deleted, or tentative again
+                m_fnCallback(false, get<0>(Address), get<1>(Address), get<2>(Address));
+        }
+    }
+}
+
+void NetlinkInterfaceSource::Resync()
+{
+    set<ADDRESS> setCurrent;
+    if (DumpAddresses(setCurrent) == false)
+        return;
+
+    for (const auto& Address : m_setKnown)
+    {
+        if (setCurrent.find(Address) == setCurrent.end())
+            m_fnCallback(false, get<0>(Address), get<1>(Address), get<2>(Address));
+    }
+    for (const auto& Address : setCurrent)
+    {
+        if (m_setKnown.find(Address) == m_setKnown.end())
+            m_fnCallback(true, get<0>(Address), get<1>(Address), get<2>(Address));
+    }
+    m_setKnown.swap(setCurrent);
+}
+
+bool NetlinkInterfaceSource::DumpAddresses(set<ADDRESS>& setAddresses)
+{
+    // A separate socket for the dump, its answer can not mix with the notifications
+    const int fdDump = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fdDump == -1)
+        return false;
+
+    struct
+    {
+        struct nlmsghdr Hdr;
+        struct ifaddrmsg Msg;
+    } Request = {};
+    Request.Hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+    Request.Hdr.nlmsg_type = RTM_GETADDR;
+    Request.Hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    Request.Hdr.nlmsg_seq = 1;
+    Request.Msg.ifa_family = AF_UNSPEC;
+
+    bool bDone = false, bError = send(fdDump, &Request, Request.Hdr.nlmsg_len, 0) == -1;
+    char szBuffer[16384];
+    while (bDone == false && bError == false)
+    {
+        const ssize_t nRead = recv(fdDump, szBuffer, sizeof(szBuffer), 0);
+        if (nRead <= 0)
+        {
+            bError = true;
+            break;
+        }
+
+        int nLen = static_cast<int>(nRead);
+        for (const struct nlmsghdr* pHdr = reinterpret_cast<const struct nlmsghdr*>(szBuffer); NLMSG_OK(pHdr, nLen); pHdr = NLMSG_NEXT(pHdr, nLen))
+        {
+            if (pHdr->nlmsg_type == NLMSG_DONE)
+                bDone = true;
+            else if (pHdr->nlmsg_type == NLMSG_ERROR)
+                bError = true;
+            else if (pHdr->nlmsg_type == RTM_NEWADDR)
+            {
+                ADDRESS Address;
+                bool bUsable;
+                if (ParseAddress(pHdr, Address, bUsable) == true && bUsable == true)
+                    setAddresses.insert(Address);
+            }
+        }
+    }
+
+    close(fdDump);
+    return bError == false;
+}
+
+bool NetlinkInterfaceSource::ParseAddress(const void* pMessage, ADDRESS& Address, bool& bUsable)
+{
+    const struct nlmsghdr* pHdr = static_cast<const struct nlmsghdr*>(pMessage);
+    const struct ifaddrmsg* pIfa = static_cast<const struct ifaddrmsg*>(NLMSG_DATA(pHdr));
+    if (pIfa->ifa_family != AF_INET && pIfa->ifa_family != AF_INET6)
+        return false;
+    if (pIfa->ifa_scope == RT_SCOPE_HOST)  // loopback
+        return false;
+
+    uint32_t nFlags = pIfa->ifa_flags;
+    const void* pAddr = nullptr;
+    int nLen = static_cast<int>(IFA_PAYLOAD(pHdr));
+    for (const struct rtattr* pAttr = IFA_RTA(pIfa); RTA_OK(pAttr, nLen); pAttr = RTA_NEXT(pAttr, nLen))
+    {
+        if (pAttr->rta_type == IFA_LOCAL || (pAttr->rta_type == IFA_ADDRESS && pAddr == nullptr))
+            pAddr = RTA_DATA(pAttr);    // IFA_LOCAL is the own address on point to point links
+        else if (pAttr->rta_type == IFA_FLAGS)
+            memcpy(&nFlags, RTA_DATA(pAttr), sizeof(nFlags));
+    }
+    if (pAddr == nullptr)
+        return false;
+
+    char szAddr[INET6_ADDRSTRLEN];
+    if (inet_ntop(pIfa->ifa_family, pAddr, szAddr, sizeof(szAddr)) == nullptr)
+        return false;
+
+    Address = make_tuple(static_cast<int>(pIfa->ifa_family), string(szAddr), static_cast<int>(pIfa->ifa_index));
+    bUsable = (nFlags & (IFA_F_TENTATIVE | IFA_F_DADFAILED)) == 0;   // IPv6 duplicate address detection not done or failed
+    return true;
+}
+#endif
+
+unique_ptr<InterfaceSource> CreateInterfaceSource()
+{
+#if defined(__linux__)
+    return make_unique<NetlinkInterfaceSource>();
+#else
+    return make_unique<EnumIpInterfaceSource>();
+#endif
+}
@@ -0,0 +1,74 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <set>
+#include <tuple>
+#include <memory>
+
+using namespace std;
+
+// Reports the IP addresses of the machine. Start() reports every address present as added,
+// later changes are reported as they happen (if the source can see them).
+class InterfaceSource
+{
+public:
+    typedef function<void(bool bAdded, int adrFamily, const string& strIpAddr, int nInterfaceIndex)> ADDRCALLBACK;
+
+    virtual ~InterfaceSource() {}
+    virtual bool Start(ADDRCALLBACK fnCallback) = 0;
+    virtual void Stop() = 0;
+};
+
+// One time enumeration with BaseSocket::EnumIpAddresses, no changes are reported
+class EnumIpInterfaceSource : public InterfaceSource
+{
+public:
+    bool Start(ADDRCALLBACK fnCallback) override;
+    void Stop() override;
+};
+
+#if defined(__linux__)
+// Listens on a rtnetlink socket for RTM_NEWADDR/RTM_DELADDR and reports the differences
+class NetlinkInterfaceSource : public InterfaceSource
+{
+    typedef tuple<int, string, int> ADDRESS;    // family, address, interface index
+
+public:
+    NetlinkInterfaceSource();
+    virtual ~NetlinkInterfaceSource();
+
+    bool Start(ADDRCALLBACK fnCallback) override;
+    void Stop() override;
+
+private:
+    void WatchThread();
+    void Resync();
+    static bool DumpAddresses(set<ADDRESS>& setAddresses);
+    static bool ParseAddress(const void* pMessage, ADDRESS& Address, bool& bUsable);
+
+private:
+    int          m_fdNetlink;
+    thread       m_thWatch;
+    atomic<bool> m_bStop;
+    ADDRCALLBACK m_fnCallback;
+    set<ADDRESS> m_setKnown;
+};
+#endif
+
+// The best source for the platform
+unique_ptr<InterfaceSource> CreateInterfaceSource();
@@ -0,0 +1,72 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include "NameFilter.h"
+
+NameFilter::NameFilter()
+{
+    Clear();
+}
+
+NameFilter::~NameFilter()
+{
+}
+
+void NameFilter::Add(const string& strName)
+{
+    uint32_t nHash1, nHash2;
+    Hash(strName.c_str(), strName.size(), nHash1, nHash2);
+    for (size_t n = 0; n < HASHES; ++n)
+    {
+        const size_t nBit = (nHash1 + n * nHash2) % BITS;
+        m_aBits[nBit / 64].fetch_or(uint64_t(1) << (nBit % 64), memory_order_relaxed);
+    }
+}
+
+void NameFilter::Clear()
+{
+    for (auto& nBits : m_aBits)
+        nBits.store(0, memory_order_relaxed);
+}
+
+bool NameFilter::MayContain(const char* szName, size_t nLen) const
+{
+    uint32_t nHash1, nHash2;
+    Hash(szName, nLen, nHash1, nHash2);
+    for (size_t n = 0; n < HASHES; ++n)
+    {
+        const size_t nBit = (nHash1 + n * nHash2) % BITS;
+        if ((m_aBits[nBit / 64].load(memory_order_relaxed) & (uint64_t(1) << (nBit % 64))) == 0)
+            return false;
+    }
+    return true;
+}
+
+void NameFilter::Hash(const char* szName, size_t nLen, uint32_t& nHash1, uint32_t& nHash2)
+{
+    // FNV-1a over the lower case name, the second hash is derived by a final mix (double hashing)
+    uint32_t nHash = 2166136261u;
+    for (size_t n = 0; n < nLen; ++n)
+    {
+        unsigned char c = static_cast<unsigned char>(szName[n]);
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        nHash = (nHash ^ c) * 16777619u;
+    }
+    nHash1 = nHash;
+    nHash ^= nHash >> 16;
+    nHash *= 0x85ebca6bu;
+    nHash ^= nHash >> 13;
+    nHash *= 0xc2b2ae35u;
+    nHash ^= nHash >> 16;
+    nHash2 = nHash | 1;
+}
@@ -0,0 +1,42 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <array>
+#include <cstdint>
+#include <atomic>
+
+using namespace std;
+
+// Bloom filter over DNS names (case insensitive). MayContain never answers false for a name
+// that was added, a true for a name never added happens with a small probability.
+// Add and MayContain may be called from different threads.
+class NameFilter
+{
+public:
+    NameFilter();
+    virtual ~NameFilter();
+
+    void Add(const string& strName);
+    void Clear();
+    bool MayContain(const char* szName, size_t nLen) const;
+
+private:
+    static void Hash(const char* szName, size_t nLen, uint32_t& nHash1, uint32_t& nHash2);
+
+private:
+    static const size_t BITS = 4096;
+    static const size_t HASHES = 4;
+    array<atomic<uint64_t>, BITS / 64> m_aBits;
+};
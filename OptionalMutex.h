@@ -0,0 +1,47 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <mutex>
+
+using namespace std;
+
+// A mutex that can be switched off when it is made. The classes EmbeddedServer uses take it off: all
+// their members are called from the one thread of the application there, a lock protects nothing.
+// Works with lock_guard, unique_lock and condition_variable_any.
+class OptionalMutex
+{
+public:
+    explicit OptionalMutex(bool bEnabled = true) : m_bEnabled(bEnabled) {}
+
+    void lock()
+    {
+        if (m_bEnabled == true)
+            m_mx.lock();
+    }
+
+    void unlock()
+    {
+        if (m_bEnabled == true)
+            m_mx.unlock();
+    }
+
+    bool try_lock()
+    {
+        return m_bEnabled == false || m_mx.try_lock();
+    }
+
+private:
+    const bool m_bEnabled;
+    mutex m_mx;
+};
@@ -0,0 +1,124 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <chrono>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <WinSock2.h>
+#else
+#include <sys/socket.h>
+#endif
+
+#include "DnsArena.h"
+#include "ServiceRegistry.h"
+#include "PacketBench.h"
+
+// Counts the allocations of the calling thread. Replacing the global operator new is the only portable way
+// to see them, it costs one thread local increment per allocation for the whole program
+static thread_local size_t s_nHeapAllocations = 0;
+
+void* operator new(size_t nSize)
+{
+    ++s_nHeapAllocations;
+    void* p = malloc(nSize > 0 ? nSize : 1);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+PacketBench::REPORT PacketBench::Run(size_t nPackets)
+{
+    ServiceRegistry Registry;
+    Registry.SetHostName("benchhost.local");
+    Registry.AddService({ "Bench", "_http._tcp.local", 80, { "path=/index.html" } });
+
+    // PTR for the type and A for the host, the A question also gets the NSEC for AAAA
+    vector<DnsProtokol::QUESTIONITEM> QdList = { { { 0, "_http._tcp.local" }, 12, 1 }, { { 0, "benchhost.local" }, 1, 1 } };
+    vector<DnsProtokol::ANSWERITEM> AnList, NsList;
+    DnsProtokol dnsQuery;
+    size_t nBufLen = 0;
+    dnsQuery.BuildQuery(QdList, AnList, NsList, nullptr, nBufLen);
+    vector<char> vQuery(nBufLen);
+    const size_t nQuerySize = dnsQuery.BuildQuery(QdList, AnList, NsList, &vQuery[0], nBufLen);
+
+    const ServiceRegistry::MULTICASTCHECK fnWithin = [](const ServiceRegistry::RECORD&, chrono::steady_clock::duration) { return false; };
+    const ServiceRegistry::MULTICASTCHECK fnClaim = [](const ServiceRegistry::RECORD&, chrono::steady_clock::duration) { return true; };
+
+    REPORT Report = { nPackets, 0, 0, 0, 0, 0 };
+    size_t nDecode = 0, nRecords = 0, nEncode = 0, nArenaBlocks = 0;
+    chrono::steady_clock::time_point tStart;
+    for (size_t n = 0; n < WARMUP + nPackets; ++n)
+    {
+        if (n == WARMUP)
+        {
+            nArenaBlocks = DnsArena::ThreadArena().GetStats().nHeapBlocks;
+            tStart = chrono::steady_clock::now();
+        }
+
+        DnsArena::Scope ArenaScope;
+        const size_t nBefore = s_nHeapAllocations;
+        auto spBuffer = MakeArenaArray<unsigned char>(nQuerySize + 1);
+        memcpy(spBuffer.get(), &vQuery[0], nQuerySize);
+        DnsProtokol dnsProto(spBuffer.get(), nQuerySize);
+        const size_t nDecoded = s_nHeapAllocations;
+
+        vector<ServiceRegistry::RECORD> vRecords;
+        const auto pSnapshot = Registry.GetSnapshot();
+        ServiceRegistry::BuildRecords(*pSnapshot, AF_INET, "192.0.2.1", vRecords);
+        ServiceRegistry::AddNsecRecords(*pSnapshot, vRecords, { 1 });
+        ServiceRegistry::ANSWERS Answers;
+        Answers.nSuppressed = 0;
+        ServiceRegistry::PrepareAnswers(dnsProto, vRecords, true, false, fnWithin, fnClaim, Answers);
+        const size_t nPrepared = s_nHeapAllocations;
+
+        DnsProtokol dnsAnswer;
+        size_t nAnswerLen = 0;
+        dnsAnswer.BuildAnswer(Answers.AnList, NsList, Answers.ArList, nullptr, nAnswerLen);
+        auto pAnswer = MakeArenaArray<char>(nAnswerLen);
+        dnsAnswer.BuildAnswer(Answers.AnList, NsList, Answers.ArList, &pAnswer[0], nAnswerLen);
+
+        if (n >= WARMUP)
+        {
+            nDecode += nDecoded - nBefore;
+            nRecords += nPrepared - nDecoded;
+            nEncode += s_nHeapAllocations - nPrepared;
+        }
+    }
+
+    if (nPackets > 0)
+    {
+        Report.dMicroseconds = chrono::duration<double, micro>(chrono::steady_clock::now() - tStart).count() / nPackets;
+        Report.dDecodeAllocs = static_cast<double>(nDecode) / nPackets;
+        Report.dRecordAllocs = static_cast<double>(nRecords) / nPackets;
+        Report.dEncodeAllocs = static_cast<double>(nEncode) / nPackets;
+        Report.nArenaHeapBlocks = DnsArena::ThreadArena().GetStats().nHeapBlocks - nArenaBlocks;
+    }
+    return Report;
+}
+
+bool PacketBench::Passed(const REPORT& Report)
+{
+    return Report.dDecodeAllocs == 0 && Report.dEncodeAllocs == 0 && Report.nArenaHeapBlocks == 0;
+}
@@ -0,0 +1,42 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <cstddef>
+
+using namespace std;
+
+// Runs a query for a service and the host address through the steps DatenEmpfangen takes for it, without
+// sockets, and counts the allocations from the global heap per packet once the thread arena is warmed up.
+// Decoding and encoding are served by the arena and must not allocate. The records of the registry and
+// the prepared answers hold std::strings, those allocations are counted and reported, not checked.
+class PacketBench
+{
+public:
+    typedef struct
+    {
+        size_t nPackets;
+        double dDecodeAllocs;       // heap allocations per packet: DnsProtokol decoding the query
+        double dRecordAllocs;       // BuildRecords, AddNsecRecords and PrepareAnswers
+        double dEncodeAllocs;       // DnsProtokol building the answer
+        size_t nArenaHeapBlocks;    // blocks the arena took from the heap after the warm-up
+        double dMicroseconds;       // per packet, all steps
+    }REPORT;
+
+    static const size_t WARMUP = 100;
+
+public:
+    static REPORT Run(size_t nPackets);
+    // Decoding and encoding did not touch the global heap
+    static bool Passed(const REPORT& Report);
+};
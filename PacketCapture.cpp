@@ -0,0 +1,503 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#if defined (_WIN32) || defined (_WIN64)
+#include <WinSock2.h>
+#include <Ws2tcpip.h>
+#include <iphlpapi.h>
+#pragma comment(lib, "Iphlpapi.lib")
+#else
+#include <arpa/inet.h>
+#include <net/if.h>
+#endif
+#include "DnsProtokol.h"
+#include "DnsArena.h"
+#include "PacketCapture.h"
+
+namespace
+{
+    void Append16(string& strOut, uint16_t nValue)
+    {
+        strOut.append(reinterpret_cast<const char*>(&nValue), 2);   // pcapng blocks are in host byte order, the byte order magic tells the reader
+    }
+
+    void Append32(string& strOut, uint32_t nValue)
+    {
+        strOut.append(reinterpret_cast<const char*>(&nValue), 4);
+    }
+
+    void AppendOption(string& strOut, uint16_t nCode, const string& strValue)
+    {
+        Append16(strOut, nCode);
+        Append16(strOut, static_cast<uint16_t>(strValue.size()));
+        strOut += strValue;
+        strOut.append((4 - strValue.size() % 4) % 4, '\0');
+    }
+
+    // Network byte order, for the IP and UDP headers
+    void AppendNet16(string& strOut, uint16_t nValue)
+    {
+        strOut += static_cast<char>(nValue >> 8);
+        strOut += static_cast<char>(nValue & 0xff);
+    }
+
+    uint32_t ChecksumAdd(uint32_t nSum, const unsigned char* pData, size_t nLen)
+    {
+        for (size_t n = 0; n + 1 < nLen; n += 2)
+            nSum += (pData[n] << 8) | pData[n + 1];
+        if (nLen % 2 == 1)
+            nSum += pData[nLen - 1] << 8;
+        return nSum;
+    }
+
+    uint16_t ChecksumFold(uint32_t nSum)
+    {
+        while (nSum >> 16)
+            nSum = (nSum & 0xffff) + (nSum >> 16);
+        return static_cast<uint16_t>(~nSum);
+    }
+}
+
+const size_t PacketCapture::BLOCKS;
+const size_t PacketCapture::BLOCKSIZE;
+const size_t PacketCapture::ADDRSIZE;
+const int PacketCapture::FLUSHINTERVAL;
+
+PacketCapture::PacketCapture() : m_bStop(true), m_bEnabled(false), m_nSampling(1), m_nSampleCounter(0), m_nMaxFileBytes(0), m_nMaxFiles(1), m_nFileBytes(0)
+    , m_nWritten(0), m_nSampledOut(0), m_nFiltered(0), m_nDropped(0), m_nRotations(0)
+{
+}
+
+PacketCapture::~PacketCapture()
+{
+    Stop();
+}
+
+bool PacketCapture::Start(const string& strFile, uint64_t nMaxFileBytes, size_t nMaxFiles)
+{
+    if (m_bEnabled == true)
+        return false;
+
+    m_strFile = strFile;
+    m_nMaxFileBytes = nMaxFileBytes;
+    m_nMaxFiles = max(nMaxFiles, size_t(1));
+    if (OpenFile() == false)
+        return false;
+
+    lock_guard<mutex> lock(m_mxBlocks);
+    if (m_vBlocks.empty() == true)      // allocated once and kept, a packet may still be copied in while Stop runs
+    {
+        m_vBlocks.resize(BLOCKS);
+        for (auto& Block : m_vBlocks)
+            Block.vData.resize(BLOCKSIZE);
+    }
+    m_vFree.clear();
+    for (size_t n = 0; n < m_vBlocks.size(); ++n)
+        m_vFree.push_back(n);
+    m_dqReady.clear();
+    m_bStop = false;
+    m_thWriter = thread(&PacketCapture::Writer, this);
+    m_bEnabled = true;
+    return true;
+}
+
+void PacketCapture::Stop()
+{
+    m_bEnabled = false;
+    {
+        lock_guard<mutex> lock(m_mxBlocks);
+        m_bStop = true;
+        m_cvBlocks.notify_all();
+    }
+    if (m_thWriter.joinable() == true)
+        m_thWriter.join();      // it writes what is waiting before it ends
+    if (m_fOut.is_open() == true)
+        m_fOut.close();
+}
+
+bool PacketCapture::IsEnabled() const
+{
+    return m_bEnabled;
+}
+
+void PacketCapture::SetSampling(uint32_t nOneIn)
+{
+    m_nSampling = max(nOneIn, 1u);
+}
+
+void PacketCapture::SetNameFilter(const vector<string>& vNames)
+{
+    vector<string> vFilter;
+    for (auto strName : vNames)
+    {
+        transform(begin(strName), end(strName), begin(strName), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+        vFilter.push_back(strName);
+    }
+    lock_guard<mutex> lock(m_mxFilter);
+    m_vFilter.swap(vFilter);
+}
+
+void PacketCapture::Capture(DIRECTION Direction, uint32_t nInterface, const char* szSource, const char* szDestination, const void* pData, size_t nLen)
+{
+    Enqueue(Direction, nInterface, szSource, 0, szDestination, pData, nLen);
+}
+
+void PacketCapture::CaptureSent(uint32_t nInterface, const char* szLocalAddr, unsigned short nLocalPort, const char* szDestination, const void* pData, size_t nLen)
+{
+    Enqueue(OUTBOUND, nInterface, szLocalAddr, nLocalPort, szDestination, pData, nLen);
+}
+
+void PacketCapture::Enqueue(DIRECTION Direction, uint32_t nInterface, const char* szSource, unsigned short nSourcePort, const char* szDestination, const void* pData, size_t nLen)
+{
+    if (m_bEnabled == false)
+        return;
+    const uint32_t nSampling = m_nSampling;
+    if (nSampling > 1 && m_nSampleCounter++ % nSampling != 0)
+    {
+        ++m_nSampledOut;
+        return;
+    }
+
+    const auto tNow = chrono::system_clock::now();
+    lock_guard<mutex> lock(m_mxBlocks);
+    if (m_bStop == true || m_vFree.empty() == true)
+    {
+        ++m_nDropped;
+        return;
+    }
+    BLOCK& Block = m_vBlocks[m_vFree.back()];
+    Block.Direction = Direction;
+    Block.nInterface = nInterface;
+    Block.tTime = tNow;
+    CopyAddress(Block.szSource, szSource, nSourcePort);
+    CopyAddress(Block.szDestination, szDestination, 0);
+    Block.nLen = nLen;
+    memcpy(Block.vData.data(), pData, min(nLen, BLOCKSIZE));
+    m_dqReady.push_back(m_vFree.back());
+    m_vFree.pop_back();
+    m_cvBlocks.notify_one();
+}
+
+PacketCapture::STATISTICS PacketCapture::GetStatistics() const
+{
+    return { m_nWritten, m_nSampledOut, m_nFiltered, m_nDropped, m_nRotations };
+}
+
+void PacketCapture::Writer()
+{
+    bool bUnflushed = false;
+    chrono::steady_clock::time_point tFlush;
+    const auto fnReady = [&]() { return m_bStop == true || m_dqReady.empty() == false; };
+
+    unique_lock<mutex> lock(m_mxBlocks);
+    while (true)
+    {
+        if (bUnflushed == false)
+            m_cvBlocks.wait(lock, fnReady);
+        else if (m_cvBlocks.wait_until(lock, tFlush, fnReady) == false)
+        {
+            lock.unlock();
+            Flush();
+            lock.lock();
+            bUnflushed = false;
+            continue;
+        }
+        if (m_dqReady.empty() == true)
+            break;      // stopped and nothing left to write, Stop closes the file and that flushes it
+
+        const size_t nBlock = m_dqReady.front();
+        m_dqReady.pop_front();
+        lock.unlock();
+        WriteBlock(m_vBlocks[nBlock]);
+        if (bUnflushed == false)
+        {
+            bUnflushed = true;
+            tFlush = chrono::steady_clock::now() + chrono::milliseconds(FLUSHINTERVAL);
+        }
+        lock.lock();
+        m_vFree.push_back(nBlock);
+    }
+}
+
+void PacketCapture::WriteBlock(BLOCK& Block)
+{
+    if (Matches(Block) == false)
+    {
+        ++m_nFiltered;
+        return;
+    }
+
+    const string strHeaders = MakeHeaders(Block);
+    if (strHeaders.empty() == true || m_fOut.is_open() == false)
+    {
+        ++m_nDropped;
+        return;
+    }
+    const size_t nCaptured = min(Block.nLen, BLOCKSIZE);
+
+    // Enhanced packet block, pcapng 4.3. Microseconds since 1970, the default resolution
+    const uint64_t nMicroSeconds = chrono::duration_cast<chrono::microseconds>(Block.tTime.time_since_epoch()).count();
+    string strBody;
+    strBody.reserve(32 + strHeaders.size() + nCaptured);
+    const uint32_t nId = InterfaceId(Block.nInterface);
+    if (m_fOut.is_open() == false)
+    {
+        ++m_nDropped;
+        return;
+    }
+    Append32(strBody, nId);
+    Append32(strBody, static_cast<uint32_t>(nMicroSeconds >> 32));
+    Append32(strBody, static_cast<uint32_t>(nMicroSeconds & 0xffffffff));
+    Append32(strBody, static_cast<uint32_t>(strHeaders.size() + nCaptured));
+    Append32(strBody, static_cast<uint32_t>(strHeaders.size() + Block.nLen));
+    strBody += strHeaders;
+    strBody.append(reinterpret_cast<const char*>(Block.vData.data()), nCaptured);
+    strBody.append((4 - strBody.size() % 4) % 4, '\0');
+    string strFlags;
+    Append32(strFlags, static_cast<uint32_t>(Block.Direction));
+    AppendOption(strBody, 2, strFlags);     // epb_flags
+    Append32(strBody, 0);                   // opt_endofopt
+
+    const string strBlock = PcapBlock(6, strBody);
+    if (m_nFileBytes + strBlock.size() > m_nMaxFileBytes && m_maInterfaceIds.size() > 0 && m_nFileBytes > 512)
+    {
+        if (Rotate() == false)
+        {
+            ++m_nDropped;
+            return;
+        }
+        WriteBlock(Block);      // the interface block goes into the new file first
+        return;
+    }
+    Write(strBlock);
+    ++m_nWritten;
+}
+
+bool PacketCapture::Matches(BLOCK& Block)
+{
+    vector<string> vFilter;
+    {
+        lock_guard<mutex> lock(m_mxFilter);
+        if (m_vFilter.empty() == true)
+            return true;
+        vFilter = m_vFilter;
+    }
+
+    DnsArena::Scope ArenaScope;
+    DnsProtokol dnsProto(Block.vData.data(), min(Block.nLen, BLOCKSIZE));
+    if (dnsProto.m_strLastErrMsg.empty() == false)
+        return false;
+
+    auto fnMatch = [&](string strName)
+    {
+        transform(begin(strName), end(strName), begin(strName), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+        return any_of(begin(vFilter), end(vFilter), [&strName](const string& strFilter)
+        {
+            return strName == strFilter || (strName.size() > strFilter.size() && strName.compare(strName.size() - strFilter.size(), string::npos, strFilter) == 0 && strName[strName.size() - strFilter.size() - 1] == '.');
+        });
+    };
+    for (short n = 0; n < dnsProto.m_DnsHeader.QDCOUNT; ++n)
+    {
+        if (fnMatch(string(begin(dnsProto.m_pQuestions.get()[n].LABEL), end(dnsProto.m_pQuestions.get()[n].LABEL))) == true)
+            return true;
+    }
+    const pair<const DnsProtokol::RRECORDS*, unsigned short> Sections[3] = { { dnsProto.m_pAnswers.get(), dnsProto.m_DnsHeader.ANCOUNT }, { dnsProto.m_pNameServ.get(), dnsProto.m_DnsHeader.NSCOUNT }, { dnsProto.m_pExtraRec.get(), dnsProto.m_DnsHeader.ARCOUNT } };
+    for (const auto& Section : Sections)
+    {
+        for (unsigned short n = 0; n < Section.second; ++n)
+        {
+            if (fnMatch(string(begin(Section.first[n].LABEL), end(Section.first[n].LABEL))) == true)
+                return true;
+        }
+    }
+    return false;
+}
+
+bool PacketCapture::OpenFile()
+{
+    m_fOut.open(m_strFile, ios::binary | ios::trunc);
+    if (m_fOut.is_open() == false)
+        return false;
+    m_nFileBytes = 0;
+    m_maInterfaceIds.clear();
+    Write(SectionHeader());
+    return m_fOut.fail() == false;
+}
+
+bool PacketCapture::Rotate()
+{
+    m_fOut.close();
+
+    // file.n-2 -> file.n-1, ..., file -> file.1, the oldest goes
+    for (size_t n = m_nMaxFiles - 1; n > 0; --n)
+    {
+        const string strFrom = n > 1 ? m_strFile + "." + to_string(n - 1) : m_strFile;
+        const string strTo = m_strFile + "." + to_string(n);
+        remove(strTo.c_str());
+        rename(strFrom.c_str(), strTo.c_str());
+    }
+    ++m_nRotations;
+    return OpenFile();
+}
+
+uint32_t PacketCapture::InterfaceId(uint32_t nInterface)
+{
+    const auto& itId = m_maInterfaceIds.find(nInterface);
+    if (itId != end(m_maInterfaceIds))
+        return itId->second;
+
+    const uint32_t nId = static_cast<uint32_t>(m_maInterfaceIds.size());
+    m_maInterfaceIds.emplace(nInterface, nId);
+    Write(InterfaceDescription(nInterface));
+    return nId;
+}
+
+void PacketCapture::Write(const string& strBlock)
+{
+    m_fOut.write(strBlock.data(), strBlock.size());
+    m_nFileBytes += strBlock.size();
+    if (m_fOut.fail() == true)
+        m_fOut.close();
+}
+
+// A crash must not take more than the last FLUSHINTERVAL along, that is what the capture is for
+void PacketCapture::Flush()
+{
+    if (m_fOut.is_open() == false)
+        return;
+    m_fOut.flush();
+    if (m_fOut.fail() == true)
+        m_fOut.close();
+}
+
+string PacketCapture::MakeHeaders(const BLOCK& Block)
+{
+    int adrFamily = 0, adrDestFamily = 0;
+    unsigned char Source[16], Destination[16];
+    unsigned short nSourcePort = 0, nDestPort = 0;
+    if (ParseAddress(Block.szSource, adrFamily, Source, nSourcePort) == false || ParseAddress(Block.szDestination, adrDestFamily, Destination, nDestPort) == false || adrFamily != adrDestFamily)
+        return string();
+
+    const uint16_t nUdpLen = static_cast<uint16_t>(8 + Block.nLen);
+    string strHeaders;
+    if (adrFamily == AF_INET)
+    {
+        strHeaders += { 0x45, 0 };
+        AppendNet16(strHeaders, static_cast<uint16_t>(20 + nUdpLen));
+        strHeaders += { 0, 0, 0, 0, static_cast<char>(255), 17, 0, 0 };
+        strHeaders.append(reinterpret_cast<const char*>(Source), 4);
+        strHeaders.append(reinterpret_cast<const char*>(Destination), 4);
+        const uint16_t nChecksum = ChecksumFold(ChecksumAdd(0, reinterpret_cast<const unsigned char*>(strHeaders.data()), 20));
+        strHeaders[10] = static_cast<char>(nChecksum >> 8);
+        strHeaders[11] = static_cast<char>(nChecksum & 0xff);
+    }
+    else
+    {
+        strHeaders += { 0x60, 0, 0, 0 };
+        AppendNet16(strHeaders, nUdpLen);
+        strHeaders += { 17, static_cast<char>(255) };
+        strHeaders.append(reinterpret_cast<const char*>(Source), 16);
+        strHeaders.append(reinterpret_cast<const char*>(Destination), 16);
+    }
+
+    AppendNet16(strHeaders, nSourcePort);
+    AppendNet16(strHeaders, nDestPort);
+    AppendNet16(strHeaders, nUdpLen);
+    AppendNet16(strHeaders, 0);     // IPv4 may go without a checksum, RFC 768
+
+    // IPv6 may not, the pseudo header is the addresses, the length and the protocol, RFC 8200 8.1
+    if (adrFamily == AF_INET6 && Block.nLen <= BLOCKSIZE)
+    {
+        uint32_t nSum = ChecksumAdd(0, Source, 16);
+        nSum = ChecksumAdd(nSum, Destination, 16);
+        nSum += nUdpLen + 17;
+        nSum = ChecksumAdd(nSum, reinterpret_cast<const unsigned char*>(strHeaders.data()) + 40, 8);
+        nSum = ChecksumAdd(nSum, Block.vData.data(), Block.nLen);
+        uint16_t nChecksum = ChecksumFold(nSum);
+        if (nChecksum == 0)
+            nChecksum = 0xffff;
+        strHeaders[46] = static_cast<char>(nChecksum >> 8);
+        strHeaders[47] = static_cast<char>(nChecksum & 0xff);
+    }
+    return strHeaders;
+}
+
+string PacketCapture::SectionHeader()
+{
+    // Section header block, pcapng 4.1, the section length is not known
+    string strBody;
+    Append32(strBody, 0x1a2b3c4d);
+    Append16(strBody, 1);
+    Append16(strBody, 0);
+    Append32(strBody, 0xffffffff);
+    Append32(strBody, 0xffffffff);
+    AppendOption(strBody, 4, "mDnsServ");  // shb_userappl
+    Append32(strBody, 0);
+    return PcapBlock(0x0a0d0d0a, strBody);
+}
+
+string PacketCapture::InterfaceDescription(uint32_t nInterface)
+{
+    // Interface description block, pcapng 4.2. Raw IP, the packets start with the IP header
+    string strBody;
+    Append16(strBody, 101);     // LINKTYPE_RAW
+    Append16(strBody, 0);
+    Append32(strBody, static_cast<uint32_t>(BLOCKSIZE + 48));
+    char szName[IF_NAMESIZE + 1] = { 0 };
+    AppendOption(strBody, 2, if_indextoname(nInterface, szName) != nullptr ? string(szName) : to_string(nInterface));     // if_name
+    Append32(strBody, 0);
+    return PcapBlock(1, strBody);
+}
+
+string PacketCapture::PcapBlock(uint32_t nType, const string& strBody)
+{
+    string strBlock;
+    strBlock.reserve(strBody.size() + 12);
+    Append32(strBlock, nType);
+    Append32(strBlock, static_cast<uint32_t>(strBody.size() + 12));
+    strBlock += strBody;
+    Append32(strBlock, static_cast<uint32_t>(strBody.size() + 12));
+    return strBlock;
+}
+
+void PacketCapture::CopyAddress(char szDest[ADDRSIZE], const char* szAddr, unsigned short nPort)
+{
+    // A cut address would give a wrong one in the headers, better none
+    int iLen = 0;
+    if (nPort == 0)
+        iLen = snprintf(szDest, ADDRSIZE, "%s", szAddr);
+    else
+        iLen = snprintf(szDest, ADDRSIZE, strchr(szAddr, ':') != nullptr ? "[%s]:%u" : "%s:%u", szAddr, static_cast<unsigned int>(nPort));
+    if (iLen < 0 || static_cast<size_t>(iLen) >= ADDRSIZE)
+        szDest[0] = 0;
+}
+
+bool PacketCapture::ParseAddress(const string& strAddr, int& adrFamily, unsigned char Addr[16], unsigned short& nPort)
+{
+    const size_t nColon = strAddr.rfind(':');
+    if (nColon == string::npos)
+        return false;
+    nPort = static_cast<unsigned short>(atoi(strAddr.c_str() + nColon + 1));
+    if (strAddr.empty() == false && strAddr[0] == '[')
+    {
+        adrFamily = AF_INET6;
+        const string strHost = strAddr.substr(1, strAddr.find(']') - 1);
+        return inet_pton(AF_INET6, strHost.substr(0, strHost.find('%')).c_str(), Addr) == 1;
+    }
+    adrFamily = AF_INET;
+    return inet_pton(AF_INET, strAddr.substr(0, nColon).c_str(), Addr) == 1;
+}
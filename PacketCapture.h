@@ -0,0 +1,132 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+// Writes the datagrams received and sent to a pcapng file, Wireshark shows them as mDNS. The DNS
+// payload gets an IPv4 or IPv6 and a UDP header made up from the addresses, the interface of each
+// packet gets its own interface block and the direction goes in the packet flags. The caller only
+// copies the packet into one of the blocks allocated at Start and goes on, the writer thread does
+// the rest. When all blocks are waiting to be written the packet is dropped, the caller never waits.
+// The writes are buffered, the file is flushed FLUSHINTERVAL after the first packet not flushed yet
+// and at Stop. The file is rotated when it gets too big: file, file.1, file.2, ...
+class PacketCapture
+{
+public:
+    enum DIRECTION { INBOUND = 1, OUTBOUND = 2 };   // the epb_flags values, pcapng 4.3.1
+
+    typedef struct
+    {
+        uint64_t nWritten;
+        uint64_t nSampledOut;       // skipped by the sampling
+        uint64_t nFiltered;         // not naming one of the filter names
+        uint64_t nDropped;          // no free block, or the file could not be written
+        uint64_t nRotations;
+    }STATISTICS;
+
+    static const size_t BLOCKS = 256;
+    static const size_t BLOCKSIZE = 9000;   // the largest mDNS packet, RFC 6762 17, longer ones are cut
+    static const size_t ADDRSIZE = 64;      // "[" + IPv6 address + "%" + scope id + "]:" + port and the 0
+    static const int FLUSHINTERVAL = 1000;  // ms, a crash loses at most the packets of this time
+
+public:
+    PacketCapture();
+    virtual ~PacketCapture();
+
+    // Can be called while packets come in, nMaxFiles counts the current file too
+    bool Start(const string& strFile, uint64_t nMaxFileBytes, size_t nMaxFiles);
+    void Stop();
+    bool IsEnabled() const;
+    // Only every nOneIn-th packet is taken, 1 = all
+    void SetSampling(uint32_t nOneIn);
+    // Only packets with a question or record of one of the names or below it, empty = all
+    void SetNameFilter(const vector<string>& vNames);
+
+    // Addresses as "192.168.1.2:5353" or "[fe80::1%4]:5353"
+    void Capture(DIRECTION Direction, uint32_t nInterface, const char* szSource, const char* szDestination, const void* pData, size_t nLen);
+    // Sent from our own socket, szLocalAddr is its address without the port. Nothing is allocated for the addresses
+    void CaptureSent(uint32_t nInterface, const char* szLocalAddr, unsigned short nLocalPort, const char* szDestination, const void* pData, size_t nLen);
+    STATISTICS GetStatistics() const;
+
+private:
+    typedef struct
+    {
+        DIRECTION Direction;
+        uint32_t nInterface;
+        chrono::system_clock::time_point tTime;
+        char szSource[ADDRSIZE];    // copied in without allocating, empty if the address does not fit
+        char szDestination[ADDRSIZE];
+        size_t nLen;                // of the packet, vData holds at most BLOCKSIZE of it
+        vector<unsigned char> vData;
+    }BLOCK;
+
+private:
+    void Enqueue(DIRECTION Direction, uint32_t nInterface, const char* szSource, unsigned short nSourcePort, const char* szDestination, const void* pData, size_t nLen);
+    void Writer();
+    void WriteBlock(BLOCK& Block);
+    bool Matches(BLOCK& Block);
+    bool OpenFile();
+    bool Rotate();
+    uint32_t InterfaceId(uint32_t nInterface);
+    void Write(const string& strBlock);
+    void Flush();
+
+    static string MakeHeaders(const BLOCK& Block);
+    static string SectionHeader();
+    static string InterfaceDescription(uint32_t nInterface);
+    static string PcapBlock(uint32_t nType, const string& strBody);
+    // nPort 0 if szAddr has its port already
+    static void CopyAddress(char szDest[ADDRSIZE], const char* szAddr, unsigned short nPort);
+    static bool ParseAddress(const string& strAddr, int& adrFamily, unsigned char Addr[16], unsigned short& nPort);
+
+private:
+    mutable mutex        m_mxBlocks;        // guards the members up to m_bStop
+    condition_variable   m_cvBlocks;
+    vector<BLOCK>        m_vBlocks;
+    vector<size_t>       m_vFree;
+    deque<size_t>        m_dqReady;         // oldest first
+    bool                 m_bStop;
+    thread               m_thWriter;
+    atomic<bool>         m_bEnabled;
+    atomic<uint32_t>     m_nSampling;
+    atomic<uint64_t>     m_nSampleCounter;
+
+    mutex                m_mxFilter;        // guards m_vFilter
+    vector<string>       m_vFilter;         // lower case
+
+    // Only used by the writer thread and by Start/Stop while it does not run
+    string               m_strFile;
+    uint64_t             m_nMaxFileBytes;
+    size_t               m_nMaxFiles;
+    ofstream             m_fOut;
+    uint64_t             m_nFileBytes;
+    map<uint32_t, uint32_t> m_maInterfaceIds;   // interface index -> id of its block in the current file
+
+    atomic<uint64_t>     m_nWritten;
+    atomic<uint64_t>     m_nSampledOut;
+    atomic<uint64_t>     m_nFiltered;
+    atomic<uint64_t>     m_nDropped;
+    atomic<uint64_t>     m_nRotations;
+};
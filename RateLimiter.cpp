@@ -0,0 +1,66 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+
+#include "RateLimiter.h"
+
+RateLimiter::RateLimiter(double dRate, double dBurst, size_t nMaxSources, bool bThreadSafe) : m_mxBuckets(bThreadSafe), m_dRate(dRate), m_dBurst(dBurst), m_nMaxSources(max(nMaxSources, static_cast<size_t>(1)))
+{
+    m_maBuckets.reserve(m_nMaxSources);
+    m_Overflow = { string(), dBurst, chrono::steady_clock::now() };
+}
+
+RateLimiter::~RateLimiter()
+{
+}
+
+bool RateLimiter::Allow(const string& strSource)
+{
+    const auto tNow = chrono::steady_clock::now();
+    lock_guard<OptionalMutex> lock(m_mxBuckets);
+
+    const auto itBucket = m_maBuckets.find(strSource);
+    if (itBucket != end(m_maBuckets))
+    {
+        m_lstBuckets.splice(begin(m_lstBuckets), m_lstBuckets, itBucket->second);
+        return Take(m_lstBuckets.front(), tNow);
+    }
+
+    // Not tracked, the shared bucket pays for this packet. A rejected one does not push a tracked source out
+    if (Take(m_Overflow, tNow) == false)
+        return false;
+
+    if (m_lstBuckets.size() >= m_nMaxSources)
+    {
+        // The bucket heard from least recently is reused, no allocation for the list node either
+        m_maBuckets.erase(m_lstBuckets.back().strSource);
+        m_lstBuckets.splice(begin(m_lstBuckets), m_lstBuckets, prev(end(m_lstBuckets)));
+        m_lstBuckets.front().strSource = strSource;
+        m_lstBuckets.front().dTokens = 0;
+        m_lstBuckets.front().tLast = tNow;
+    }
+    else
+        m_lstBuckets.push_front(BUCKET{ strSource, 0, tNow });     // empty, it fills at nRate like any other
+    m_maBuckets.emplace(strSource, begin(m_lstBuckets));
+    return true;
+}
+
+bool RateLimiter::Take(BUCKET& Bucket, chrono::steady_clock::time_point tNow)
+{
+    Bucket.dTokens = min(m_dBurst, Bucket.dTokens + chrono::duration<double>(tNow - Bucket.tLast).count() * m_dRate);
+    Bucket.tLast = tNow;
+    if (Bucket.dTokens < 1.0)
+        return false;
+    Bucket.dTokens -= 1.0;
+    return true;
+}
@@ -0,0 +1,57 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <list>
+#include <chrono>
+
+#include "OptionalMutex.h"
+
+using namespace std;
+
+// One token bucket per source address. A source may send nBurst packets at once and nRate per second
+// after that. A source without a bucket, new or forgotten, pays with a token of one overflow bucket all
+// of them share, and only then gets its own, empty bucket. So a flood of made up addresses gets nRate
+// and nBurst together, and a throttled source gains nothing by being forgotten. The number of sources
+// tracked is limited, the buckets are kept in the order they were used and a new source takes the place
+// of the one heard from least recently, every packet costs the same no matter how many sources there are.
+class RateLimiter
+{
+public:
+    // bThreadSafe false if Allow is always called from the same thread
+    RateLimiter(double dRate, double dBurst, size_t nMaxSources, bool bThreadSafe = true);
+    virtual ~RateLimiter();
+
+    bool Allow(const string& strSource);
+
+private:
+    typedef struct
+    {
+        string strSource;
+        double dTokens;
+        chrono::steady_clock::time_point tLast;
+    }BUCKET;
+
+    bool Take(BUCKET& Bucket, chrono::steady_clock::time_point tNow);
+
+private:
+    OptionalMutex m_mxBuckets;
+    double m_dRate;
+    double m_dBurst;
+    size_t m_nMaxSources;
+    list<BUCKET> m_lstBuckets;      // the one used last first
+    unordered_map<string, list<BUCKET>::iterator> m_maBuckets;
+    BUCKET m_Overflow;              // strSource unused
+};
@@ -0,0 +1,234 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+#include <cctype>
+
+#include "DnsProtokol.h"
+#include "RecordCache.h"
+#include "CacheSnapshot.h"
+
+RecordCache::RecordCache(bool bThreadSafe) : m_mxCache(bThreadSafe), m_nEntries(0), m_nNextCallbackId(1)
+{
+}
+
+RecordCache::~RecordCache()
+{
+}
+
+size_t RecordCache::AddChangeCallback(CHANGECALLBACK fnCallback)
+{
+    lock_guard<OptionalMutex> lock(m_mxCache);
+    m_maCallbacks.emplace(m_nNextCallbackId, fnCallback);
+    return m_nNextCallbackId++;
+}
+
+void RecordCache::RemoveChangeCallback(size_t nId)
+{
+    unique_lock<OptionalMutex> lock(m_mxCache);
+    m_maCallbacks.erase(nId);
+
+    // A notification may have copied the callback before, it runs without the lock. A callback removing
+    // itself is not waited for, that would never end
+    const thread::id idSelf = this_thread::get_id();
+    m_cvNotify.wait(lock, [&]() { return m_msNotifying.size() == m_msNotifying.count(idSelf); });
+}
+
+void RecordCache::Add(const string& strName, unsigned short usType, unsigned short usClass, const string& strRData, uint32_t nTtl, uint32_t nInterface)
+{
+    const auto tNow = chrono::steady_clock::now();
+    vector<ENTRY> vAdded;
+    map<size_t, CHANGECALLBACK> maCallbacks;
+    {
+        lock_guard<OptionalMutex> lock(m_mxCache);
+        vector<ENTRY>& vEntries = m_maEntries[MakeKey(strName, usType)];
+
+        // Cache flush, the records of the same name and type received more than a second ago are outdated, RFC 6762 10.2
+        if ((usClass & 0x8000) != 0)
+        {
+            if (m_pSnapshot != nullptr)
+                m_setFlushed.insert(MakeKey(strName, usType));
+            for (auto& Entry : vEntries)
+            {
+                if (Entry.strRData != strRData && tNow - Entry.tReceived > chrono::seconds(1) && Entry.tExpire > tNow + chrono::seconds(1))
+                    Entry.tExpire = tNow + chrono::seconds(1);
+            }
+        }
+
+        // A goodbye keeps the record for one more second, RFC 6762 10.1
+        const auto tExpire = nTtl == 0 ? tNow + chrono::seconds(1) : tNow + chrono::seconds(nTtl);
+        const auto& itEntry = find_if(begin(vEntries), end(vEntries), [&](const ENTRY& Entry) { return Entry.strRData == strRData && Entry.usClass == (usClass & 0x7fff); });
+        if (itEntry != end(vEntries))
+        {
+            itEntry->nTtl = nTtl;
+            itEntry->tReceived = tNow;
+            itEntry->tExpire = tExpire;
+            itEntry->nInterface = nInterface;
+        }
+        else if (nTtl != 0 && m_nEntries < MAXENTRIES)
+        {
+            vEntries.push_back({ strName, usType, static_cast<unsigned short>(usClass & 0x7fff), strRData, nTtl, tNow, tExpire, nInterface });
+            vAdded.push_back(vEntries.back());
+            ++m_nEntries;
+        }
+        else if (vEntries.empty() == true)
+            m_maEntries.erase(MakeKey(strName, usType));
+
+        if (vAdded.empty() == false)
+        {
+            maCallbacks = m_maCallbacks;
+            m_msNotifying.insert(this_thread::get_id());
+        }
+    }
+
+    if (vAdded.empty() == false)
+        Notify(maCallbacks, vAdded, true);
+}
+
+vector<RecordCache::ENTRY> RecordCache::Lookup(const string& strName, unsigned short usType) const
+{
+    const auto tNow = chrono::steady_clock::now();
+    vector<ENTRY> vResult;
+    lock_guard<OptionalMutex> lock(m_mxCache);
+    const auto& itEntries = m_maEntries.find(MakeKey(strName, usType));
+    if (itEntries != end(m_maEntries))
+        copy_if(begin(itEntries->second), end(itEntries->second), back_inserter(vResult), [&tNow](const ENTRY& Entry) { return Entry.tExpire > tNow; });
+
+    if (m_pSnapshot != nullptr && m_setFlushed.find(MakeKey(strName, usType)) == end(m_setFlushed))
+    {
+        for (auto& Entry : m_pSnapshot->Lookup(strName, usType))
+        {
+            if (itEntries == end(m_maEntries) || none_of(begin(itEntries->second), end(itEntries->second), [&Entry](const ENTRY& item) { return item.strRData == Entry.strRData; }))
+                vResult.push_back(move(Entry));
+        }
+    }
+    return vResult;
+}
+
+bool RecordCache::IsNegative(const string& strName, unsigned short usType) const
+{
+    if (usType == 47 || usType == 255 || Lookup(strName, usType).empty() == false)
+        return false;   // a record received after the NSEC outdates it
+
+    for (const auto& Entry : Lookup(strName, 47))
+    {
+        string strNextName;
+        vector<unsigned short> vTypes;
+        if (DnsProtokol::ParseNsec(Entry.strRData, strNextName, vTypes) == true && find(begin(vTypes), end(vTypes), usType) == end(vTypes))
+            return true;
+    }
+    return false;
+}
+
+vector<RecordCache::ENTRY> RecordCache::GetAll() const
+{
+    vector<ENTRY> vResult;
+    lock_guard<OptionalMutex> lock(m_mxCache);
+    vResult.reserve(m_nEntries);
+    for (const auto& item : m_maEntries)
+        vResult.insert(end(vResult), begin(item.second), end(item.second));
+    return vResult;
+}
+
+size_t RecordCache::Size() const
+{
+    lock_guard<OptionalMutex> lock(m_mxCache);
+    return m_nEntries;
+}
+
+chrono::steady_clock::time_point RecordCache::Expire()
+{
+    const auto tNow = chrono::steady_clock::now();
+    auto tNext = chrono::steady_clock::time_point::max();
+    vector<ENTRY> vRemoved;
+    map<size_t, CHANGECALLBACK> maCallbacks;
+    {
+        lock_guard<OptionalMutex> lock(m_mxCache);
+        for (auto itEntries = begin(m_maEntries); itEntries != end(m_maEntries);)
+        {
+            vector<ENTRY>& vEntries = itEntries->second;
+            for (auto it = begin(vEntries); it != end(vEntries);)
+            {
+                if (it->tExpire <= tNow)
+                {
+                    vRemoved.push_back(move(*it));
+                    it = vEntries.erase(it);
+                    --m_nEntries;
+                }
+                else
+                    tNext = min(tNext, (it++)->tExpire);
+            }
+            itEntries = vEntries.empty() == true ? m_maEntries.erase(itEntries) : next(itEntries);
+        }
+
+        if (vRemoved.empty() == false)
+        {
+            maCallbacks = m_maCallbacks;
+            m_msNotifying.insert(this_thread::get_id());
+        }
+    }
+
+    if (vRemoved.empty() == false)
+        Notify(maCallbacks, vRemoved, false);
+    return tNext;
+}
+
+void RecordCache::AttachSnapshot(unique_ptr<CacheSnapshot> pSnapshot)
+{
+    lock_guard<OptionalMutex> lock(m_mxCache);
+    m_pSnapshot = move(pSnapshot);
+    m_setFlushed.clear();
+}
+
+void RecordCache::AdoptSnapshot()
+{
+    lock_guard<OptionalMutex> lock(m_mxCache);
+    if (m_pSnapshot == nullptr)
+        return;
+
+    for (auto& Entry : m_pSnapshot->GetAll())
+    {
+        const KEY Key = MakeKey(Entry.strName, Entry.usType);
+        if (m_setFlushed.find(Key) != end(m_setFlushed) || m_nEntries >= MAXENTRIES)
+            continue;
+        vector<ENTRY>& vEntries = m_maEntries[Key];
+        if (none_of(begin(vEntries), end(vEntries), [&Entry](const ENTRY& item) { return item.strRData == Entry.strRData; }))
+        {
+            vEntries.push_back(move(Entry));
+            ++m_nEntries;
+        }
+    }
+
+    m_pSnapshot.reset();
+    m_setFlushed.clear();
+}
+
+void RecordCache::Notify(const map<size_t, CHANGECALLBACK>& maCallbacks, const vector<ENTRY>& vEntries, bool bAdded)
+{
+    // Called after the thread was put into m_msNotifying, together with copying the callbacks
+    for (const auto& Entry : vEntries)
+    {
+        for (const auto& item : maCallbacks)
+            item.second(Entry, bAdded);
+    }
+
+    lock_guard<OptionalMutex> lock(m_mxCache);
+    m_msNotifying.erase(m_msNotifying.find(this_thread::get_id()));
+    m_cvNotify.notify_all();
+}
+
+RecordCache::KEY RecordCache::MakeKey(const string& strName, unsigned short usType)
+{
+    KEY Key(strName, usType);
+    transform(begin(Key.first), end(Key.first), begin(Key.first), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+    return Key;
+}
@@ -0,0 +1,94 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+
+#include "OptionalMutex.h"
+
+using namespace std;
+
+class CacheSnapshot;
+
+// The resource records other hosts announced or answered with, RFC 6762 10.
+// Records are kept with their canonical RDATA (names uncompressed) until their TTL runs out.
+// A snapshot from the last run can be attached, its records are found by Lookup until they expire
+// or a cache flush replaces them, and are taken over into the cache by AdoptSnapshot.
+class RecordCache
+{
+public:
+    typedef struct
+    {
+        string strName;
+        unsigned short usType;
+        unsigned short usClass;     // without the cache flush bit
+        string strRData;            // canonical form, see DnsProtokol::GetCanonicalRData
+        uint32_t nTtl;              // as received
+        chrono::steady_clock::time_point tReceived;
+        chrono::steady_clock::time_point tExpire;
+        uint32_t nInterface;        // index of the interface it was received on, 0 = unknown (from the snapshot)
+    }ENTRY;
+
+    // Called without any lock held, bAdded is false if the record expired or was flushed
+    typedef function<void(const ENTRY& Entry, bool bAdded)> CHANGECALLBACK;
+
+    static const size_t MAXENTRIES = 10000;
+
+public:
+    // bThreadSafe false if all members are called from the same thread
+    explicit RecordCache(bool bThreadSafe = true);
+    virtual ~RecordCache();
+
+    // Returns an id for RemoveChangeCallback
+    size_t AddChangeCallback(CHANGECALLBACK fnCallback);
+    // Returns when no other thread is inside a callback any more, the owner of the callback may go away then
+    void RemoveChangeCallback(size_t nId);
+
+    // usClass with the top bit set flushes the other records of the same name and type, TTL 0 is a goodbye
+    void Add(const string& strName, unsigned short usType, unsigned short usClass, const string& strRData, uint32_t nTtl, uint32_t nInterface = 0);
+    vector<ENTRY> Lookup(const string& strName, unsigned short usType) const;
+    // True if the owner of the name told us by an NSEC record that it has no record of the type, RFC 6762 6.1
+    bool IsNegative(const string& strName, unsigned short usType) const;
+    vector<ENTRY> GetAll() const;       // without the records of an attached snapshot
+    size_t Size() const;
+    // Removes the records whose TTL ran out, returns the time the next one does
+    chrono::steady_clock::time_point Expire();
+
+    void AttachSnapshot(unique_ptr<CacheSnapshot> pSnapshot);
+    // Copies the records still valid from the snapshot into the cache and releases the snapshot file
+    void AdoptSnapshot();
+
+private:
+    typedef pair<string, unsigned short> KEY;     // lower case name, type
+    static KEY MakeKey(const string& strName, unsigned short usType);
+    void Notify(const map<size_t, CHANGECALLBACK>& maCallbacks, const vector<ENTRY>& vEntries, bool bAdded);
+
+private:
+    mutable OptionalMutex    m_mxCache;
+    map<KEY, vector<ENTRY>>  m_maEntries;
+    size_t                   m_nEntries;
+    map<size_t, CHANGECALLBACK> m_maCallbacks;
+    size_t                   m_nNextCallbackId;
+    multiset<thread::id>     m_msNotifying; // threads calling the callbacks they copied, RemoveChangeCallback waits for them
+    condition_variable_any   m_cvNotify;
+    unique_ptr<CacheSnapshot> m_pSnapshot;
+    set<KEY>                 m_setFlushed;  // the snapshot records of these are outdated by a cache flush
+};
@@ -0,0 +1,261 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+#if defined (_WIN32) || defined (_WIN64)
+#include <WinSock2.h>
+#include <Ws2tcpip.h>
+#include <iphlpapi.h>
+#pragma comment(lib, "Iphlpapi.lib")
+#else
+#include <net/if.h>
+#endif
+#include "Reflector.h"
+
+const size_t Reflector::MAXDIGESTS;
+const int Reflector::REFLECTIONWINDOW;
+
+Reflector::Reflector(RecordCache& Cache, SENDER fnSend) : m_Cache(Cache), m_fnSend(fnSend), m_Limiter(50.0, 100.0, 256), m_nForwarded(0), m_nDuplicates(0), m_nRateLimited(0), m_nAnsweredFromCache(0)
+{
+}
+
+Reflector::~Reflector()
+{
+}
+
+bool Reflector::SetInterfaces(const vector<string>& vInterfaces)
+{
+    bool bAllKnown = true;
+    m_setInterfaces.clear();
+    for (const auto& strInterface : vInterfaces)
+    {
+        const uint32_t nIndex = strInterface.find_first_not_of("0123456789") == string::npos ? static_cast<uint32_t>(strtoul(strInterface.c_str(), nullptr, 10)) : if_nametoindex(strInterface.c_str());
+        if (nIndex == 0)
+            bAllKnown = false;
+        else
+            m_setInterfaces.insert(nIndex);
+    }
+    return bAllKnown;
+}
+
+bool Reflector::IsEnabled() const
+{
+    return m_setInterfaces.size() > 1;
+}
+
+bool Reflector::IsReflected(uint32_t nInterface) const
+{
+    return IsEnabled() == true && m_setInterfaces.find(nInterface) != end(m_setInterfaces);
+}
+
+void Reflector::Process(const unsigned char* pBuffer, size_t nRead, DnsProtokol& dnsProto, const string& strFrom, int adrFamily, uint32_t nInterface)
+{
+    if (IsReflected(nInterface) == false || nRead < 12)
+        return;
+
+    // The answer to a legacy query goes back to the port it came from by unicast, we would never see it, RFC 6762 6.7
+    if (dnsProto.m_DnsHeader.QR == 0 && strFrom.substr(strFrom.rfind(':') + 1) != "5353")
+        return;
+
+    if (IsOwnReflection(nInterface, pBuffer, nRead) == true)
+    {
+        ++m_nDuplicates;
+        return;
+    }
+
+    // Probes must reach the other links to find conflicts there, they are always forwarded
+    if (dnsProto.m_DnsHeader.QR == 0 && dnsProto.m_DnsHeader.NSCOUNT == 0 && dnsProto.m_DnsHeader.TC == 0 && AnswerFromCache(pBuffer, nRead, dnsProto, adrFamily, nInterface) == true)
+    {
+        ++m_nAnsweredFromCache;
+        return;
+    }
+
+    const string strPacket = Rewrite(pBuffer, nRead, dnsProto);
+    if (strPacket.empty() == true)
+        return;
+
+    for (const auto nTo : m_setInterfaces)
+    {
+        if (nTo != nInterface)
+            Send(nInterface, nTo, adrFamily, strPacket);
+    }
+}
+
+Reflector::STATISTICS Reflector::GetStatistics() const
+{
+    return { m_nForwarded, m_nDuplicates, m_nRateLimited, m_nAnsweredFromCache };
+}
+
+bool Reflector::AnswerFromCache(const unsigned char* pBuffer, size_t nRead, DnsProtokol& dnsProto, int adrFamily, uint32_t nInterface)
+{
+    auto fnLower = [](string strName) { transform(begin(strName), end(strName), begin(strName), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); }); return strName; };
+
+    // Records the querier listed as known with at least half their TTL left are not sent again, RFC 6762 7.1
+    vector<tuple<string, unsigned short, string, uint32_t>> vKnown;
+    for (short n = 0; n < dnsProto.m_DnsHeader.ANCOUNT; ++n)
+    {
+        const auto& Record = dnsProto.m_pAnswers.get()[n];
+        vKnown.emplace_back(fnLower(string(begin(Record.LABEL), end(Record.LABEL))), Record.TYPE, dnsProto.GetCanonicalRData(pBuffer, nRead, Record), Record.TTL);
+    }
+
+    const auto tNow = chrono::steady_clock::now();
+    string strRecords;
+    unsigned short nRecords = 0;
+    for (short n = 0; n < dnsProto.m_DnsHeader.QDCOUNT; ++n)
+    {
+        const auto& Question = dnsProto.m_pQuestions.get()[n];
+        if (Question.QTYPE == 255)
+            return false;   // we never know if we have all types of a name
+
+        size_t nFound = 0;
+        for (const auto& Entry : m_Cache.Lookup(string(begin(Question.LABEL), end(Question.LABEL)), Question.QTYPE))
+        {
+            // Only records learned on another link and fresh enough, on its own link the owner answers itself
+            const auto tLeft = chrono::duration_cast<chrono::seconds>(Entry.tExpire - tNow);
+            if (Entry.nInterface == 0 || Entry.nInterface == nInterface || IsLinkLocal(Entry.usType, Entry.strRData) == true || tLeft.count() * 2 <= static_cast<int64_t>(Entry.nTtl))
+                continue;
+            ++nFound;
+
+            const string strName = fnLower(Entry.strName);
+            if (any_of(begin(vKnown), end(vKnown), [&](const tuple<string, unsigned short, string, uint32_t>& item) { return get<0>(item) == strName && get<1>(item) == Entry.usType && get<2>(item) == Entry.strRData && uint64_t(get<3>(item)) * 2 >= Entry.nTtl; }) == true)
+                continue;
+
+            AppendRecord(strRecords, Entry.strName, Entry.usType, Entry.usClass, static_cast<uint32_t>(tLeft.count()), Entry.strRData);
+            ++nRecords;
+        }
+        if (nFound == 0)
+            return false;
+    }
+
+    if (nRecords > 0)
+    {
+        // Response, authoritative, no questions, RFC 6762 18
+        string strPacket = { 0, 0, static_cast<char>(0x84), 0, 0, 0, static_cast<char>(nRecords >> 8), static_cast<char>(nRecords & 0xff), 0, 0, 0, 0 };
+        strPacket += strRecords;
+        Send(nInterface, nInterface, adrFamily, strPacket);
+    }
+    return true;
+}
+
+string Reflector::Rewrite(const unsigned char* pBuffer, size_t nRead, DnsProtokol& dnsProto)
+{
+    // The packet is built again without name compression, that way records can be left out
+    string strPacket(reinterpret_cast<const char*>(pBuffer), 4);    // ID and flags
+    strPacket.append(8, '\0');
+
+    for (short n = 0; n < dnsProto.m_DnsHeader.QDCOUNT; ++n)
+    {
+        // The QU bit is not forwarded, a unicast answer would come to us and not to the one asking
+        const auto& Question = dnsProto.m_pQuestions.get()[n];
+        strPacket += DnsProtokol::EncodeName(string(begin(Question.LABEL), end(Question.LABEL)));
+        strPacket += { static_cast<char>(Question.QTYPE >> 8), static_cast<char>(Question.QTYPE & 0xff), static_cast<char>(Question.QCLASS >> 8), static_cast<char>(Question.QCLASS & 0xff) };
+    }
+
+    unsigned short nCounts[4] = { dnsProto.m_DnsHeader.QDCOUNT, 0, 0, 0 };
+    const pair<const DnsProtokol::RRECORDS*, unsigned short> Sections[3] = { { dnsProto.m_pAnswers.get(), dnsProto.m_DnsHeader.ANCOUNT }, { dnsProto.m_pNameServ.get(), dnsProto.m_DnsHeader.NSCOUNT }, { dnsProto.m_pExtraRec.get(), dnsProto.m_DnsHeader.ARCOUNT } };
+    for (size_t nSection = 0; nSection < 3; ++nSection)
+    {
+        for (unsigned short n = 0; n < Sections[nSection].second; ++n)
+        {
+            const auto& Record = Sections[nSection].first[n];
+            const string strRData = dnsProto.GetCanonicalRData(pBuffer, nRead, Record);
+            if (IsLinkLocal(Record.TYPE, strRData) == true)
+                continue;   // not reachable from another link
+            AppendRecord(strPacket, string(begin(Record.LABEL), end(Record.LABEL)), Record.TYPE, Record.CLASS, Record.TTL, strRData);
+            ++nCounts[nSection + 1];
+        }
+    }
+
+    if (dnsProto.m_DnsHeader.QR == 1 && nCounts[1] == 0)
+        return string();    // nothing left worth telling the other links
+
+    for (size_t n = 0; n < 4; ++n)
+    {
+        strPacket[4 + n * 2] = static_cast<char>(nCounts[n] >> 8);
+        strPacket[5 + n * 2] = static_cast<char>(nCounts[n] & 0xff);
+    }
+    return strPacket;
+}
+
+void Reflector::Send(uint32_t nFrom, uint32_t nTo, int adrFamily, const string& strPacket)
+{
+    if (m_Limiter.Allow(to_string(nFrom) + ">" + to_string(nTo)) == false)
+    {
+        ++m_nRateLimited;
+        return;
+    }
+
+    RememberSent(nTo, strPacket);     // when it comes back on that interface it is not forwarded again
+    m_fnSend(nTo, adrFamily, strPacket);
+    if (nFrom != nTo)
+        ++m_nForwarded;
+}
+
+void Reflector::RememberSent(uint32_t nInterface, const string& strPacket)
+{
+    const uint64_t nDigest = Digest(nInterface, strPacket.data(), strPacket.size());
+    const auto tNow = chrono::steady_clock::now();
+    lock_guard<mutex> lock(m_mxDigests);
+
+    while (m_lstDigests.empty() == false && (tNow - m_lstDigests.front().first > chrono::milliseconds(REFLECTIONWINDOW) || m_lstDigests.size() >= MAXDIGESTS))
+    {
+        const auto& itDigest = m_maDigests.find(m_lstDigests.front().second);
+        if (itDigest != end(m_maDigests) && itDigest->second == m_lstDigests.front().first)
+            m_maDigests.erase(itDigest);
+        m_lstDigests.pop_front();
+    }
+
+    m_maDigests[nDigest] = tNow;
+    m_lstDigests.emplace_back(tNow, nDigest);
+}
+
+bool Reflector::IsOwnReflection(uint32_t nInterface, const unsigned char* pBuffer, size_t nLen)
+{
+    const uint64_t nDigest = Digest(nInterface, reinterpret_cast<const char*>(pBuffer), nLen);
+    const auto tNow = chrono::steady_clock::now();
+    lock_guard<mutex> lock(m_mxDigests);
+
+    const auto& itDigest = m_maDigests.find(nDigest);
+    return itDigest != end(m_maDigests) && tNow - itDigest->second <= chrono::milliseconds(REFLECTIONWINDOW);
+}
+
+void Reflector::AppendRecord(string& strPacket, const string& strName, unsigned short usType, unsigned short usClass, uint32_t nTtl, const string& strRData)
+{
+    strPacket += DnsProtokol::EncodeName(strName);
+    strPacket += { static_cast<char>(usType >> 8), static_cast<char>(usType & 0xff), static_cast<char>(usClass >> 8), static_cast<char>(usClass & 0xff) };
+    strPacket += { static_cast<char>(nTtl >> 24), static_cast<char>((nTtl >> 16) & 0xff), static_cast<char>((nTtl >> 8) & 0xff), static_cast<char>(nTtl & 0xff) };
+    strPacket += { static_cast<char>(strRData.size() >> 8), static_cast<char>(strRData.size() & 0xff) };
+    strPacket += strRData;
+}
+
+bool Reflector::IsLinkLocal(unsigned short usType, const string& strRData)
+{
+    const unsigned char* pAddr = reinterpret_cast<const unsigned char*>(strRData.data());
+    if (usType == 1 && strRData.size() == 4)
+        return pAddr[0] == 169 && pAddr[1] == 254;              // 169.254.0.0/16
+    if (usType == 28 && strRData.size() == 16)
+        return pAddr[0] == 0xfe && (pAddr[1] & 0xc0) == 0x80;   // fe80::/10
+    return false;
+}
+
+uint64_t Reflector::Digest(uint32_t nInterface, const char* pPacket, size_t nLen)
+{
+    uint64_t nHash = 0xcbf29ce484222325;    // FNV-1a, over the interface and the packet
+    for (size_t n = 0; n < sizeof(nInterface); ++n)
+        nHash = (nHash ^ ((nInterface >> (n * 8)) & 0xff)) * 0x100000001b3;
+    for (size_t n = 0; n < nLen; ++n)
+        nHash = (nHash ^ static_cast<unsigned char>(pPacket[n])) * 0x100000001b3;
+    return nHash;
+}
@@ -0,0 +1,93 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <deque>
+#include <tuple>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include "DnsProtokol.h"
+#include "RecordCache.h"
+#include "RateLimiter.h"
+
+using namespace std;
+
+// Forwards multicast queries and answers between the selected interfaces, so services on one link or VLAN
+// are found from the others. Every packet we send is remembered by a digest together with the interface
+// it went out on for a short time, only that packet coming back on that interface (a loop or a second
+// reflector) is dropped. Repeated probes, queries and announcements of the hosts are forwarded. Addresses
+// only valid on their own link are removed before forwarding, and queries the cache can answer with
+// records learned on another interface are answered and not forwarded.
+class Reflector
+{
+public:
+    // Multicasts the packet on the interface, on the sockets of the address family
+    typedef function<void(uint32_t nInterface, int adrFamily, const string& strPacket)> SENDER;
+
+    typedef struct
+    {
+        uint64_t nForwarded;            // packets sent to another interface
+        uint64_t nDuplicates;           // our own reflections coming back, not forwarded again
+        uint64_t nRateLimited;          // packets not forwarded, the direction had used up its share
+        uint64_t nAnsweredFromCache;    // queries answered by us and not forwarded
+    }STATISTICS;
+
+    static const size_t MAXDIGESTS = 8192;
+    static const int REFLECTIONWINDOW = 200;    // ms, a reflection comes back at once, probes are 250 ms apart
+
+public:
+    Reflector(RecordCache& Cache, SENDER fnSend);
+    virtual ~Reflector();
+
+    // Interface names or indices, to be set before packets arrive. Returns false if one is not known
+    bool SetInterfaces(const vector<string>& vInterfaces);
+    bool IsEnabled() const;
+    bool IsReflected(uint32_t nInterface) const;
+
+    // A packet received from another host on a reflected interface
+    void Process(const unsigned char* pBuffer, size_t nRead, DnsProtokol& dnsProto, const string& strFrom, int adrFamily, uint32_t nInterface);
+    STATISTICS GetStatistics() const;
+
+private:
+    bool AnswerFromCache(const unsigned char* pBuffer, size_t nRead, DnsProtokol& dnsProto, int adrFamily, uint32_t nInterface);
+    string Rewrite(const unsigned char* pBuffer, size_t nRead, DnsProtokol& dnsProto);
+    void Send(uint32_t nFrom, uint32_t nTo, int adrFamily, const string& strPacket);
+    void RememberSent(uint32_t nInterface, const string& strPacket);
+    bool IsOwnReflection(uint32_t nInterface, const unsigned char* pBuffer, size_t nLen);
+
+    static void AppendRecord(string& strPacket, const string& strName, unsigned short usType, unsigned short usClass, uint32_t nTtl, const string& strRData);
+    static bool IsLinkLocal(unsigned short usType, const string& strRData);
+    static uint64_t Digest(uint32_t nInterface, const char* pPacket, size_t nLen);
+
+private:
+    RecordCache&     m_Cache;
+    SENDER           m_fnSend;
+    set<uint32_t>    m_setInterfaces;
+    RateLimiter      m_Limiter;         // per direction "from>to", 50 packets a second, bursts up to 100
+
+    mutex            m_mxDigests;       // guards the two members below
+    unordered_map<uint64_t, chrono::steady_clock::time_point> m_maDigests;
+    deque<pair<chrono::steady_clock::time_point, uint64_t>> m_lstDigests;   // oldest first, to expire them
+
+    atomic<uint64_t> m_nForwarded;
+    atomic<uint64_t> m_nDuplicates;
+    atomic<uint64_t> m_nRateLimited;
+    atomic<uint64_t> m_nAnsweredFromCache;
+};
@@ -0,0 +1,569 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+#include <cctype>
+
+#if defined (_WIN32) || defined (_WIN64)
+#include <WinSock2.h>
+#else
+#include <sys/socket.h>
+#endif
+#include "DnsArena.h"
+#include "Responder.h"
+
+Responder::Responder(ServiceRegistry& Registry, SENDER fnSend, RENAMED fnRenamed, WAKEUP fnWakeUp, bool bThreadSafe) : m_Registry(Registry), m_fnSend(fnSend), m_fnRenamed(fnRenamed), m_fnWakeUp(fnWakeUp)
+    , m_mxResponder(bThreadSafe), m_bStarted(false), m_iProbeStep(0), m_tProbeStep(TIMEPOINT::max()), m_bTieBreakLost(false), m_tReannounce(TIMEPOINT::max()), m_Rng(random_device()())
+    , m_mxMulticast(bThreadSafe), m_bProbed(false), m_nMulticastSuppressed(0)
+{
+}
+
+Responder::~Responder()
+{
+}
+
+void Responder::Start()
+{
+    m_mxResponder.lock();
+    m_bStarted = true;
+    if (m_tProbeStep == TIMEPOINT::max())
+        StartRound(chrono::steady_clock::now());
+    m_mxResponder.unlock();
+
+    if (m_fnWakeUp != nullptr)
+        m_fnWakeUp();
+}
+
+void Responder::Stop()
+{
+    m_mxResponder.lock();
+    const SOCKETLIST vSockets = GetSockets(nullptr, false);
+    const bool bProbed = m_bProbed;
+    m_maSockets.clear();
+    m_setRound.clear();
+    m_setProbePending.clear();
+    m_setProbeNames.insert(begin(m_setRoundNames), end(m_setRoundNames));   // still tentative, probed after the next Start
+    m_setRoundNames.clear();
+    m_bTieBreakLost = false;
+    m_tProbeStep = TIMEPOINT::max();
+    m_vReannounce.clear();
+    m_tReannounce = TIMEPOINT::max();
+    m_bProbed = false;
+    m_bStarted = false;
+    m_mxResponder.unlock();
+
+    m_mxMulticast.lock();
+    m_maLastMulticast.clear();
+    m_mxMulticast.unlock();
+
+    if (bProbed == true)
+        SendAnnouncement(true, vSockets, true, set<string>());   // Goodbye packets, TTL 0 for all our records, one packet per interface
+}
+
+void Responder::AddSocket(SOCKETID nSocket, const SOCKETINFO& Info)
+{
+    // Only the new socket is probed and announced, the others did not change
+    m_mxResponder.lock();
+    m_maSockets[nSocket] = Info;
+    m_setProbePending.insert(nSocket);
+    if (m_tProbeStep == TIMEPOINT::max())
+        StartRound(chrono::steady_clock::now());
+    m_mxResponder.unlock();
+
+    if (m_fnWakeUp != nullptr)
+        m_fnWakeUp();
+}
+
+void Responder::RemoveSocket(SOCKETID nSocket)
+{
+    m_mxResponder.lock();
+    const auto& itSocket = m_maSockets.find(nSocket);
+    if (itSocket == end(m_maSockets))
+    {
+        m_mxResponder.unlock();
+        return;
+    }
+    const SOCKETINFO Info = itSocket->second;
+    m_maSockets.erase(itSocket);
+    m_setRound.erase(nSocket);
+    m_setProbePending.erase(nSocket);
+    const auto& itOther = find_if(begin(m_maSockets), end(m_maSockets), [&](const pair<const SOCKETID, SOCKETINFO>& item) { return get<2>(item.second) == get<2>(Info); });
+    const bool bOther = itOther != end(m_maSockets);
+    const pair<SOCKETID, SOCKETINFO> Other = bOther == true ? make_pair(itOther->first, itOther->second) : pair<SOCKETID, SOCKETINFO>();
+    m_mxResponder.unlock();
+
+    m_mxMulticast.lock();
+    for (auto it = begin(m_maLastMulticast); it != end(m_maLastMulticast);)
+        it = it->first.first == nSocket ? m_maLastMulticast.erase(it) : next(it);
+    m_mxMulticast.unlock();
+
+    // Goodbye for the address record, sent on a socket still alive on the same link
+    if (bOther == true && m_bProbed == true)
+    {
+        vector<ServiceRegistry::RECORD> vRecords;
+        m_Registry.BuildRecords(get<0>(Info), get<1>(Info), vRecords);
+        vector<DnsProtokol::ANSWERITEM> AnList, NsList, ArList;
+        for (auto& Record : vRecords)
+        {
+            if (Record.usType == 1 || Record.usType == 28)
+                AnList.push_back(ServiceRegistry::AsAnswer(Record, true, 0));
+        }
+        if (AnList.empty() == false)
+            SendAnswer(AnList, NsList, ArList, Other.first, Other.second);
+    }
+}
+
+void Responder::ServicesChanged(ServiceRegistry::CHANGES& Changes, const vector<ServiceRegistry::SERVICE>& vServices)
+{
+    const auto tNow = chrono::steady_clock::now();
+    m_mxResponder.lock();
+    if (Changes.vProbe.empty() == false)
+    {
+        for (const auto& Service : vServices)   // the type too, its PTR records are announced along when the probing is done
+        {
+            if (find_if(begin(Changes.vProbe), end(Changes.vProbe), [&Service](const string& strName) { return ServiceRegistry::IsSameName(strName, Service.strInstance + "." + Service.strType); }) == end(Changes.vProbe))
+                continue;
+            m_setProbeNames.insert(ToLower(Service.strInstance + "." + Service.strType));
+            m_setProbeNames.insert(ToLower(Service.strType));
+        }
+        if (m_tProbeStep == TIMEPOINT::max())
+            StartRound(tNow);
+    }
+
+    // RFC 6762 8.4 wants the changes announced twice, the second time from Step one second later
+    const bool bStarted = m_bStarted;
+    const SOCKETLIST vSockets = GetSockets(nullptr, false);
+    if (bStarted == true && Changes.vAnnounce.empty() == false)
+    {
+        m_vReannounce.insert(end(m_vReannounce), begin(Changes.vAnnounce), end(Changes.vAnnounce));
+        m_tReannounce = tNow + chrono::seconds(1);
+    }
+    m_mxResponder.unlock();
+
+    // While probing the round announces everything at its end anyway
+    if (bStarted == true)
+    {
+        for (const auto& item : vSockets)
+        {
+            SendRecords(Changes.vGoodbye, true, item.first, item.second);
+            if (m_bProbed == true)
+                SendRecords(Changes.vAnnounce, false, item.first, item.second);
+        }
+    }
+
+    if (m_fnWakeUp != nullptr)
+        m_fnWakeUp();
+}
+
+void Responder::HandlePacket(DnsProtokol& dnsProto, const unsigned char* pBuffer, size_t nRead, SOCKETID nSocket, const SOCKETINFO& Info, const string& strFrom, bool bOwnPacket)
+{
+    // Step renames with m_mxResponder held and waits for the snapshots to be let go, we must not wait for the lock while we hold one
+    const bool bAnswer = dnsProto.m_DnsHeader.QR == 0 && (bOwnPacket == false || dnsProto.m_DnsHeader.NSCOUNT == 0);    // our own probes are not answered
+    const vector<unsigned short> vHostTypes = bAnswer == true ? GetAddressTypes(get<2>(Info)) : vector<unsigned short>();
+    vector<string> vConflicts;
+    bool bTieBreakLost = false;
+    {
+        // All records of the packet from one snapshot, a change of the services meanwhile does not mix in
+        const auto pSnapshot = m_Registry.GetSnapshot();
+        vector<ServiceRegistry::RECORD> vRecords;
+        ServiceRegistry::BuildRecords(*pSnapshot, get<0>(Info), get<1>(Info), vRecords);
+
+        // Our own multicasts come back to us, they are no conflict
+        if (bOwnPacket == false)
+            bTieBreakLost = ServiceRegistry::FindConflicts(dnsProto, pBuffer, nRead, vRecords, m_bProbed == false, vConflicts);
+
+        vRecords.erase(remove_if(begin(vRecords), end(vRecords), [](const ServiceRegistry::RECORD& Record) { return Record.bTentative == true; }), end(vRecords));  // still probed, not ours yet
+        if (bAnswer == true)
+        {
+            ServiceRegistry::AddNsecRecords(*pSnapshot, vRecords, vHostTypes);
+            AnswerQuestions(dnsProto, vRecords, nSocket, Info, strFrom);
+        }
+    }
+
+    if (bTieBreakLost == true || vConflicts.empty() == false)
+    {
+        m_mxResponder.lock();
+        if (bTieBreakLost == true)
+            m_bTieBreakLost = true;
+        for (const auto& strName : vConflicts)
+            ReportConflict(strName);
+        m_mxResponder.unlock();
+
+        if (m_fnWakeUp != nullptr)
+            m_fnWakeUp();
+    }
+}
+
+void Responder::SendQuestion(const string& strName, unsigned short usType)
+{
+    m_mxResponder.lock();
+    const SOCKETLIST vSockets = GetSockets(nullptr, false);
+    m_mxResponder.unlock();
+
+    vector<DnsProtokol::QUESTIONITEM> QdList = { { { 0, strName }, usType, 1 } };
+    vector<DnsProtokol::ANSWERITEM> AnList, NsList;
+    for (const auto& item : vSockets)
+        SendQuery(QdList, AnList, NsList, item.first, item.second);
+}
+
+Responder::TIMEPOINT Responder::NextStep() const
+{
+    lock_guard<OptionalMutex> lock(m_mxResponder);
+    return min(m_tProbeStep, m_tReannounce);
+}
+
+void Responder::Step(TIMEPOINT tNow)
+{
+    vector<ServiceRegistry::RECORD> vReannounce;
+    vector<pair<string, string>> vRenamed;
+    bool bProbe = false, bAnnounce = false;
+    SOCKETLIST vRound, vOthers;     // the names of the round are probed and announced on the other sockets too
+    set<string> setNames;
+
+    m_mxResponder.lock();
+    if (m_tReannounce <= tNow)
+    {
+        vReannounce.swap(m_vReannounce);
+        m_tReannounce = TIMEPOINT::max();
+    }
+
+    if (m_tProbeStep <= tNow)
+    {
+        if (m_bTieBreakLost == true)    // RFC 6762 8.2, we lost, try again in one second
+        {
+            m_bTieBreakLost = false;
+            m_iProbeStep = 0;
+            m_tProbeStep = tNow + chrono::seconds(1);
+        }
+        else if (m_vConflicts.empty() == false)
+        {
+            for (const auto& strName : m_vConflicts)
+            {
+                const string strNewName = m_Registry.Rename(strName);
+                if (strNewName.empty() == false && m_setRoundNames.erase(ToLower(strName)) > 0)
+                    m_setRoundNames.insert(ToLower(strNewName));
+                if (strNewName.empty() == false && m_setProbeNames.erase(ToLower(strName)) > 0)
+                    m_setProbeNames.insert(ToLower(strNewName));
+                vRenamed.emplace_back(strName, strNewName);
+                m_dqConflictTimes.push_back(tNow);
+            }
+            m_vConflicts.clear();
+            m_bProbed = false;
+            for (const auto& item : m_maSockets)    // the new names have to be probed everywhere
+                m_setRound.insert(item.first);
+            m_setProbePending.clear();
+            m_setRoundNames.insert(begin(m_setProbeNames), end(m_setProbeNames));
+            m_setProbeNames.clear();
+
+            // More than 15 conflicts in 10 seconds, wait 5 seconds before the next probe, RFC 6762 8.1
+            while (m_dqConflictTimes.empty() == false && tNow - m_dqConflictTimes.front() > chrono::seconds(10))
+                m_dqConflictTimes.pop_front();
+            m_iProbeStep = 0;
+            m_tProbeStep = m_dqConflictTimes.size() >= 15 ? tNow + chrono::seconds(5) : tNow + chrono::milliseconds(uniform_int_distribution<int>(0, 250)(m_Rng));
+        }
+        else
+        {
+            if (m_iProbeStep == 0)      // the sockets and names coming during the random delay go along
+            {
+                m_setRound.insert(begin(m_setProbePending), end(m_setProbePending));
+                m_setProbePending.clear();
+                m_setRoundNames.insert(begin(m_setProbeNames), end(m_setProbeNames));
+                m_setProbeNames.clear();
+            }
+            vRound = GetSockets(&m_setRound, false);
+            if (m_setRoundNames.empty() == false)
+                vOthers = GetSockets(&m_setRound, true);
+            setNames = m_setRoundNames;
+
+            if (m_iProbeStep < 3)
+            {
+                bProbe = true;
+                ++m_iProbeStep;
+                m_tProbeStep = tNow + chrono::milliseconds(250);
+            }
+            else
+            {
+                // RFC 6762 8.3, announce twice, one second apart
+                bAnnounce = true;
+                if (m_iProbeStep == 3)
+                {
+                    m_bProbed = true;
+                    m_Registry.SetProbed(vector<string>(begin(m_setRoundNames), end(m_setRoundNames)));
+                }
+                if (++m_iProbeStep < 5)
+                    m_tProbeStep = tNow + chrono::seconds(1);
+                else
+                {
+                    m_setRound.clear();
+                    m_setRoundNames.clear();
+                    m_tProbeStep = TIMEPOINT::max();
+                    StartRound(tNow);   // for the sockets and names that came while the round was running
+                }
+            }
+        }
+    }
+    const SOCKETLIST vSockets = vReannounce.empty() == false ? GetSockets(nullptr, false) : SOCKETLIST();
+    m_mxResponder.unlock();
+
+    for (const auto& item : vRenamed)
+    {
+        if (m_fnRenamed != nullptr)
+            m_fnRenamed(item.first, item.second);
+    }
+
+    // The second announcement of changed records, ServicesChanged sent the first one, RFC 6762 8.4
+    if (m_bProbed == true)
+    {
+        for (const auto& item : vSockets)
+            SendRecords(vReannounce, false, item.first, item.second);
+    }
+
+    if (bProbe == true)
+    {
+        SendProbes(vRound, true, setNames);
+        SendProbes(vOthers, false, setNames);
+    }
+    if (bAnnounce == true)
+    {
+        SendAnnouncement(false, vRound, true, setNames);
+        SendAnnouncement(false, vOthers, false, setNames);
+    }
+}
+
+bool Responder::IsOwnAddress(const string& strFrom) const
+{
+    const string strAddr = SourceAddress(strFrom);
+    lock_guard<OptionalMutex> lock(m_mxResponder);
+    return any_of(begin(m_maSockets), end(m_maSockets), [&strAddr](const pair<const SOCKETID, SOCKETINFO>& item) { return get<1>(item.second).substr(0, get<1>(item.second).find('%')) == strAddr; });
+}
+
+void Responder::GetLocalRecords(vector<ServiceRegistry::RECORD>& vRecords) const
+{
+    m_mxResponder.lock();
+    const SOCKETLIST vSockets = GetSockets(nullptr, false);
+    m_mxResponder.unlock();
+
+    bool bFirst = true;
+    for (const auto& item : vSockets)
+    {
+        vector<ServiceRegistry::RECORD> vInterface;
+        m_Registry.BuildRecords(get<0>(item.second), get<1>(item.second), vInterface);
+        for (auto& Record : vInterface)
+        {
+            if ((Record.bUnique == true && m_bProbed == false) || Record.bTentative == true)   // not ours until the probing is done
+                continue;
+            if (bFirst == true || Record.usType == 1 || Record.usType == 28)
+                vRecords.push_back(move(Record));
+        }
+        bFirst = false;
+    }
+}
+
+uint64_t Responder::GetMulticastSuppressed() const
+{
+    return m_nMulticastSuppressed;
+}
+
+string Responder::SourceAddress(const string& strFrom)
+{
+    const string strAddr = strFrom.empty() == false && strFrom[0] == '[' ? strFrom.substr(1, strFrom.find(']') - 1) : strFrom.substr(0, strFrom.rfind(':'));
+    return strAddr.substr(0, strAddr.find('%'));
+}
+
+void Responder::StartRound(TIMEPOINT tNow)
+{
+    // RFC 6762 8.1, three probes 250 ms apart, the first one after a random delay of 0-250 ms. Without a socket there
+    // is nowhere to probe, AddSocket starts the round then
+    if (m_bStarted == false || m_maSockets.empty() == true || (m_setProbePending.empty() == true && m_setProbeNames.empty() == true))
+        return;
+    m_iProbeStep = 0;
+    m_tProbeStep = tNow + chrono::milliseconds(uniform_int_distribution<int>(0, 250)(m_Rng));
+}
+
+void Responder::ReportConflict(const string& strName)
+{
+    if (find(begin(m_vConflicts), end(m_vConflicts), strName) == end(m_vConflicts))
+        m_vConflicts.push_back(strName);
+    m_bProbed = false;      // RFC 6762 9, back to probing, the unique records are not given out until then
+    if (m_tProbeStep == TIMEPOINT::max() && m_bStarted == true)
+        m_tProbeStep = chrono::steady_clock::now();     // the next Step renames and starts the round
+}
+
+Responder::SOCKETLIST Responder::GetSockets(const set<SOCKETID>* pFilter, bool bExclude) const
+{
+    SOCKETLIST vSockets;
+    for (const auto& item : m_maSockets)
+    {
+        if (pFilter == nullptr || (pFilter->find(item.first) != pFilter->end()) != bExclude)
+            vSockets.emplace_back(item.first, item.second);
+    }
+    return vSockets;
+}
+
+vector<unsigned short> Responder::GetAddressTypes(uint32_t nInterface) const
+{
+    vector<unsigned short> vTypes;
+    lock_guard<OptionalMutex> lock(m_mxResponder);
+    for (const auto& item : m_maSockets)
+    {
+        const unsigned short usType = get<0>(item.second) == AF_INET ? 1 : 28;
+        if (get<2>(item.second) == nInterface && find(begin(vTypes), end(vTypes), usType) == end(vTypes))
+            vTypes.push_back(usType);
+    }
+    return vTypes;
+}
+
+void Responder::AnswerQuestions(DnsProtokol& dnsProto, vector<ServiceRegistry::RECORD>& vRecords, SOCKETID nSocket, const SOCKETINFO& Info, const string& strFrom)
+{
+    // Queries not sent from port 5353 come from simple resolvers, they get a conventional unicast DNS answer, RFC 6762 6.7
+    const bool bLegacy = strFrom.substr(strFrom.rfind(':') + 1) != "5353";
+
+    ServiceRegistry::ANSWERS Answers;
+    ServiceRegistry::PrepareAnswers(dnsProto, vRecords, m_bProbed, bLegacy,
+        [&](const ServiceRegistry::RECORD& Record, chrono::steady_clock::duration tInterval) { return MulticastWithin(Record, nSocket, tInterval); },
+        [&](const ServiceRegistry::RECORD& Record, chrono::steady_clock::duration tInterval) { return ClaimMulticast(Record, nSocket, tInterval); }, Answers);
+    m_nMulticastSuppressed += Answers.nSuppressed;
+
+    vector<DnsProtokol::ANSWERITEM> NsList;
+    if (Answers.AnList.empty() == false)
+        SendAnswer(Answers.AnList, NsList, Answers.ArList, nSocket, Info);
+    if (Answers.UnAnList.empty() == false)
+        SendUnicastAnswer(Answers.nId, Answers.QdList, Answers.UnAnList, NsList, Answers.UnArList, nSocket, Info, strFrom);
+}
+
+void Responder::SendProbes(const SOCKETLIST& vSockets, bool bAll, const set<string>& setNames)
+{
+    // All our unique records (see IsSelected) in one query per interface, the questions ask for ANY with the QU bit set,
+    // the proposed records go in the authority section, RFC 6762 8.1 and 8.2
+    for (const auto& item : vSockets)
+    {
+        vector<ServiceRegistry::RECORD> vRecords;
+        m_Registry.BuildRecords(get<0>(item.second), get<1>(item.second), vRecords);
+
+        vector<DnsProtokol::QUESTIONITEM> QdList;
+        vector<DnsProtokol::ANSWERITEM> AnList, NsList;
+        for (auto& Record : vRecords)
+        {
+            if (Record.bUnique == false || IsSelected(Record, bAll, setNames) == false)
+                continue;
+            if (find_if(begin(QdList), end(QdList), [&Record](const DnsProtokol::QUESTIONITEM& Question) { return ServiceRegistry::IsSameName(Question.strLabel.second, Record.strName); }) == end(QdList))
+                QdList.push_back({ { 0, Record.strName }, 255, 0x8001 });
+            NsList.push_back(ServiceRegistry::AsAnswer(Record, false, Record.iTtl));
+        }
+
+        if (QdList.empty() == false)
+            SendQuery(QdList, AnList, NsList, item.first, item.second);
+    }
+}
+
+void Responder::SendAnnouncement(bool bGoodbye, const SOCKETLIST& vSockets, bool bAll, const set<string>& setNames)
+{
+    for (const auto& item : vSockets)
+    {
+        vector<ServiceRegistry::RECORD> vRecords;
+        m_Registry.BuildRecords(get<0>(item.second), get<1>(item.second), vRecords);
+        vRecords.erase(remove_if(begin(vRecords), end(vRecords), [&](const ServiceRegistry::RECORD& Record) { return IsSelected(Record, bAll, setNames) == false; }), end(vRecords));
+        SendRecords(vRecords, bGoodbye, item.first, item.second);
+    }
+}
+
+void Responder::SendRecords(vector<ServiceRegistry::RECORD>& vRecords, bool bGoodbye, SOCKETID nSocket, const SOCKETINFO& Info)
+{
+    vector<DnsProtokol::ANSWERITEM> AnList, NsList, ArList;
+    for (auto& Record : vRecords)
+        AnList.push_back(ServiceRegistry::AsAnswer(Record, true, bGoodbye == true ? 0 : Record.iTtl));
+
+    if (AnList.empty() == false)
+        SendAnswer(AnList, NsList, ArList, nSocket, Info);
+}
+
+void Responder::SendQuery(vector<DnsProtokol::QUESTIONITEM>& QdList, vector<DnsProtokol::ANSWERITEM>& AnList, vector<DnsProtokol::ANSWERITEM>& NsList, SOCKETID nSocket, const SOCKETINFO& Info)
+{
+    DnsArena::Scope ArenaScope;
+    DnsProtokol dnsProto;
+    size_t nBufLen = 0;
+    if (dnsProto.BuildQuery(QdList, AnList, NsList, nullptr, nBufLen) != 0)
+        return;
+
+    auto pBuffer = MakeArenaArray<char>(nBufLen);
+    const size_t nSendSize = dnsProto.BuildQuery(QdList, AnList, NsList, &pBuffer[0], nBufLen);
+    m_fnSend(nSocket, Info, &pBuffer[0], nSendSize, string());
+}
+
+void Responder::SendAnswer(vector<DnsProtokol::ANSWERITEM>& AnList, vector<DnsProtokol::ANSWERITEM>& NsList, vector<DnsProtokol::ANSWERITEM>& ArList, SOCKETID nSocket, const SOCKETINFO& Info)
+{
+    DnsArena::Scope ArenaScope;
+    DnsProtokol dnsProto;
+    size_t nBufLen = 0;
+    if (dnsProto.BuildAnswer(AnList, NsList, ArList, nullptr, nBufLen) != 0)
+        return;
+
+    auto pBuffer = MakeArenaArray<char>(nBufLen);
+    const size_t nSendSize = dnsProto.BuildAnswer(AnList, NsList, ArList, &pBuffer[0], nBufLen);
+    m_fnSend(nSocket, Info, &pBuffer[0], nSendSize, string());
+
+    const auto tNow = chrono::steady_clock::now();
+    lock_guard<OptionalMutex> lock(m_mxMulticast);
+    for (const auto& item : AnList)
+        m_maLastMulticast[make_pair(nSocket, MulticastKey(item.strLabel.second, item.usType))] = tNow;
+    for (const auto& item : ArList)
+        m_maLastMulticast[make_pair(nSocket, MulticastKey(item.strLabel.second, item.usType))] = tNow;
+}
+
+void Responder::SendUnicastAnswer(unsigned short nId, vector<DnsProtokol::QUESTIONITEM>& QdList, vector<DnsProtokol::ANSWERITEM>& AnList, vector<DnsProtokol::ANSWERITEM>& NsList, vector<DnsProtokol::ANSWERITEM>& ArList, SOCKETID nSocket, const SOCKETINFO& Info, const string& strTo)
+{
+    DnsArena::Scope ArenaScope;
+    DnsProtokol dnsProto;
+    size_t nBufLen = 0;
+    if (dnsProto.BuildAnswer(nId, QdList, AnList, NsList, ArList, nullptr, nBufLen) != 0)
+        return;
+
+    auto pBuffer = MakeArenaArray<char>(nBufLen);
+    const size_t nSendSize = dnsProto.BuildAnswer(nId, QdList, AnList, NsList, ArList, &pBuffer[0], nBufLen);
+    m_fnSend(nSocket, Info, &pBuffer[0], nSendSize, strTo);
+}
+
+bool Responder::MulticastWithin(const ServiceRegistry::RECORD& Record, SOCKETID nSocket, chrono::steady_clock::duration tInterval)
+{
+    lock_guard<OptionalMutex> lock(m_mxMulticast);
+    const auto& itLast = m_maLastMulticast.find(make_pair(nSocket, MulticastKey(Record.strName, Record.usType)));
+    return itLast != end(m_maLastMulticast) && chrono::steady_clock::now() - itLast->second < tInterval;
+}
+
+bool Responder::ClaimMulticast(const ServiceRegistry::RECORD& Record, SOCKETID nSocket, chrono::steady_clock::duration tMinInterval)
+{
+    const auto tNow = chrono::steady_clock::now();
+    lock_guard<OptionalMutex> lock(m_mxMulticast);
+    const auto& itLast = m_maLastMulticast.emplace(make_pair(nSocket, MulticastKey(Record.strName, Record.usType)), TIMEPOINT());
+    if (itLast.second == false && tNow - itLast.first->second < tMinInterval)
+        return false;
+    itLast.first->second = tNow;
+    return true;
+}
+
+bool Responder::IsSelected(const ServiceRegistry::RECORD& Record, bool bAll, const set<string>& setNames)
+{
+    if (bAll == true && Record.bTentative == false)
+        return true;
+    return setNames.find(ToLower(Record.strName)) != end(setNames) || (Record.usType == 12 && setNames.find(ToLower(Record.PtrData.second)) != end(setNames));
+}
+
+string Responder::MulticastKey(const string& strName, unsigned short usType)
+{
+    return ToLower(strName) + '/' + to_string(usType);
+}
+
+string Responder::ToLower(string strName)
+{
+    transform(begin(strName), end(strName), begin(strName), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+    return strName;
+}
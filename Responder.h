@@ -0,0 +1,140 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <tuple>
+#include <random>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+
+#include "DnsProtokol.h"
+#include "ServiceRegistry.h"
+#include "OptionalMutex.h"
+
+using namespace std;
+
+// The responder of mDnsServer and EmbeddedServer: probing and announcing our records, RFC 6762 8, finding
+// conflicts in the packets received, answering the queries and the goodbyes. The front end owns the sockets
+// and reads the packets, the responder knows the sockets by an id and sends through the SENDER. It has no
+// thread and no timer, the front end calls Step when NextStep has come, mDnsServer from a thread waiting for
+// it and EmbeddedServer from Process. Made with bThreadSafe every member may be called from any thread and
+// the callbacks are called without a lock held, else all members must be called from the same thread.
+class Responder
+{
+public:
+    typedef uintptr_t SOCKETID;
+    typedef tuple<int, string, uint32_t> SOCKETINFO;    // address family, address, interface index
+    typedef chrono::steady_clock::time_point TIMEPOINT;
+
+    // Sends the packet on the socket, to the multicast group if strTo is empty. Info is what the responder knows of the
+    // socket, a front end reusing the id for another socket meanwhile drops the packet if that one is different
+    typedef function<void(SOCKETID nSocket, const SOCKETINFO& Info, const char* pBuffer, size_t nSize, const string& strTo)> SENDER;
+    // A name of ours was in conflict, strNewName is the one it has now, empty if it could not be renamed
+    typedef function<void(const string& strName, const string& strNewName)> RENAMED;
+    // NextStep may be earlier now, a front end waiting for it has to look again
+    typedef function<void()> WAKEUP;
+
+public:
+    Responder(ServiceRegistry& Registry, SENDER fnSend, RENAMED fnRenamed, WAKEUP fnWakeUp, bool bThreadSafe);
+    virtual ~Responder();
+
+    // The sockets added before are probed from now on
+    void Start();
+    // Goodbye packets for our records, the sockets are forgotten
+    void Stop();
+
+    // The socket is probed and announced on in the next round
+    void AddSocket(SOCKETID nSocket, const SOCKETINFO& Info);
+    // The goodbye for its address record goes out on another socket of the same link
+    void RemoveSocket(SOCKETID nSocket);
+    // After ServiceRegistry::SetServices. The new instances are probed on all sockets, the records gone get a
+    // goodbye, the changed ones two announcements a second apart, RFC 6762 8.4
+    void ServicesChanged(ServiceRegistry::CHANGES& Changes, const vector<ServiceRegistry::SERVICE>& vServices);
+
+    // A packet decoded without error, received on the socket. bOwnPacket if one of our addresses sent it
+    void HandlePacket(DnsProtokol& dnsProto, const unsigned char* pBuffer, size_t nRead, SOCKETID nSocket, const SOCKETINFO& Info, const string& strFrom, bool bOwnPacket);
+    void SendQuestion(const string& strName, unsigned short usType);
+
+    TIMEPOINT NextStep() const;         // TIMEPOINT::max() if there is nothing to do
+    void Step(TIMEPOINT tNow);
+
+    bool IsOwnAddress(const string& strFrom) const;
+    // Our records on all sockets, the ones not socket specific only once
+    void GetLocalRecords(vector<ServiceRegistry::RECORD>& vRecords) const;
+    uint64_t GetMulticastSuppressed() const;
+
+    // "192.168.1.2:5353" or "[fe80::1%4]:5353" to the address alone
+    static string SourceAddress(const string& strFrom);
+
+private:
+    typedef vector<pair<SOCKETID, SOCKETINFO>> SOCKETLIST;
+
+    // Called with m_mxResponder held
+    void StartRound(TIMEPOINT tNow);
+    void ReportConflict(const string& strName);
+    // The sockets in pFilter, or the ones not in it with bExclude, all if pFilter is nullptr
+    SOCKETLIST GetSockets(const set<SOCKETID>* pFilter, bool bExclude) const;
+    // The address record types we have on an interface, one per address family with a socket there
+    vector<unsigned short> GetAddressTypes(uint32_t nInterface) const;
+
+    void AnswerQuestions(DnsProtokol& dnsProto, vector<ServiceRegistry::RECORD>& vRecords, SOCKETID nSocket, const SOCKETINFO& Info, const string& strFrom);
+    void SendProbes(const SOCKETLIST& vSockets, bool bAll, const set<string>& setNames);
+    void SendAnnouncement(bool bGoodbye, const SOCKETLIST& vSockets, bool bAll, const set<string>& setNames);
+    void SendRecords(vector<ServiceRegistry::RECORD>& vRecords, bool bGoodbye, SOCKETID nSocket, const SOCKETINFO& Info);
+    void SendQuery(vector<DnsProtokol::QUESTIONITEM>& QdList, vector<DnsProtokol::ANSWERITEM>& AnList, vector<DnsProtokol::ANSWERITEM>& NsList, SOCKETID nSocket, const SOCKETINFO& Info);
+    void SendAnswer(vector<DnsProtokol::ANSWERITEM>& AnList, vector<DnsProtokol::ANSWERITEM>& NsList, vector<DnsProtokol::ANSWERITEM>& ArList, SOCKETID nSocket, const SOCKETINFO& Info);
+    void SendUnicastAnswer(unsigned short nId, vector<DnsProtokol::QUESTIONITEM>& QdList, vector<DnsProtokol::ANSWERITEM>& AnList, vector<DnsProtokol::ANSWERITEM>& NsList, vector<DnsProtokol::ANSWERITEM>& ArList, SOCKETID nSocket, const SOCKETINFO& Info, const string& strTo);
+    bool MulticastWithin(const ServiceRegistry::RECORD& Record, SOCKETID nSocket, chrono::steady_clock::duration tInterval);
+    // Checks and books the next multicast of the record in one step, two threads answering at the same time can not both send it
+    bool ClaimMulticast(const ServiceRegistry::RECORD& Record, SOCKETID nSocket, chrono::steady_clock::duration tMinInterval);
+
+    // bAll takes the records that are not tentative, setNames (lower case) the ones of these names and the PTR records pointing to them
+    static bool IsSelected(const ServiceRegistry::RECORD& Record, bool bAll, const set<string>& setNames);
+    static string MulticastKey(const string& strName, unsigned short usType);
+    static string ToLower(string strName);
+
+private:
+    ServiceRegistry&     m_Registry;
+    SENDER               m_fnSend;
+    RENAMED              m_fnRenamed;
+    WAKEUP               m_fnWakeUp;
+
+    mutable OptionalMutex m_mxResponder;    // guards the members below up to m_mxMulticast, never held while calling a callback
+    map<SOCKETID, SOCKETINFO> m_maSockets;
+    bool                 m_bStarted;
+    set<SOCKETID>        m_setRound;        // the sockets of the round running, all our records are probed on them
+    set<SOCKETID>        m_setProbePending; // the sockets waiting for the next round
+    set<string>          m_setRoundNames;   // new service instances and their types (lower case), the round probes them on all sockets
+    set<string>          m_setProbeNames;   // the ones waiting for the next round
+    int                  m_iProbeStep;      // 0 to 2 probes, 3 and 4 announcements
+    TIMEPOINT            m_tProbeStep;      // max() if no round is running
+    bool                 m_bTieBreakLost;
+    vector<string>       m_vConflicts;
+    deque<TIMEPOINT>     m_dqConflictTimes;
+    vector<ServiceRegistry::RECORD> m_vReannounce;  // changed records waiting for their second announcement at m_tReannounce
+    TIMEPOINT            m_tReannounce;     // max() if none waits
+    mt19937              m_Rng;
+
+    OptionalMutex        m_mxMulticast;     // guards m_maLastMulticast
+    map<pair<SOCKETID, string>, TIMEPOINT> m_maLastMulticast;   // (socket, "name/type") -> last sent by multicast
+
+    atomic<bool>         m_bProbed;         // probing done, we answer for our unique records
+    atomic<uint64_t>     m_nMulticastSuppressed;
+};
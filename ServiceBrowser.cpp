@@ -0,0 +1,344 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+#include <cctype>
+
+#if defined (_WIN32) || defined (_WIN64)
+#include <WinSock2.h>
+#include <Ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#endif
+#include "DnsProtokol.h"
+#include "ServiceRegistry.h"
+#include "ServiceBrowser.h"
+
+ServiceBrowser::ServiceBrowser(RecordCache& Cache, QUERYSENDER fnSendQuery) : m_Cache(Cache), m_fnSendQuery(fnSendQuery), m_bStop(true), m_nNextId(1), m_nCallbackId(0)
+{
+}
+
+ServiceBrowser::~ServiceBrowser()
+{
+    Stop();
+}
+
+void ServiceBrowser::Start()
+{
+    m_bStop = false;
+    m_nCallbackId = m_Cache.AddChangeCallback([this](const RecordCache::ENTRY& Entry, bool bAdded) { RecordChanged(Entry, bAdded); });
+    m_thWorker = thread(&ServiceBrowser::Worker, this);
+}
+
+void ServiceBrowser::Stop()
+{
+    m_mxBrowser.lock();
+    m_bStop = true;
+    m_cvBrowser.notify_all();
+    m_mxBrowser.unlock();
+
+    if (m_thWorker.joinable() == true)
+        m_thWorker.join();
+    if (m_nCallbackId != 0)
+        m_Cache.RemoveChangeCallback(m_nCallbackId);
+    m_nCallbackId = 0;
+
+    lock_guard<mutex> lock(m_mxBrowser);
+    m_maLookups.clear();
+    m_maQueries.clear();
+}
+
+ServiceBrowser::LOOKUPID ServiceBrowser::Browse(const string& strType, BROWSECALLBACK fnCallback)
+{
+    PENDING Pending;
+    LOOKUPID nId;
+    {
+        lock_guard<mutex> lock(m_mxBrowser);
+        nId = m_nNextId++;
+        LOOKUP& Lookup = m_maLookups[nId];
+        Lookup.strName = strType;
+        Lookup.fnBrowse = fnCallback;
+        Lookup.tTimeout = chrono::steady_clock::time_point::max();
+        Lookup.bDone = false;
+
+        // What the cache knows already is reported right away
+        for (const auto& Entry : m_Cache.Lookup(strType, 12))
+            CollectChanged(Entry, true, Pending);
+        HoldQuery(Lookup, strType, 12, Pending);
+    }
+    Deliver(Pending);
+    return nId;
+}
+
+ServiceBrowser::LOOKUPID ServiceBrowser::Resolve(const string& strInstance, chrono::milliseconds tTimeout, RESOLVECALLBACK fnCallback)
+{
+    PENDING Pending;
+    LOOKUPID nId;
+    {
+        lock_guard<mutex> lock(m_mxBrowser);
+        nId = m_nNextId++;
+        LOOKUP& Lookup = m_maLookups[nId];
+        Lookup.strName = strInstance;
+        Lookup.fnResolve = fnCallback;
+        Lookup.tTimeout = chrono::steady_clock::now() + tTimeout;
+        Lookup.bDone = false;
+
+        CheckResolve(nId, Pending);
+        m_cvBrowser.notify_all();   // the worker has a new timeout to watch
+    }
+    Deliver(Pending);
+    return nId;
+}
+
+void ServiceBrowser::Cancel(LOOKUPID nId)
+{
+    unique_lock<mutex> lock(m_mxBrowser);
+    const auto& itLookup = m_maLookups.find(nId);
+    if (itLookup != end(m_maLookups))
+    {
+        ReleaseQueries(itLookup->second);
+        m_maLookups.erase(itLookup);
+    }
+
+    // A callback of the lookup may have started before, it runs without the lock. One canceling its own lookup is not waited for
+    const thread::id idSelf = this_thread::get_id();
+    m_cvBrowser.wait(lock, [&]()
+    {
+        const auto& itRange = m_mmRunning.equal_range(nId);
+        return all_of(itRange.first, itRange.second, [&](const pair<const LOOKUPID, thread::id>& item) { return item.second == idSelf; });
+    });
+}
+
+void ServiceBrowser::RecordChanged(const RecordCache::ENTRY& Entry, bool bAdded)
+{
+    PENDING Pending;
+    {
+        lock_guard<mutex> lock(m_mxBrowser);
+        CollectChanged(Entry, bAdded, Pending);
+    }
+    Deliver(Pending);
+}
+
+void ServiceBrowser::CollectChanged(const RecordCache::ENTRY& Entry, bool bAdded, PENDING& Pending)
+{
+    if (Entry.usType == 12)
+    {
+        size_t nOffset = 0;
+        const string strInstance = DnsProtokol::DecodeName(Entry.strRData, nOffset);
+        const string strKey = MakeKey(strInstance, 0).first;
+        if (strInstance.empty() == true)
+            return;
+
+        for (auto& item : m_maLookups)
+        {
+            LOOKUP& Lookup = item.second;
+            if (!Lookup.fnBrowse || MakeKey(Lookup.strName, 0).first != MakeKey(Entry.strName, 0).first)
+                continue;
+
+            // A record can be reported by the cache and by the initial lookup, each instance is reported once
+            if ((bAdded == true && Lookup.setInstances.insert(strKey).second == true)
+                || (bAdded == false && Lookup.setInstances.erase(strKey) > 0))
+                Pending.vCalls.push_back({ item.first, false, bind(Lookup.fnBrowse, strInstance, bAdded) });
+        }
+    }
+    else if (bAdded == true && (Entry.usType == 33 || Entry.usType == 16 || Entry.usType == 1 || Entry.usType == 28))
+    {
+        for (const auto& item : m_maLookups)
+            CheckResolve(item.first, Pending);
+    }
+}
+
+void ServiceBrowser::CheckResolve(LOOKUPID nId, PENDING& Pending)
+{
+    const auto& itLookup = m_maLookups.find(nId);
+    if (itLookup == end(m_maLookups) || !itLookup->second.fnResolve || itLookup->second.bDone == true)
+        return;
+    LOOKUP& Lookup = itLookup->second;
+
+    RESOLVED Result;
+    Result.strInstance = Lookup.strName;
+    Result.nPort = 0;
+
+    const vector<RecordCache::ENTRY> vSrv = m_Cache.Lookup(Lookup.strName, 33);
+    const vector<RecordCache::ENTRY> vTxt = m_Cache.Lookup(Lookup.strName, 16);
+    ServiceRegistry::RECORD Record;
+    if (vSrv.empty() == false && ServiceRegistry::FromCanonicalRData(vSrv.front().strName, 33, vSrv.front().strRData, Record) == true)
+    {
+        Result.nPort = Record.SrvData.Port;
+        Result.strHost = Record.SrvData.strHost.second;
+    }
+    if (vTxt.empty() == false && ServiceRegistry::FromCanonicalRData(vTxt.front().strName, 16, vTxt.front().strRData, Record) == true)
+        Result.vTxt = Record.vTxt;
+    if (Result.strHost.empty() == false)
+    {
+        for (const unsigned short usType : { 1, 28 })
+        {
+            for (const auto& Entry : m_Cache.Lookup(Result.strHost, usType))
+                Result.vAddresses.push_back(AddressToString(Entry.strRData));
+        }
+    }
+
+    // A TXT record the owner said it does not have is not waited for
+    const bool bTxtDone = vTxt.empty() == false || m_Cache.IsNegative(Lookup.strName, 16) == true;
+    if (Result.strHost.empty() == false && bTxtDone == true && Result.vAddresses.empty() == false)
+    {
+        ReleaseQueries(Lookup);
+        Lookup.bDone = true;
+        Lookup.tTimeout = chrono::steady_clock::time_point::max();
+        Pending.vCalls.push_back({ nId, true, bind(Lookup.fnResolve, true, Result) });
+        return;
+    }
+
+    // Ask for what is still missing
+    if (vSrv.empty() == true)
+        HoldQuery(Lookup, Lookup.strName, 33, Pending);
+    if (vTxt.empty() == true)
+        HoldQuery(Lookup, Lookup.strName, 16, Pending);
+    if (Result.strHost.empty() == false)
+    {
+        HoldQuery(Lookup, Result.strHost, 1, Pending);
+        HoldQuery(Lookup, Result.strHost, 28, Pending);
+    }
+}
+
+void ServiceBrowser::HoldQuery(LOOKUP& Lookup, const string& strName, unsigned short usType, PENDING& Pending)
+{
+    const QUERYKEY Key = MakeKey(strName, usType);
+    if (Lookup.setQueries.insert(Key).second == false)
+        return;
+
+    QUERY& Query = m_maQueries[Key];
+    if (Query.nUsers++ > 0)
+        return;     // somebody asks already
+
+    Query.tInterval = chrono::seconds(1);
+    Query.tNext = chrono::steady_clock::now() + Query.tInterval;
+    if (m_Cache.IsNegative(strName, usType) == false)     // the owner told us it has none, asking again is no use
+        Pending.vQueries.emplace_back(strName, usType);
+    m_cvBrowser.notify_all();
+}
+
+void ServiceBrowser::ReleaseQueries(LOOKUP& Lookup)
+{
+    for (const auto& Key : Lookup.setQueries)
+    {
+        const auto& itQuery = m_maQueries.find(Key);
+        if (itQuery != end(m_maQueries) && --itQuery->second.nUsers == 0)
+            m_maQueries.erase(itQuery);
+    }
+    Lookup.setQueries.clear();
+}
+
+void ServiceBrowser::Deliver(PENDING& Pending)
+{
+    for (const auto& Query : Pending.vQueries)
+        m_fnSendQuery(Query.first, Query.second);
+
+    const thread::id idSelf = this_thread::get_id();
+    for (const auto& Call : Pending.vCalls)
+    {
+        {
+            lock_guard<mutex> lock(m_mxBrowser);
+            const auto& itLookup = m_maLookups.find(Call.nId);
+            if (itLookup == end(m_maLookups))
+                continue;   // canceled
+            if (Call.bFinal == true)
+                m_maLookups.erase(itLookup);
+            m_mmRunning.emplace(Call.nId, idSelf);
+        }
+
+        Call.fnCall();
+
+        lock_guard<mutex> lock(m_mxBrowser);
+        const auto& itRange = m_mmRunning.equal_range(Call.nId);
+        m_mmRunning.erase(find_if(itRange.first, itRange.second, [&](const pair<const LOOKUPID, thread::id>& item) { return item.second == idSelf; }));
+        m_cvBrowser.notify_all();
+    }
+}
+
+void ServiceBrowser::Worker()
+{
+    unique_lock<mutex> lock(m_mxBrowser);
+    while (m_bStop == false)
+    {
+        // The cache is checked at least once a second for expired records
+        auto tWakeUp = chrono::steady_clock::now() + chrono::seconds(1);
+        for (const auto& item : m_maQueries)
+            tWakeUp = min(tWakeUp, item.second.tNext);
+        for (const auto& item : m_maLookups)
+            tWakeUp = min(tWakeUp, item.second.tTimeout);
+        m_cvBrowser.wait_until(lock, tWakeUp);
+        if (m_bStop == true)
+            break;
+
+        lock.unlock();
+        m_Cache.Expire();   // calls RecordChanged for the removed records
+        lock.lock();
+
+        // Repeat the queries still wanted, the interval doubles up to one hour, RFC 6762 5.2
+        PENDING Pending;
+        const auto tNow = chrono::steady_clock::now();
+        for (auto& item : m_maQueries)
+        {
+            if (item.second.tNext > tNow)
+                continue;
+            item.second.tInterval = min(item.second.tInterval * 2, chrono::seconds(3600));
+            item.second.tNext = tNow + item.second.tInterval;
+            if (m_Cache.IsNegative(item.first.first, item.first.second) == false)
+                Pending.vQueries.push_back(item.first);
+        }
+
+        for (auto it = begin(m_maLookups); it != end(m_maLookups);)
+        {
+            LOOKUP& Lookup = it->second;
+            if (Lookup.tTimeout > tNow || Lookup.bDone == true)
+            {
+                ++it;
+                continue;
+            }
+            ReleaseQueries(Lookup);
+            if (!Lookup.fnResolve)
+            {
+                it = m_maLookups.erase(it);
+                continue;
+            }
+            RESOLVED Result;
+            Result.strInstance = Lookup.strName;
+            Result.nPort = 0;
+            Lookup.bDone = true;
+            Lookup.tTimeout = chrono::steady_clock::time_point::max();
+            Pending.vCalls.push_back({ it->first, true, bind(Lookup.fnResolve, false, Result) });
+            ++it;
+        }
+
+        lock.unlock();
+        Deliver(Pending);
+        lock.lock();
+    }
+}
+
+ServiceBrowser::QUERYKEY ServiceBrowser::MakeKey(const string& strName, unsigned short usType)
+{
+    QUERYKEY Key(strName, usType);
+    transform(begin(Key.first), end(Key.first), begin(Key.first), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+    return Key;
+}
+
+string ServiceBrowser::AddressToString(const string& strRData)
+{
+    char szAddr[INET6_ADDRSTRLEN] = { 0 };
+    if (strRData.size() == 4)
+        inet_ntop(AF_INET, strRData.data(), szAddr, sizeof(szAddr));
+    else if (strRData.size() == 16)
+        inet_ntop(AF_INET6, strRData.data(), szAddr, sizeof(szAddr));
+    return szAddr;
+}
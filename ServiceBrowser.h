@@ -0,0 +1,127 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+
+#include "RecordCache.h"
+
+using namespace std;
+
+// Asynchronous DNS-SD browse and resolve (RFC 6763) on top of the record cache.
+// Lookups are answered from the cache first, the queries still needed are shared by all lookups
+// asking for the same name and type and repeated with growing intervals, RFC 6762 5.2.
+// The callbacks run on the thread delivering the records, on the browser thread or on the one starting
+// the lookup, never with a lock of the browser held. After Cancel() returns no callback of that lookup
+// runs anymore, unless Cancel is called from it. Callbacks may start and cancel lookups.
+class ServiceBrowser
+{
+public:
+    typedef uint64_t LOOKUPID;
+
+    typedef struct
+    {
+        string strInstance;         // "HTTP2SERV._http._tcp.local"
+        string strHost;             // target of the SRV record
+        unsigned short nPort;
+        vector<string> vTxt;
+        vector<string> vAddresses;  // IPv4 and IPv6 addresses of the host
+    }RESOLVED;
+
+    typedef function<void(const string& strInstance, bool bAdded)> BROWSECALLBACK;
+    typedef function<void(bool bResolved, const RESOLVED& Result)> RESOLVECALLBACK;     // bResolved is false after the timeout
+    typedef function<void(const string& strName, unsigned short usType)> QUERYSENDER;   // multicasts one question on all interfaces
+
+public:
+    ServiceBrowser(RecordCache& Cache, QUERYSENDER fnSendQuery);
+    virtual ~ServiceBrowser();
+
+    void Start();
+    void Stop();
+
+    // Reports every instance of the service type as it comes and goes until it is canceled
+    LOOKUPID Browse(const string& strType, BROWSECALLBACK fnCallback);
+    // Reports once, if SRV, TXT and at least one address of the instance are known or the timeout is reached
+    LOOKUPID Resolve(const string& strInstance, chrono::milliseconds tTimeout, RESOLVECALLBACK fnCallback);
+    void Cancel(LOOKUPID nId);
+
+private:
+    typedef pair<string, unsigned short> QUERYKEY;  // lower case name, type
+
+    typedef struct
+    {
+        int nUsers;
+        chrono::seconds tInterval;
+        chrono::steady_clock::time_point tNext;
+    }QUERY;
+
+    typedef struct
+    {
+        LOOKUPID nId;
+        bool bFinal;                // a resolve reports once, the lookup goes when the call is made
+        function<void()> fnCall;
+    }CALL;
+
+    // What was decided with m_mxBrowser held and is done after it is released, see Deliver
+    typedef struct
+    {
+        vector<CALL> vCalls;
+        vector<pair<string, unsigned short>> vQueries;
+    }PENDING;
+
+    typedef struct
+    {
+        string strName;             // the service type for a browse, the instance for a resolve
+        BROWSECALLBACK fnBrowse;
+        RESOLVECALLBACK fnResolve;
+        chrono::steady_clock::time_point tTimeout;
+        set<QUERYKEY> setQueries;   // the shared queries this lookup holds
+        set<string> setInstances;   // browse, the instances reported as added (lower case)
+        bool bDone;                 // resolve, the result is reported, the lookup waits for its call
+    }LOOKUP;
+
+private:
+    void RecordChanged(const RecordCache::ENTRY& Entry, bool bAdded);
+    // Called with m_mxBrowser held
+    void CollectChanged(const RecordCache::ENTRY& Entry, bool bAdded, PENDING& Pending);
+    void CheckResolve(LOOKUPID nId, PENDING& Pending);
+    void HoldQuery(LOOKUP& Lookup, const string& strName, unsigned short usType, PENDING& Pending);
+    void ReleaseQueries(LOOKUP& Lookup);
+    // Called without m_mxBrowser held. A call of a lookup canceled meanwhile is not made
+    void Deliver(PENDING& Pending);
+    void Worker();
+
+    static QUERYKEY MakeKey(const string& strName, unsigned short usType);
+    static string AddressToString(const string& strRData);
+
+private:
+    RecordCache&               m_Cache;
+    QUERYSENDER                m_fnSendQuery;
+    mutex                      m_mxBrowser;     // guards everything below, never held while a callback or m_fnSendQuery runs
+    condition_variable         m_cvBrowser;
+    thread                     m_thWorker;
+    bool                       m_bStop;
+    LOOKUPID                   m_nNextId;
+    size_t                     m_nCallbackId;   // of our cache change callback
+    map<LOOKUPID, LOOKUP>      m_maLookups;
+    map<QUERYKEY, QUERY>       m_maQueries;
+    multimap<LOOKUPID, thread::id> m_mmRunning; // the callbacks running, Cancel waits for them
+};
@@ -0,0 +1,195 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+
+#include "ServiceConfig.h"
+
+ServiceConfig::ServiceConfig() : m_tInterval(1000), m_bStop(true)
+{
+}
+
+ServiceConfig::~ServiceConfig()
+{
+    Stop();
+}
+
+bool ServiceConfig::Load(const string& strFile, vector<ServiceRegistry::SERVICE>& vServices, string& strError)
+{
+    string strText;
+    if (ReadFile(strFile, strText) == false)
+    {
+        strError = strFile + ": can not be read";
+        return false;
+    }
+    if (Parse(strText, vServices, strError) == false)
+    {
+        strError = strFile + ":" + strError;
+        return false;
+    }
+    return true;
+}
+
+bool ServiceConfig::Parse(const string& strText, vector<ServiceRegistry::SERVICE>& vServices, string& strError)
+{
+    vector<ServiceRegistry::SERVICE> vParsed;
+    stringstream ssText(strText);
+    int nLine = 0;
+    for (string strLine; getline(ssText, strLine);)
+    {
+        ++nLine;
+        vector<string> vTokens;
+        if (SplitLine(strLine, vTokens) == false)
+        {
+            strError = to_string(nLine) + ": quote not closed";
+            return false;
+        }
+        if (vTokens.empty() == true)
+            continue;
+        if (vTokens[0] != "service" || vTokens.size() < 4)
+        {
+            strError = to_string(nLine) + ": expected service <instance> <type> <port> [<txt> ...]";
+            return false;
+        }
+
+        ServiceRegistry::SERVICE Service;
+        Service.strInstance = vTokens[1];
+        Service.strType = vTokens[2];
+        if (Service.strType.size() < 6 || ServiceRegistry::IsSameName(Service.strType.substr(Service.strType.size() - 6), string(".local")) == false)
+            Service.strType += ".local";
+        const string& strPort = vTokens[3];
+        const unsigned long nPort = strPort.find_first_not_of("0123456789") == string::npos && strPort.size() <= 5 ? stoul(strPort) : 65536;
+        Service.nPort = static_cast<unsigned short>(nPort);
+        Service.vTxt.assign(begin(vTokens) + 4, end(vTokens));
+
+        // Labels have at most 63 bytes, TXT strings 255, RFC 1035 2.3.4 and RFC 6763 6.1
+        if (Service.strInstance.empty() == true || Service.strInstance.size() > 63)
+            strError = to_string(nLine) + ": the instance name must have 1 to 63 bytes";
+        else if (Service.strType.compare(0, 1, "_") != 0 || (Service.strType.find("._tcp.") == string::npos && Service.strType.find("._udp.") == string::npos))
+            strError = to_string(nLine) + ": the type must look like _http._tcp";
+        else if (nPort > 65535)
+            strError = to_string(nLine) + ": invalid port " + strPort;
+        else if (any_of(begin(Service.vTxt), end(Service.vTxt), [](const string& strTxt) { return strTxt.size() > 255; }))
+            strError = to_string(nLine) + ": a TXT string has more than 255 bytes";
+        else if (any_of(begin(vParsed), end(vParsed), [&Service](const ServiceRegistry::SERVICE& item) { return ServiceRegistry::IsSameName(item.strInstance, Service.strInstance) == true && ServiceRegistry::IsSameName(item.strType, Service.strType) == true; }))
+            strError = to_string(nLine) + ": " + Service.strInstance + "." + Service.strType + " is there twice";
+        if (strError.empty() == false)
+            return false;
+        vParsed.push_back(Service);
+    }
+
+    vServices.swap(vParsed);
+    return true;
+}
+
+bool ServiceConfig::Start(const string& strFile, chrono::milliseconds tInterval, RELOADCALLBACK fnReload, ERRORCALLBACK fnError)
+{
+    if (m_thWatcher.joinable() == true || tInterval.count() <= 0)
+        return false;
+
+    m_strFile = strFile;
+    m_tInterval = tInterval;
+    m_fnReload = fnReload;
+    m_fnError = fnError;
+    if (ReadFile(m_strFile, m_strText) == false)
+        m_strText.clear();
+
+    m_bStop = false;
+    m_thWatcher = thread(&ServiceConfig::Watcher, this);
+    return true;
+}
+
+void ServiceConfig::Stop()
+{
+    {
+        lock_guard<mutex> lock(m_mxWatcher);
+        m_bStop = true;
+        m_cvWatcher.notify_all();
+    }
+    if (m_thWatcher.joinable() == true)
+        m_thWatcher.join();
+}
+
+void ServiceConfig::Watcher()
+{
+    bool bReadable = true;
+    unique_lock<mutex> lock(m_mxWatcher);
+    while (m_cvWatcher.wait_for(lock, m_tInterval, [&]() { return m_bStop; }) == false)
+    {
+        lock.unlock();
+
+        string strText;
+        const bool bRead = ReadFile(m_strFile, strText);
+        if (bRead == false && bReadable == true && m_fnError)   // the services stay as they are, an editor may be replacing the file
+            m_fnError(m_strFile + ": can not be read");
+        bReadable = bRead;
+
+        if (bRead == true && strText != m_strText)
+        {
+            m_strText = strText;
+            vector<ServiceRegistry::SERVICE> vServices;
+            string strError;
+            if (Parse(strText, vServices, strError) == true)
+                m_fnReload(vServices);
+            else if (m_fnError)
+                m_fnError(m_strFile + ":" + strError);
+        }
+
+        lock.lock();
+    }
+}
+
+bool ServiceConfig::ReadFile(const string& strFile, string& strText)
+{
+    ifstream fin(strFile, ios::binary);
+    if (fin.is_open() == false)
+        return false;
+    strText.assign(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+    return fin.bad() == false;
+}
+
+bool ServiceConfig::SplitLine(const string& strLine, vector<string>& vTokens)
+{
+    // Separated by blanks, "..." holds blanks, \" and \\ inside stand for the character
+    for (size_t nPos = 0; nPos < strLine.size();)
+    {
+        const char c = strLine[nPos];
+        if (c == ' ' || c == '\t' || c == '\r')
+            ++nPos;
+        else if (c == '#')
+            break;
+        else if (c == '"')
+        {
+            string strToken;
+            for (++nPos; nPos < strLine.size() && strLine[nPos] != '"'; ++nPos)
+            {
+                if (strLine[nPos] == '\\' && nPos + 1 < strLine.size())
+                    ++nPos;
+                strToken += strLine[nPos];
+            }
+            if (nPos == strLine.size())
+                return false;
+            ++nPos;
+            vTokens.push_back(strToken);
+        }
+        else
+        {
+            const size_t nEnd = strLine.find_first_of(" \t\r", nPos);
+            vTokens.push_back(strLine.substr(nPos, nEnd == string::npos ? string::npos : nEnd - nPos));
+            nPos = nEnd == string::npos ? strLine.size() : nEnd;
+        }
+    }
+    return true;
+}
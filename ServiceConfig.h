@@ -0,0 +1,68 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+#include "ServiceRegistry.h"
+
+using namespace std;
+
+// The services to advertise, read from a text file. One service per line, # starts a comment:
+//
+//   service <instance> <type> <port> [<txt> ...]
+//   service "My Server" _http._tcp.local 80 path=/index.html
+//
+// Start() watches the file and reports the services whenever it changed and still parses. The file is
+// looked at every interval, so an editor writing it in several steps is seen once it is done.
+class ServiceConfig
+{
+public:
+    typedef function<void(const vector<ServiceRegistry::SERVICE>& vServices)> RELOADCALLBACK;
+    typedef function<void(const string& strError)> ERRORCALLBACK;
+
+public:
+    ServiceConfig();
+    virtual ~ServiceConfig();
+
+    // Reads the file now, strError tells the line at fault
+    static bool Load(const string& strFile, vector<ServiceRegistry::SERVICE>& vServices, string& strError);
+    static bool Parse(const string& strText, vector<ServiceRegistry::SERVICE>& vServices, string& strError);
+
+    // The file as it is now counts as reported, only later changes call fnReload
+    bool Start(const string& strFile, chrono::milliseconds tInterval, RELOADCALLBACK fnReload, ERRORCALLBACK fnError);
+    void Stop();
+
+private:
+    void Watcher();
+    static bool ReadFile(const string& strFile, string& strText);
+    static bool SplitLine(const string& strLine, vector<string>& vTokens);
+
+private:
+    string               m_strFile;
+    chrono::milliseconds m_tInterval;
+    RELOADCALLBACK       m_fnReload;
+    ERRORCALLBACK        m_fnError;
+    string               m_strText;         // the content seen last, the file is only parsed when it differs
+
+    mutex                m_mxWatcher;
+    condition_variable   m_cvWatcher;
+    thread               m_thWatcher;
+    bool                 m_bStop;
+};
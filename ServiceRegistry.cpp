@@ -0,0 +1,583 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <cstring>
+#include <tuple>
+#include <thread>
+
+#if defined (_WIN32) || defined (_WIN64)
+#include <WinSock2.h>
+#include <Ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#endif
+#include "ServiceRegistry.h"
+
+ServiceRegistry::SnapshotRef::SnapshotRef(const ServiceRegistry& Registry)
+{
+    // Counted before the pointer is loaded, a writer that swapped it before sees us or we get its new snapshot
+    m_pReaders = &Registry.m_nReaders[Registry.m_nEpoch.load() & 1];
+    m_pReaders->fetch_add(1);
+    m_pSnapshot = Registry.m_pSnapshot.load();
+}
+
+ServiceRegistry::SnapshotRef::SnapshotRef(SnapshotRef&& Other) : m_pReaders(Other.m_pReaders), m_pSnapshot(Other.m_pSnapshot)
+{
+    Other.m_pReaders = nullptr;
+}
+
+ServiceRegistry::SnapshotRef::~SnapshotRef()
+{
+    if (m_pReaders != nullptr)
+        m_pReaders->fetch_sub(1);
+}
+
+ServiceRegistry::ServiceRegistry(bool bThreadSafe) : m_mtxRegistry(bThreadSafe), m_pSnapshot(new SNAPSHOT()), m_nEpoch(0)
+{
+    m_nReaders[0] = 0;
+    m_nReaders[1] = 0;
+}
+
+ServiceRegistry::~ServiceRegistry()
+{
+    delete m_pSnapshot.load();
+}
+
+void ServiceRegistry::SetHostName(const string& strHostName)
+{
+    lock_guard<OptionalMutex> lock(m_mtxRegistry);
+    unique_ptr<SNAPSHOT> pSnapshot = make_unique<SNAPSHOT>(*m_pSnapshot);
+    pSnapshot->strHostName = strHostName;
+    Publish(move(pSnapshot));
+}
+
+string ServiceRegistry::GetHostName() const
+{
+    return GetSnapshot()->strHostName;
+}
+
+void ServiceRegistry::AddService(const SERVICE& Service)
+{
+    lock_guard<OptionalMutex> lock(m_mtxRegistry);
+    unique_ptr<SNAPSHOT> pSnapshot = make_unique<SNAPSHOT>(*m_pSnapshot);
+    pSnapshot->vEntries.push_back({ Service, Service.strInstance, false });
+    if (Service.vTxt.empty() == true)
+        pSnapshot->vEntries.back().Service.vTxt.emplace_back();     // a TXT record has at least one (empty) string, RFC 6763 6.1
+    Publish(move(pSnapshot));
+}
+
+ServiceRegistry::CHANGES ServiceRegistry::SetServices(const vector<SERVICE>& vServices)
+{
+    lock_guard<OptionalMutex> lock(m_mtxRegistry);
+    unique_ptr<SNAPSHOT> pSnapshot = make_unique<SNAPSHOT>();
+    pSnapshot->strHostName = m_pSnapshot.load()->strHostName;
+
+    CHANGES Changes;
+    for (const auto& Service : vServices)
+    {
+        // Known by the label it was added with and the type, it keeps its name and whether it is probed
+        const auto itOld = find_if(begin(m_pSnapshot.load()->vEntries), end(m_pSnapshot.load()->vEntries), [&Service](const ENTRY& item) { return IsSameName(item.strConfigured, Service.strInstance) == true && IsSameName(item.Service.strType, Service.strType) == true; });
+        if (itOld != end(m_pSnapshot.load()->vEntries))
+        {
+            pSnapshot->vEntries.push_back({ Service, itOld->strConfigured, itOld->bTentative });
+            pSnapshot->vEntries.back().Service.strInstance = itOld->Service.strInstance;
+        }
+        else
+        {
+            pSnapshot->vEntries.push_back({ Service, Service.strInstance, true });
+            Changes.vProbe.push_back(Service.strInstance + "." + Service.strType);
+        }
+        if (pSnapshot->vEntries.back().Service.vTxt.empty() == true)
+            pSnapshot->vEntries.back().Service.vTxt.emplace_back();
+    }
+
+    // Compared record by record. One we had with other data for a unique name and type we still have is replaced
+    // by the announcement with the cache flush bit, the rest of the ones gone get a goodbye, RFC 6762 10.1 and 10.2
+    vector<RECORD> vOld, vNew;
+    BuildServiceRecords(*m_pSnapshot, vOld);
+    BuildServiceRecords(*pSnapshot, vNew);
+    auto fnContains = [](const vector<RECORD>& vRecords, const RECORD& Record, bool bSameData)
+    {
+        return any_of(begin(vRecords), end(vRecords), [&](const RECORD& item) { return item.usType == Record.usType && IsSameName(item.strName, Record.strName) == true && (bSameData == false || GetCanonicalRData(item) == GetCanonicalRData(Record)); });
+    };
+    for (auto& Record : vOld)
+    {
+        if (fnContains(vNew, Record, true) == false && (Record.bUnique == false || fnContains(vNew, Record, false) == false))
+            Changes.vGoodbye.push_back(move(Record));
+    }
+    for (auto& Record : vNew)
+    {
+        if (Record.bTentative == false && fnContains(vOld, Record, true) == false)
+            Changes.vAnnounce.push_back(move(Record));
+    }
+
+    Publish(move(pSnapshot));
+    return Changes;
+}
+
+void ServiceRegistry::SetProbed(const vector<string>& vNames)
+{
+    lock_guard<OptionalMutex> lock(m_mtxRegistry);
+    unique_ptr<SNAPSHOT> pSnapshot = make_unique<SNAPSHOT>(*m_pSnapshot);
+    for (auto& Entry : pSnapshot->vEntries)
+    {
+        if (any_of(begin(vNames), end(vNames), [&Entry](const string& strName) { return IsSameName(strName, Entry.Service.strInstance + "." + Entry.Service.strType); }) == true)
+            Entry.bTentative = false;
+    }
+    Publish(move(pSnapshot));
+}
+
+vector<string> ServiceRegistry::GetOwnedNames() const
+{
+    const SnapshotRef pSnapshot = GetSnapshot();
+    vector<string> vNames = { "_services._dns-sd._udp.local", pSnapshot->strHostName };
+    for (const auto& Entry : pSnapshot->vEntries)
+    {
+        vNames.push_back(Entry.Service.strType);
+        vNames.push_back(Entry.Service.strInstance + "." + Entry.Service.strType);
+    }
+    return vNames;
+}
+
+ServiceRegistry::SnapshotRef ServiceRegistry::GetSnapshot() const
+{
+    return SnapshotRef(*this);
+}
+
+void ServiceRegistry::BuildRecords(int adrFamily, const string& strIpAddr, vector<RECORD>& vRecords) const
+{
+    BuildRecords(*GetSnapshot(), adrFamily, strIpAddr, vRecords);
+}
+
+void ServiceRegistry::BuildRecords(const SNAPSHOT& Snapshot, int adrFamily, const string& strIpAddr, vector<RECORD>& vRecords)
+{
+    BuildServiceRecords(Snapshot, vRecords);
+
+    auto fnNewRecord = [&vRecords, &Snapshot](unsigned short usType) -> RECORD&
+    {
+        vRecords.emplace_back();
+        vRecords.back().strName = Snapshot.strHostName;
+        vRecords.back().usType = usType;
+        vRecords.back().bUnique = true;
+        vRecords.back().bTentative = false;
+        vRecords.back().iTtl = TTL_HOST;
+        return vRecords.back();
+    };
+
+    if (adrFamily == AF_INET)
+    {
+        RECORD& Record = fnNewRecord(1);
+        if (inet_pton(AF_INET, strIpAddr.c_str(), Record.Addr) != 1)
+            vRecords.pop_back();
+    }
+    else if (adrFamily == AF_INET6)
+    {
+        string strAddr = strIpAddr.substr(0, strIpAddr.find('%')); // without the scope id
+        RECORD& Record = fnNewRecord(28);
+        if (inet_pton(AF_INET6, strAddr.c_str(), Record.Addr) != 1)
+            vRecords.pop_back();
+    }
+}
+
+void ServiceRegistry::AddNsecRecords(vector<RECORD>& vRecords, const vector<unsigned short>& vHostTypes) const
+{
+    AddNsecRecords(*GetSnapshot(), vRecords, vHostTypes);
+}
+
+void ServiceRegistry::AddNsecRecords(const SNAPSHOT& Snapshot, vector<RECORD>& vRecords, const vector<unsigned short>& vHostTypes)
+{
+    const string& strHostName = Snapshot.strHostName;
+    const size_t nRecords = vRecords.size();
+    for (size_t n = 0; n < nRecords; ++n)
+    {
+        if (vRecords[n].bUnique == false || find_if(begin(vRecords), begin(vRecords) + n, [&](const RECORD& item) { return item.bUnique == true && IsSameName(item.strName, vRecords[n].strName); }) != begin(vRecords) + n)
+            continue;
+
+        RECORD Nsec;
+        Nsec.strName = vRecords[n].strName;
+        Nsec.usType = 47;
+        Nsec.bUnique = true;
+        Nsec.bTentative = vRecords[n].bTentative;
+        Nsec.iTtl = vRecords[n].iTtl;
+        Nsec.NsecData.strNextName = { 0, vRecords[n].strName };
+        if (IsSameName(Nsec.strName, strHostName) == true)
+            Nsec.NsecData.vTypes = vHostTypes;
+        for (size_t i = n; i < nRecords; ++i)
+        {
+            if (IsSameName(vRecords[i].strName, Nsec.strName) == false)
+                continue;
+            Nsec.iTtl = min(Nsec.iTtl, vRecords[i].iTtl);   // it must not outlive the records it describes
+            if (find(begin(Nsec.NsecData.vTypes), end(Nsec.NsecData.vTypes), vRecords[i].usType) == end(Nsec.NsecData.vTypes))
+                Nsec.NsecData.vTypes.push_back(vRecords[i].usType);
+        }
+        sort(begin(Nsec.NsecData.vTypes), end(Nsec.NsecData.vTypes));
+        vRecords.push_back(Nsec);
+    }
+}
+
+string ServiceRegistry::Rename(const string& strName)
+{
+    lock_guard<OptionalMutex> lock(m_mtxRegistry);
+    unique_ptr<SNAPSHOT> pSnapshot = make_unique<SNAPSHOT>(*m_pSnapshot);
+
+    // "name" -> "name (2)" -> "name (3)" for instances, "host.local" -> "host-2.local" for the host, RFC 6762 9
+    auto fnNextName = [](const string& strLabel, const char* szOpen, const char* szClose) -> string
+    {
+        const size_t nPos = strLabel.rfind(szOpen);
+        if (nPos != string::npos && strLabel.size() > nPos + strlen(szOpen) + strlen(szClose)
+            && strLabel.compare(strLabel.size() - strlen(szClose), string::npos, szClose) == 0)
+        {
+            const string strNum = strLabel.substr(nPos + strlen(szOpen), strLabel.size() - nPos - strlen(szOpen) - strlen(szClose));
+            if (strNum.find_first_not_of("0123456789") == string::npos)
+                return strLabel.substr(0, nPos) + szOpen + to_string(stoi(strNum) + 1) + szClose;
+        }
+        return strLabel + szOpen + "2" + szClose;
+    };
+
+    string& strHostName = pSnapshot->strHostName;
+    if (IsSameName(strHostName, strName) == true)
+    {
+        const size_t nDot = strHostName.find('.');
+        strHostName = fnNextName(strHostName.substr(0, nDot), "-", "") + (nDot != string::npos ? strHostName.substr(nDot) : string());
+        const string strNewName = strHostName;
+        Publish(move(pSnapshot));
+        return strNewName;
+    }
+
+    for (auto& Entry : pSnapshot->vEntries)
+    {
+        SERVICE& Service = Entry.Service;
+        if (IsSameName(Service.strInstance + "." + Service.strType, strName) == true)
+        {
+            Service.strInstance = fnNextName(Service.strInstance, " (", ")");
+            const string strNewName = Service.strInstance + "." + Service.strType;
+            Publish(move(pSnapshot));
+            return strNewName;
+        }
+    }
+
+    return string();
+}
+
+void ServiceRegistry::PrepareAnswers(DnsProtokol& dnsProto, vector<RECORD>& vRecords, bool bProbed, bool bLegacy, const MULTICASTCHECK& fnMulticastWithin, const MULTICASTCHECK& fnClaimMulticast, ANSWERS& Answers)
+{
+    enum { NONE, UNICAST, MULTICAST };    // a record asked for by multicast and by unicast goes out by multicast
+
+    vector<int> vAnswer(vRecords.size(), NONE), vAdditional(vRecords.size(), NONE);
+    Answers.nId = 0;
+    Answers.nSuppressed = 0;
+
+    for (short n = 0; n < dnsProto.m_DnsHeader.QDCOUNT; ++n)
+    {
+        const auto& Question = dnsProto.m_pQuestions.get()[n];
+        size_t nNsec = vRecords.size();
+        bool bAnswered = false;
+        for (size_t i = 0; i < vRecords.size(); ++i)
+        {
+            if (vRecords[i].bUnique == true && bProbed == false)    // not ours until the probing is done
+                continue;
+            if (vRecords[i].usType == 47 && IsSameName(vRecords[i].strName, Question.LABEL) == true)
+                nNsec = i;
+            if ((Question.QTYPE == vRecords[i].usType || Question.QTYPE == 255) && IsSameName(vRecords[i].strName, Question.LABEL) == true)
+            {
+                // A QU question is answered by unicast, unless the record was not multicast within a quarter of its TTL, RFC 6762 5.4
+                int iDest = MULTICAST;
+                if (bLegacy == true || (Question.QU == true && fnMulticastWithin(vRecords[i], chrono::seconds(vRecords[i].iTtl) / 4) == true))
+                    iDest = UNICAST;
+                vAnswer[i] = max(vAnswer[i], iDest);
+                bAnswered = true;
+            }
+        }
+
+        // A name we own without the type asked for gets a negative answer, the NSEC record lists the types it has, RFC 6762 6.1
+        if (bAnswered == false && nNsec < vRecords.size())
+        {
+            int iDest = MULTICAST;
+            if (bLegacy == true || (Question.QU == true && fnMulticastWithin(vRecords[nNsec], chrono::seconds(vRecords[nNsec].iTtl) / 4) == true))
+                iDest = UNICAST;
+            vAnswer[nNsec] = max(vAnswer[nNsec], iDest);
+        }
+    }
+
+    // A record is multicast at most once a second on an interface, answers to probes may go again after 250 ms, RFC 6762 6
+    const chrono::milliseconds tMinInterval(dnsProto.m_DnsHeader.NSCOUNT > 0 ? 250 : 1000);
+    for (size_t i = 0; i < vRecords.size(); ++i)
+    {
+        if (vAnswer[i] == MULTICAST && fnClaimMulticast(vRecords[i], tMinInterval) == false)
+        {
+            vAnswer[i] = NONE;
+            ++Answers.nSuppressed;
+        }
+    }
+
+    // Additional records, RFC 6763 12. PTR -> SRV and TXT of the instance, SRV -> address records of the host
+    function<void(const string&, int)> fnAddName = [&](const string& strName, int iDest)
+    {
+        for (size_t i = 0; i < vRecords.size(); ++i)
+        {
+            if (vAnswer[i] != NONE || vAdditional[i] >= iDest || IsSameName(vRecords[i].strName, strName) == false)
+                continue;
+            if (vRecords[i].bUnique == true && bProbed == false)
+                continue;
+            vAdditional[i] = iDest;
+            if (vRecords[i].usType == 33)
+                fnAddName(vRecords[i].SrvData.strHost.second, iDest);
+        }
+    };
+    for (size_t i = 0; i < vRecords.size(); ++i)
+    {
+        if (vAnswer[i] != NONE && vRecords[i].usType == 12)
+            fnAddName(vRecords[i].PtrData.second, vAnswer[i]);
+        else if (vAnswer[i] != NONE && vRecords[i].usType == 33)
+            fnAddName(vRecords[i].SrvData.strHost.second, vAnswer[i]);
+    }
+
+    // A name sent with some of its records also tells which types it does not have, the NSEC record goes along, RFC 6762 6.1
+    for (size_t i = 0; i < vRecords.size(); ++i)
+    {
+        if (vRecords[i].usType != 47 || vAnswer[i] != NONE)
+            continue;
+        for (size_t j = 0; j < vRecords.size(); ++j)
+        {
+            if (j != i && IsSameName(vRecords[j].strName, vRecords[i].strName) == true)
+                vAdditional[i] = max(vAdditional[i], max(vAnswer[j], vAdditional[j]));
+        }
+    }
+
+    // Legacy answers have no cache flush bit and a TTL of at most 10 seconds, RFC 6762 6.7
+    auto fnUnicastAnswer = [bLegacy](RECORD& Record)
+    {
+        return bLegacy == true ? AsAnswer(Record, false, min(Record.iTtl, 10)) : AsAnswer(Record, true, Record.iTtl);
+    };
+
+    for (size_t i = 0; i < vRecords.size(); ++i)
+    {
+        if (vAnswer[i] == MULTICAST)
+            Answers.AnList.push_back(AsAnswer(vRecords[i], true, vRecords[i].iTtl));
+        else if (vAnswer[i] == UNICAST)
+            Answers.UnAnList.push_back(fnUnicastAnswer(vRecords[i]));
+        else if (vAdditional[i] == MULTICAST)
+        {
+            if (fnClaimMulticast(vRecords[i], tMinInterval) == true)
+                Answers.ArList.push_back(AsAnswer(vRecords[i], true, vRecords[i].iTtl));
+            else
+                ++Answers.nSuppressed;
+        }
+        else if (vAdditional[i] == UNICAST)
+            Answers.UnArList.push_back(fnUnicastAnswer(vRecords[i]));
+    }
+
+    // The legacy resolver matches the answer by the query ID and the question
+    if (bLegacy == true && Answers.UnAnList.empty() == false)
+    {
+        Answers.nId = dnsProto.m_DnsHeader.ID;
+        for (short n = 0; n < dnsProto.m_DnsHeader.QDCOUNT; ++n)
+        {
+            const auto& Question = dnsProto.m_pQuestions.get()[n];
+            Answers.QdList.push_back({ { 0, Question.LABEL.c_str() }, Question.QTYPE, Question.QCLASS });
+        }
+    }
+}
+
+bool ServiceRegistry::FindConflicts(DnsProtokol& dnsProto, const unsigned char* pBuffer, size_t nRead, const vector<RECORD>& vRecords, bool bProbing, vector<string>& vConflicts)
+{
+    typedef tuple<unsigned short, unsigned short, string> SORTKEY;  // class, type, rdata as RFC 6762 8.2 compares them
+
+    if (dnsProto.m_DnsHeader.QR == 1)
+    {
+        // Somebody else answers with one of our unique names and other data, RFC 6762 9
+        auto fnCheck = [&](const DnsProtokol::RRECORDS* pRecords, unsigned short nCount)
+        {
+            for (unsigned short n = 0; n < nCount; ++n)
+            {
+                bool bSameType = false, bSameData = false;
+                string strRData;
+                for (const auto& Record : vRecords)
+                {
+                    if (Record.bUnique == false || Record.usType != pRecords[n].TYPE || IsSameName(Record.strName, pRecords[n].LABEL) == false)
+                        continue;
+                    if (bSameType == false)
+                        strRData = dnsProto.GetCanonicalRData(pBuffer, nRead, pRecords[n]);
+                    bSameType = true;
+                    bSameData |= GetCanonicalRData(Record) == strRData;
+                }
+                if (bSameType == true && bSameData == false)
+                    vConflicts.emplace_back(begin(pRecords[n].LABEL), end(pRecords[n].LABEL));
+            }
+        };
+        fnCheck(dnsProto.m_pAnswers.get(), dnsProto.m_DnsHeader.ANCOUNT);
+        fnCheck(dnsProto.m_pExtraRec.get(), dnsProto.m_DnsHeader.ARCOUNT);
+    }
+    else if (dnsProto.m_DnsHeader.NSCOUNT > 0)
+    {
+        // Simultaneous probe for a name we are probing, the lexicographically later data wins, RFC 6762 8.2. Tentative records are probed too
+        for (short n = 0; n < dnsProto.m_DnsHeader.QDCOUNT; ++n)
+        {
+            const auto& Question = dnsProto.m_pQuestions.get()[n];
+            vector<SORTKEY> vOurs, vTheirs;
+            for (const auto& Record : vRecords)
+            {
+                if (Record.bUnique == true && (bProbing == true || Record.bTentative == true) && IsSameName(Record.strName, Question.LABEL) == true)
+                    vOurs.emplace_back(1, Record.usType, GetCanonicalRData(Record));
+            }
+            if (vOurs.empty() == true)
+                continue;
+            for (unsigned short i = 0; i < dnsProto.m_DnsHeader.NSCOUNT; ++i)
+            {
+                const auto& Record = dnsProto.m_pNameServ.get()[i];
+                if (IsSameName(Record.LABEL, Question.LABEL) == true)
+                    vTheirs.emplace_back(Record.CLASS & 0x7fff, Record.TYPE, dnsProto.GetCanonicalRData(pBuffer, nRead, Record));
+            }
+            sort(begin(vOurs), end(vOurs));
+            sort(begin(vTheirs), end(vTheirs));
+            if (vOurs < vTheirs)
+                return true;
+        }
+    }
+    return false;
+}
+
+DnsProtokol::ANSWERITEM ServiceRegistry::AsAnswer(RECORD& Record, bool bCacheFlush, int iTtl)
+{
+    DnsProtokol::ANSWERITEM Item;
+    Item.strLabel = { 0, Record.strName };
+    Item.usType = Record.usType;
+    Item.usClass = bCacheFlush == true && Record.bUnique == true ? 0x8001 : 1;
+    Item.iTtl = iTtl;
+    switch (Record.usType)
+    {
+    case 12: Item.rData.ptrData = &Record.PtrData; break;
+    case 16: Item.rData.txtData = &Record.vTxt; break;
+    case 33: Item.rData.svData = &Record.SrvData; break;
+    case 47: Item.rData.nsData = &Record.NsecData; break;
+    default: Item.rData.pVoid = Record.Addr; break;
+    }
+    return Item;
+}
+
+string ServiceRegistry::GetCanonicalRData(const RECORD& Record)
+{
+    switch (Record.usType)
+    {
+    case 1:     // A
+        return string(reinterpret_cast<const char*>(Record.Addr), 4);
+    case 28:    // AAAA
+        return string(reinterpret_cast<const char*>(Record.Addr), 16);
+    case 12:    // PTR
+        return DnsProtokol::EncodeName(Record.PtrData.second);
+    case 16:    // TXT
+    {
+        string strRData;
+        for (const auto& strTxt : Record.vTxt)
+            strRData += static_cast<char>(strTxt.size()) + strTxt;
+        return strRData;
+    }
+    case 33:    // SRV
+    {
+        const unsigned short aValues[3] = { htons(Record.SrvData.Priority), htons(Record.SrvData.Weight), htons(Record.SrvData.Port) };
+        return string(reinterpret_cast<const char*>(aValues), 6) + DnsProtokol::EncodeName(Record.SrvData.strHost.second);
+    }
+    case 47:    // NSEC
+        return DnsProtokol::EncodeName(Record.NsecData.strNextName.second) + DnsProtokol::EncodeTypeBitmaps(Record.NsecData.vTypes);
+    default:
+        return string();
+    }
+}
+
+bool ServiceRegistry::FromCanonicalRData(const string& strName, unsigned short usType, const string& strRData, RECORD& Record)
+{
+    Record.strName = strName;
+    Record.usType = usType;
+    switch (usType)
+    {
+    case 1:     // A
+    case 28:    // AAAA
+        if (strRData.size() != (usType == 1 ? 4u : 16u))
+            return false;
+        copy(begin(strRData), end(strRData), Record.Addr);
+        return true;
+    case 12:    // PTR
+    {
+        size_t nOffset = 0;
+        Record.PtrData = { 0, DnsProtokol::DecodeName(strRData, nOffset) };
+        return Record.PtrData.second.empty() == false;
+    }
+    case 16:    // TXT
+        Record.vTxt.clear();
+        for (size_t nPos = 0; nPos < strRData.size(); nPos += 1 + static_cast<unsigned char>(strRData[nPos]))
+            Record.vTxt.push_back(strRData.substr(nPos + 1, static_cast<unsigned char>(strRData[nPos])));
+        return true;
+    case 33:    // SRV
+    {
+        if (strRData.size() <= 6)
+            return false;
+        size_t nOffset = 6;
+        const unsigned char* pData = reinterpret_cast<const unsigned char*>(strRData.data());
+        Record.SrvData.Priority = static_cast<unsigned short>((pData[0] << 8) | pData[1]);
+        Record.SrvData.Weight = static_cast<unsigned short>((pData[2] << 8) | pData[3]);
+        Record.SrvData.Port = static_cast<unsigned short>((pData[4] << 8) | pData[5]);
+        Record.SrvData.strHost = { 0, DnsProtokol::DecodeName(strRData, nOffset) };
+        return Record.SrvData.strHost.second.empty() == false;
+    }
+    case 47:    // NSEC
+        return DnsProtokol::ParseNsec(strRData, Record.NsecData.strNextName.second, Record.NsecData.vTypes);
+    default:
+        return false;
+    }
+}
+
+void ServiceRegistry::BuildServiceRecords(const SNAPSHOT& Snapshot, vector<RECORD>& vRecords)
+{
+    auto fnNewRecord = [&vRecords](const string& strName, unsigned short usType, bool bUnique, bool bTentative, int iTtl) -> RECORD&
+    {
+        vRecords.emplace_back();
+        vRecords.back().strName = strName;
+        vRecords.back().usType = usType;
+        vRecords.back().bUnique = bUnique;
+        vRecords.back().bTentative = bTentative;
+        vRecords.back().iTtl = iTtl;
+        return vRecords.back();
+    };
+
+    const vector<ENTRY>& vEntries = Snapshot.vEntries;
+    for (size_t n = 0; n < vEntries.size(); ++n)
+    {
+        const SERVICE& Service = vEntries[n].Service;
+        const string strInstance = Service.strInstance + "." + Service.strType;
+        auto fnSameType = [&Service](const ENTRY& item) { return IsSameName(item.Service.strType, Service.strType); };
+
+        // The type is enumerated once, tentative as long as all instances of it are, RFC 6763 9
+        if (find_if(begin(vEntries), begin(vEntries) + n, fnSameType) == begin(vEntries) + n)
+        {
+            const bool bTentative = all_of(begin(vEntries), end(vEntries), [&](const ENTRY& item) { return fnSameType(item) == false || item.bTentative == true; });
+            fnNewRecord("_services._dns-sd._udp.local", 12, false, bTentative, TTL_OTHER).PtrData = { 0, Service.strType };
+        }
+        fnNewRecord(Service.strType, 12, false, vEntries[n].bTentative, TTL_OTHER).PtrData = { 0, strInstance };
+        fnNewRecord(strInstance, 33, true, vEntries[n].bTentative, TTL_HOST).SrvData = { 0, 0, Service.nPort, { 0, Snapshot.strHostName } };
+        fnNewRecord(strInstance, 16, true, vEntries[n].bTentative, TTL_OTHER).vTxt = Service.vTxt;
+    }
+}
+
+void ServiceRegistry::Publish(unique_ptr<SNAPSHOT> pSnapshot)
+{
+    const SNAPSHOT* pOld = m_pSnapshot.exchange(pSnapshot.release());
+
+    // A reader may have read the epoch just before it moved on and count itself in the old counter late,
+    // it got the new snapshot then. Waiting for both counters once catches all readers of the old one
+    for (int n = 0; n < 2; ++n)
+    {
+        const uint32_t nEpoch = m_nEpoch.fetch_add(1);
+        while (m_nReaders[nEpoch & 1].load() != 0)
+            this_thread::yield();
+    }
+    delete pOld;
+}
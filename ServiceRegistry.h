@@ -0,0 +1,168 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <functional>
+
+#include "DnsProtokol.h"
+#include "OptionalMutex.h"
+
+using namespace std;
+
+// The host name and the services we are authoritative for, and the resource records derived from them.
+// The data is an immutable snapshot, a change copies it and publishes the copy. Readers take no lock: a
+// SnapshotRef counts itself in one of two reader counters, picked by the current epoch, and loads the
+// snapshot pointer. A writer swaps the pointer, then moves the epoch on twice and each time waits until the
+// counter of the old epoch is 0. After that no reader can hold the replaced snapshot, the writer frees it.
+// Writers wait for readers, never the other way round, so a thread holding a SnapshotRef must not change
+// the registry. A packet is answered from one snapshot, even if a change is published meanwhile.
+class ServiceRegistry
+{
+public:
+    typedef struct
+    {
+        string strInstance;         // instance label, "HTTP2SERV"
+        string strType;             // service type, "_http._tcp.local"
+        unsigned short nPort;
+        vector<string> vTxt;
+    }SERVICE;
+
+    typedef struct                  // owns the data an ANSWERITEM points to
+    {
+        string strName;
+        unsigned short usType;
+        bool bUnique;               // unique records are probed and sent with the cache flush bit
+        bool bTentative;            // of a service added by SetServices and not probed yet, we do not answer with it
+        int iTtl;
+        DnsProtokol::IDxSTRING PtrData;
+        DnsProtokol::SRVDATA SrvData;
+        vector<string> vTxt;
+        unsigned char Addr[16];
+        DnsProtokol::NSECDATA NsecData;
+    }RECORD;
+
+    typedef struct                  // points into the records the answers were prepared from
+    {
+        vector<DnsProtokol::ANSWERITEM> AnList;     // multicast
+        vector<DnsProtokol::ANSWERITEM> ArList;
+        vector<DnsProtokol::ANSWERITEM> UnAnList;   // unicast to the querier
+        vector<DnsProtokol::ANSWERITEM> UnArList;
+        vector<DnsProtokol::QUESTIONITEM> QdList;   // repeated in the answer to a legacy query
+        unsigned short nId;                         // of the unicast answer
+        size_t nSuppressed;                         // records not multicast again within the minimum interval
+    }ANSWERS;
+
+    typedef struct                  // what SetServices changed, the records are the ones of the services, not the address records
+    {
+        vector<RECORD> vGoodbye;    // gone, sent with TTL 0
+        vector<RECORD> vAnnounce;   // new data for names we own already, announced again, RFC 6762 8.4
+        vector<string> vProbe;      // names of new service instances, tentative until SetProbed
+    }CHANGES;
+
+    // Was the record multicast on the interface within the interval. The claim version also books the next multicast if not
+    typedef function<bool(const RECORD& Record, chrono::steady_clock::duration tInterval)> MULTICASTCHECK;
+
+    typedef struct
+    {
+        SERVICE Service;
+        string strConfigured;       // the instance label it was added with, Service.strInstance may be renamed
+        bool bTentative;
+    }ENTRY;
+
+    typedef struct
+    {
+        string strHostName;
+        vector<ENTRY> vEntries;
+    }SNAPSHOT;
+
+    // The snapshot current when it was taken, valid as long as the SnapshotRef lives
+    class SnapshotRef
+    {
+    public:
+        explicit SnapshotRef(const ServiceRegistry& Registry);
+        SnapshotRef(SnapshotRef&& Other);
+        ~SnapshotRef();
+        SnapshotRef& operator=(const SnapshotRef&) = delete;
+        const SNAPSHOT& operator*() const { return *m_pSnapshot; }
+        const SNAPSHOT* operator->() const { return m_pSnapshot; }
+
+    private:
+        atomic<uint32_t>* m_pReaders;   // the counter it is counted in, nullptr once moved away
+        const SNAPSHOT*   m_pSnapshot;
+    };
+
+    static const int TTL_HOST = 120;     // RFC 6762 10, records containing a host name
+    static const int TTL_OTHER = 4500;   // RFC 6762 10, all other records
+
+public:
+    // bThreadSafe false if all members are called from the same thread, the readers take no lock anyway
+    explicit ServiceRegistry(bool bThreadSafe = true);
+    virtual ~ServiceRegistry();
+
+    void SetHostName(const string& strHostName);
+    string GetHostName() const;
+    void AddService(const SERVICE& Service);
+    // Replaces all services. A service keeps a name it got by Rename as long as it stays in the list
+    CHANGES SetServices(const vector<SERVICE>& vServices);
+    // The probing of these instance names is done, their records are given out from now on
+    void SetProbed(const vector<string>& vNames);
+    vector<string> GetOwnedNames() const;
+    // The current data, the receive paths take it once per packet and build all records of the packet from it
+    SnapshotRef GetSnapshot() const;
+
+    // All records for an interface, the address records are built from the interface address
+    void BuildRecords(int adrFamily, const string& strIpAddr, vector<RECORD>& vRecords) const;
+    static void BuildRecords(const SNAPSHOT& Snapshot, int adrFamily, const string& strIpAddr, vector<RECORD>& vRecords);
+    // One NSEC record for every unique name in vRecords, listing the types it has, so a querier learns which it has not, RFC 6762 6.1.
+    // vHostTypes are the address types the host has on the interface, also the ones of the other address family
+    void AddNsecRecords(vector<RECORD>& vRecords, const vector<unsigned short>& vHostTypes) const;
+    static void AddNsecRecords(const SNAPSHOT& Snapshot, vector<RECORD>& vRecords, const vector<unsigned short>& vHostTypes);
+    // Picks a new name for the host or the service instance owning strName, returns the new name or an empty string
+    string Rename(const string& strName);
+
+    // Our records answering the questions of a query and the ones going along as additional records, RFC 6762 6 and 6.7, RFC 6763 12.
+    // bProbed is false while the unique records are probed, they are not ours until then
+    static void PrepareAnswers(DnsProtokol& dnsProto, vector<RECORD>& vRecords, bool bProbed, bool bLegacy, const MULTICASTCHECK& fnMulticastWithin, const MULTICASTCHECK& fnClaimMulticast, ANSWERS& Answers);
+    // Names of our unique records another host answers with other data, RFC 6762 9. Returns true if bProbing
+    // and a simultaneous probe for one of our names wins the tie-break, RFC 6762 8.2
+    static bool FindConflicts(DnsProtokol& dnsProto, const unsigned char* pBuffer, size_t nRead, const vector<RECORD>& vRecords, bool bProbing, vector<string>& vConflicts);
+
+    static DnsProtokol::ANSWERITEM AsAnswer(RECORD& Record, bool bCacheFlush, int iTtl);
+    static string GetCanonicalRData(const RECORD& Record);
+    // The reverse, fills the data fields of a record (not bUnique and iTtl), false for a type we can not hold
+    static bool FromCanonicalRData(const string& strName, unsigned short usType, const string& strRData, RECORD& Record);
+    template<class STR1, class STR2>
+    static bool IsSameName(const STR1& strName1, const STR2& strName2)
+    {
+        return strName1.size() == strName2.size() && equal(begin(strName1), end(strName1), begin(strName2), [](char c1, char c2) { return tolower(static_cast<unsigned char>(c1)) == tolower(static_cast<unsigned char>(c2)); });
+    }
+
+private:
+    // The PTR, SRV and TXT records of the services
+    static void BuildServiceRecords(const SNAPSHOT& Snapshot, vector<RECORD>& vRecords);
+    // Called with m_mtxRegistry held, pSnapshot is a changed copy of the current one. Returns when the replaced one is freed
+    void Publish(unique_ptr<SNAPSHOT> pSnapshot);
+
+private:
+    mutable OptionalMutex m_mtxRegistry;      // held by the writers only, while they copy, change and publish
+    atomic<const SNAPSHOT*> m_pSnapshot;        // owned, only the writers change it
+    mutable atomic<uint32_t> m_nEpoch;          // its lowest bit picks the reader counter
+    mutable atomic<uint32_t> m_nReaders[2];     // SnapshotRefs alive per epoch parity
+};
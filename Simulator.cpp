@@ -0,0 +1,446 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+#include <cctype>
+
+#if defined (_WIN32) || defined (_WIN64)
+#include <WinSock2.h>
+#include <Ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#endif
+#include "DnsProtokol.h"
+#include "Simulator.h"
+
+namespace
+{
+    const int64_t MILLISECOND = 1000;
+    const int64_t SECOND = 1000000;
+    const char* const SERVICETYPE = "_http._tcp.local";
+}
+
+Simulator::CONFIG Simulator::DefaultConfig()
+{
+    return { 200, 0.25, 1, 0.0, chrono::microseconds(200), chrono::microseconds(800), chrono::seconds(5), chrono::seconds(120), 0.0, chrono::seconds(10) };
+}
+
+Simulator::Simulator(const CONFIG& Config) : m_Config(Config), m_Rng(Config.nSeed), m_tNow(0), m_nSequence(0), m_nPairsLive(0), m_nPairsStale(0), m_nLiveHosts(0), m_nLiveBrowsers(0), m_bAllStarted(false), m_tConverged(-1), m_nChurnEvents(0)
+{
+    m_Report = REPORT();
+}
+
+Simulator::~Simulator()
+{
+}
+
+Simulator::REPORT Simulator::Run()
+{
+    m_vKnownBy.assign(m_Config.nHosts, 0);
+    SIMTIME tLastStart = 0;
+    for (size_t n = 0; n < m_Config.nHosts; ++n)
+    {
+        m_vHosts.push_back(make_unique<HOST>());
+        HOST& Host = *m_vHosts.back();
+        Host.nIndex = n;
+        Host.bBrowser = Chance(m_Config.dBrowserShare);
+        Host.Registry.SetHostName("host" + to_string(n) + ".local");
+        Host.Registry.AddService({ "Service " + to_string(n), SERVICETYPE, 80, { "path=/" } });
+        const string strAddr = "10." + to_string((n >> 16) & 0xff) + "." + to_string((n >> 8) & 0xff) + "." + to_string(n & 0xff);
+        Host.Registry.BuildRecords(AF_INET, strAddr, Host.vRecords);
+        Host.vAnswerRecords = Host.vRecords;
+        Host.Registry.AddNsecRecords(Host.vAnswerRecords, { 1 });     // the hosts have IPv4 only
+        for (const auto& Record : Host.vRecords)
+        {
+            if (Record.usType == 12 && ServiceRegistry::IsSameName(Record.strName, string(SERVICETYPE)) == true)
+                m_maInstances[ServiceRegistry::GetCanonicalRData(Record)] = n;
+        }
+
+        const SIMTIME tStart = RandomDelay(0, chrono::duration_cast<chrono::microseconds>(m_Config.tStartSpread).count());
+        tLastStart = max(tLastStart, tStart);
+        Schedule(tStart, [this, n]() { StartHost(*m_vHosts[n]); });
+    }
+    Schedule(tLastStart, [this]() { m_bAllStarted = true; CheckConvergence(); });   // after the last start, same time runs in order
+    if (m_Config.dChurnPerMinute > 0)
+        Schedule(RandomDelay(0, static_cast<SIMTIME>(2 * 60 * SECOND / m_Config.dChurnPerMinute)), [this]() { Churn(); });
+
+    const SIMTIME tEnd = chrono::duration_cast<chrono::microseconds>(m_Config.tDuration).count();
+    while (m_Events.empty() == false && m_Events.top().tWhen <= tEnd)
+    {
+        EVENT Event = m_Events.top();
+        m_Events.pop();
+        m_tNow = Event.tWhen;
+        Event.fnAction();
+    }
+
+    m_Report.nAnswered = m_vLatencies.size();
+    if (m_vLatencies.empty() == false)
+    {
+        sort(begin(m_vLatencies), end(m_vLatencies));
+        double dSum = 0;
+        for (const auto dLatency : m_vLatencies)
+            dSum += dLatency;
+        m_Report.dLatencyAvgMs = dSum / m_vLatencies.size();
+        m_Report.dLatencyP95Ms = m_vLatencies[m_vLatencies.size() * 95 / 100];
+        m_Report.dLatencyMaxMs = m_vLatencies.back();
+    }
+    m_Report.dConvergenceSec = m_tConverged < 0 ? -1.0 : ToSeconds(m_tConverged);
+    m_Report.nChurnEvents = m_nChurnEvents;
+    m_Report.nChurnConverged = m_vChurnConvergence.size();
+    for (const auto dTime : m_vChurnConvergence)
+    {
+        m_Report.dChurnConvergenceAvgSec += dTime / m_vChurnConvergence.size();
+        m_Report.dChurnConvergenceMaxSec = max(m_Report.dChurnConvergenceMaxSec, dTime);
+    }
+    return m_Report;
+}
+
+void Simulator::Schedule(SIMTIME tWhen, function<void()> fnAction)
+{
+    m_Events.push({ tWhen, m_nSequence++, move(fnAction) });
+}
+
+void Simulator::ScheduleHost(HOST& Host, SIMTIME tWhen, function<void(HOST&)> fnAction)
+{
+    const uint64_t nGeneration = Host.nGeneration;
+    HOST* pHost = &Host;
+    Schedule(tWhen, [pHost, nGeneration, fnAction]()
+    {
+        if (pHost->nGeneration == nGeneration)     // the host went down or restarted in the meantime
+            fnAction(*pHost);
+    });
+}
+
+Simulator::SIMTIME Simulator::RandomDelay(SIMTIME tMin, SIMTIME tMax)
+{
+    return tMin + (tMax > tMin ? static_cast<SIMTIME>(m_Rng() % static_cast<uint64_t>(tMax - tMin + 1)) : 0);
+}
+
+bool Simulator::Chance(double dProbability)
+{
+    return (m_Rng() >> 11) * (1.0 / 9007199254740992.0) < dProbability;    // 53 random bits to [0, 1)
+}
+
+void Simulator::StartHost(HOST& Host)
+{
+    Host.bUp = true;
+    Host.bProbed = false;
+    Host.maLastMulticast.clear();
+    ++Host.nGeneration;
+    ++m_nLiveHosts;
+    if (Host.bBrowser == true)
+        ++m_nLiveBrowsers;
+    m_nPairsStale -= m_vKnownBy[Host.nIndex];
+    m_nPairsLive += m_vKnownBy[Host.nIndex];
+
+    // Three probes 250 ms apart, then two announcements a second apart, RFC 6762 8.1 and 8.3
+    for (int n = 0; n < 3; ++n)
+        ScheduleHost(Host, m_tNow + n * 250 * MILLISECOND, [this](HOST& Host) { SendProbe(Host); });
+    ScheduleHost(Host, m_tNow + 750 * MILLISECOND, [this](HOST& Host) { Host.bProbed = true; SendAnnouncement(Host, false); });
+    ScheduleHost(Host, m_tNow + 1750 * MILLISECOND, [this](HOST& Host) { SendAnnouncement(Host, false); });
+
+    // As ServiceBrowser, the first browse query goes at once, then after one second and the interval doubles, RFC 6762 5.2
+    if (Host.bBrowser == true)
+    {
+        Host.tQueryInterval = SECOND;
+        Host.tQuerySent = -1;
+        ScheduleHost(Host, m_tNow, [this](HOST& Host) { SendBrowseQuery(Host); });
+    }
+    CheckConvergence();
+}
+
+void Simulator::StopHost(HOST& Host)
+{
+    if (Host.bProbed == true)
+        SendAnnouncement(Host, true);
+
+    Host.bUp = false;
+    ++Host.nGeneration;
+    --m_nLiveHosts;
+    m_nPairsLive -= m_vKnownBy[Host.nIndex];
+    m_nPairsStale += m_vKnownBy[Host.nIndex];
+    if (Host.bBrowser == true)
+    {
+        --m_nLiveBrowsers;
+        while (Host.maCache.empty() == false)
+            Forget(Host, Host.maCache.begin()->first);
+    }
+    CheckConvergence();
+}
+
+void Simulator::Churn()
+{
+    vector<size_t> vUp;
+    for (const auto& pHost : m_vHosts)
+    {
+        if (pHost->bUp == true)
+            vUp.push_back(pHost->nIndex);
+    }
+    if (vUp.empty() == false)
+    {
+        HOST& Host = *m_vHosts[vUp[m_Rng() % vUp.size()]];
+        ++m_nChurnEvents;
+        m_vChurnPending.push_back(m_tNow);
+        StopHost(Host);
+
+        const size_t nIndex = Host.nIndex;
+        Schedule(m_tNow + chrono::duration_cast<chrono::microseconds>(m_Config.tDowntime).count(), [this, nIndex]()
+        {
+            ++m_nChurnEvents;
+            m_vChurnPending.push_back(m_tNow);
+            StartHost(*m_vHosts[nIndex]);
+        });
+    }
+    Schedule(m_tNow + RandomDelay(0, static_cast<SIMTIME>(2 * 60 * SECOND / m_Config.dChurnPerMinute)), [this]() { Churn(); });
+}
+
+void Simulator::SendProbe(HOST& Host)
+{
+    // Questions of type ANY for the unique names, our records in the authority section, RFC 6762 8.2
+    vector<DnsProtokol::QUESTIONITEM> QdList;
+    vector<DnsProtokol::ANSWERITEM> AnList, NsList, ArList;
+    for (auto& Record : Host.vRecords)
+    {
+        if (Record.bUnique == false)
+            continue;
+        if (none_of(begin(QdList), end(QdList), [&Record](const DnsProtokol::QUESTIONITEM& item) { return ServiceRegistry::IsSameName(item.strLabel.second, Record.strName); }))
+            QdList.push_back({ { 0, Record.strName }, 255, 0x8001 });
+        NsList.push_back(ServiceRegistry::AsAnswer(Record, false, Record.iTtl));
+    }
+    Send(Host, false, QdList, AnList, NsList, ArList, false);
+}
+
+void Simulator::SendAnnouncement(HOST& Host, bool bGoodbye)
+{
+    vector<DnsProtokol::QUESTIONITEM> QdList;
+    vector<DnsProtokol::ANSWERITEM> AnList, NsList, ArList;
+    for (auto& Record : Host.vRecords)
+        AnList.push_back(ServiceRegistry::AsAnswer(Record, true, bGoodbye == true ? 0 : Record.iTtl));
+    Send(Host, true, QdList, AnList, NsList, ArList, false);
+}
+
+void Simulator::SendBrowseQuery(HOST& Host)
+{
+    // One question without known answers, as mDnsServer sends for ServiceBrowser
+    vector<DnsProtokol::QUESTIONITEM> QdList = { { { 0, SERVICETYPE }, 12, 1 } };
+    vector<DnsProtokol::ANSWERITEM> AnList, NsList, ArList;
+    Send(Host, false, QdList, AnList, NsList, ArList, false);
+
+    Host.tQuerySent = m_tNow;
+    ScheduleHost(Host, m_tNow + Host.tQueryInterval, [this](HOST& Host) { SendBrowseQuery(Host); });
+    Host.tQueryInterval = min(Host.tQueryInterval * 2, 3600 * SECOND);
+}
+
+void Simulator::Send(HOST& Host, bool bResponse, vector<DnsProtokol::QUESTIONITEM>& QdList, vector<DnsProtokol::ANSWERITEM>& AnList, vector<DnsProtokol::ANSWERITEM>& NsList, vector<DnsProtokol::ANSWERITEM>& ArList, bool bSolicited, size_t nTo/* = SIZE_MAX*/)
+{
+    auto pPacket = make_shared<SIMPACKET>();
+    pPacket->nFrom = Host.nIndex;
+    pPacket->bSolicited = bSolicited;
+    {
+        DnsArena::Scope ArenaScope;
+        DnsProtokol dnsBuild;
+        size_t nBufLen = 0;
+        if ((bResponse == true ? dnsBuild.BuildAnswer(AnList, NsList, ArList, nullptr, nBufLen) : dnsBuild.BuildQuery(QdList, AnList, NsList, nullptr, nBufLen)) != 0)
+            return;
+        auto pBuffer = MakeArenaArray<char>(nBufLen);
+        const size_t nSize = bResponse == true ? dnsBuild.BuildAnswer(AnList, NsList, ArList, &pBuffer[0], nBufLen) : dnsBuild.BuildQuery(QdList, AnList, NsList, &pBuffer[0], nBufLen);
+        pPacket->vData.assign(&pBuffer[0], &pBuffer[0] + nSize);
+    }
+
+    // As mDnsServer::SendAnswer, the records multicast now are not multicast again too soon
+    if (bResponse == true && nTo == SIZE_MAX)
+    {
+        for (const auto& item : AnList)
+            Host.maLastMulticast[MulticastKey(item.strLabel.second, item.usType)] = m_tNow;
+        for (const auto& item : ArList)
+            Host.maLastMulticast[MulticastKey(item.strLabel.second, item.usType)] = m_tNow;
+    }
+
+    // Decoded once here, outside the arena since the receivers get it later. What they see is what went over the wire
+    pPacket->pDecoded = make_unique<DnsProtokol>(&pPacket->vData[0], pPacket->vData.size());
+    const DnsProtokol& dnsProto = *pPacket->pDecoded;
+    if (dnsProto.m_strLastErrMsg.empty() == false)
+        return;
+
+    auto fnRecords = [&](const DnsProtokol::RRECORDS* pRecords, unsigned short nCount)
+    {
+        for (unsigned short n = 0; n < nCount; ++n)
+        {
+            SIMRECORD Record = { string(begin(pRecords[n].LABEL), end(pRecords[n].LABEL)), pRecords[n].TYPE, pRecords[n].CLASS, pRecords[n].TTL, pPacket->pDecoded->GetCanonicalRData(&pPacket->vData[0], pPacket->vData.size(), pRecords[n]), string(begin(pRecords[n].RDATA), end(pRecords[n].RDATA)) };
+            transform(begin(Record.strName), end(Record.strName), begin(Record.strName), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+            pPacket->vRecords.push_back(move(Record));
+        }
+    };
+    if (dnsProto.m_DnsHeader.QR == 1)
+    {
+        fnRecords(dnsProto.m_pAnswers.get(), dnsProto.m_DnsHeader.ANCOUNT);
+        fnRecords(dnsProto.m_pExtraRec.get(), dnsProto.m_DnsHeader.ARCOUNT);
+    }
+
+    ++m_Report.nPackets;
+    m_Report.nBytes += pPacket->vData.size();
+    ++(dnsProto.m_DnsHeader.QR == 1 ? m_Report.nResponses : m_Report.nQueries);
+
+    // Every other host that is up gets it, each one with its own latency and luck. A unicast answer only the querier
+    const SIMTIME tLatency = chrono::duration_cast<chrono::microseconds>(m_Config.tLatency).count();
+    const SIMTIME tJitter = chrono::duration_cast<chrono::microseconds>(m_Config.tJitter).count();
+    for (auto& pReceiver : m_vHosts)
+    {
+        if (pReceiver->nIndex == Host.nIndex || pReceiver->bUp == false || (nTo != SIZE_MAX && pReceiver->nIndex != nTo))
+            continue;
+        if (Chance(m_Config.dLoss) == true)
+        {
+            ++m_Report.nLost;
+            continue;
+        }
+        ScheduleHost(*pReceiver, m_tNow + tLatency + RandomDelay(0, tJitter), [this, pPacket](HOST& Receiver)
+        {
+            ++m_Report.nDelivered;
+            Receive(Receiver, *pPacket);
+        });
+    }
+}
+
+void Simulator::Receive(HOST& Host, SIMPACKET& Packet)
+{
+    // As mDnsServer::DatenEmpfangen, every packet of another host is checked for conflicts with our records
+    vector<string> vConflicts;
+    if (ServiceRegistry::FindConflicts(*Packet.pDecoded, &Packet.vData[0], Packet.vData.size(), Host.vRecords, Host.bProbed == false, vConflicts) == true)
+        ++m_Report.nConflicts;
+    m_Report.nConflicts += vConflicts.size();
+
+    if (Packet.pDecoded->m_DnsHeader.QR == 1)
+        ReceiveResponse(Host, Packet);
+    else
+        AnswerQuestions(Host, Packet);
+}
+
+void Simulator::AnswerQuestions(HOST& Host, SIMPACKET& Packet)
+{
+    // mDnsServer::AnswerQuestions, with the virtual clock behind the multicast checks. All hosts use port 5353, there are no legacy queries
+    const auto fnWithin = [this, &Host](const ServiceRegistry::RECORD& Record, chrono::steady_clock::duration tInterval)
+    {
+        const auto& itLast = Host.maLastMulticast.find(MulticastKey(Record.strName, Record.usType));
+        return itLast != end(Host.maLastMulticast) && m_tNow - itLast->second < chrono::duration_cast<chrono::microseconds>(tInterval).count();
+    };
+    const auto fnClaim = [this, &Host](const ServiceRegistry::RECORD& Record, chrono::steady_clock::duration tMinInterval)
+    {
+        const auto& itLast = Host.maLastMulticast.emplace(MulticastKey(Record.strName, Record.usType), m_tNow);
+        if (itLast.second == false && m_tNow - itLast.first->second < chrono::duration_cast<chrono::microseconds>(tMinInterval).count())
+            return false;
+        itLast.first->second = m_tNow;
+        return true;
+    };
+
+    ServiceRegistry::ANSWERS Answers;
+    ServiceRegistry::PrepareAnswers(*Packet.pDecoded, Host.vAnswerRecords, Host.bProbed, false, fnWithin, fnClaim, Answers);
+    m_Report.nSuppressed += Answers.nSuppressed;
+
+    vector<DnsProtokol::QUESTIONITEM> QdList;
+    vector<DnsProtokol::ANSWERITEM> NsList;
+    if (Answers.AnList.empty() == false)
+        Send(Host, true, QdList, Answers.AnList, NsList, Answers.ArList, true);
+    if (Answers.UnAnList.empty() == false)
+        Send(Host, true, QdList, Answers.UnAnList, NsList, Answers.UnArList, true, Packet.nFrom);
+}
+
+void Simulator::ReceiveResponse(HOST& Host, const SIMPACKET& Packet)
+{
+    if (Host.bBrowser == false)
+        return;
+
+    bool bAnswer = false;
+    for (const auto& Record : Packet.vRecords)
+    {
+        if (Record.usType == 12 && Record.strName == SERVICETYPE)
+        {
+            Learn(Host, Record);
+            bAnswer = true;
+        }
+    }
+
+    if (bAnswer == true && Packet.bSolicited == true && Host.tQuerySent >= 0)
+    {
+        m_vLatencies.push_back((m_tNow - Host.tQuerySent) / 1000.0);
+        Host.tQuerySent = -1;
+    }
+}
+
+void Simulator::Learn(HOST& Host, const SIMRECORD& Record)
+{
+    const auto& itEntry = Host.maCache.find(Record.strRData);
+    if (Record.nTtl == 0)
+    {
+        // A goodbye, the record goes in one second, RFC 6762 10.1
+        if (itEntry != end(Host.maCache))
+        {
+            itEntry->second.tExpire = min(itEntry->second.tExpire, m_tNow + SECOND);
+            const string strRData = Record.strRData;
+            ScheduleHost(Host, m_tNow + SECOND, [this, strRData](HOST& Host)
+            {
+                const auto& itEntry = Host.maCache.find(strRData);
+                if (itEntry != end(Host.maCache) && itEntry->second.tExpire <= m_tNow)
+                    Forget(Host, strRData);
+            });
+        }
+        return;
+    }
+
+    if (itEntry != end(Host.maCache))
+    {
+        itEntry->second.tExpire = m_tNow + Record.nTtl * SECOND;
+        itEntry->second.nTtl = Record.nTtl;
+        return;
+    }
+
+    Host.maCache[Record.strRData] = { Record.strText, m_tNow + Record.nTtl * SECOND, Record.nTtl };
+    const auto& itInstance = m_maInstances.find(Record.strRData);
+    if (itInstance != end(m_maInstances))
+    {
+        ++m_vKnownBy[itInstance->second];
+        ++(m_vHosts[itInstance->second]->bUp == true ? m_nPairsLive : m_nPairsStale);
+        CheckConvergence();
+    }
+}
+
+void Simulator::Forget(HOST& Host, const string& strRData)
+{
+    Host.maCache.erase(strRData);
+    const auto& itInstance = m_maInstances.find(strRData);
+    if (itInstance != end(m_maInstances))
+    {
+        --m_vKnownBy[itInstance->second];
+        --(m_vHosts[itInstance->second]->bUp == true ? m_nPairsLive : m_nPairsStale);
+        CheckConvergence();
+    }
+}
+
+void Simulator::CheckConvergence()
+{
+    // Every browser that is up knows the services of all other hosts that are up, and none of a host that is down
+    const uint64_t nWanted = m_nLiveHosts > 0 ? m_nLiveBrowsers * (m_nLiveHosts - 1) : 0;
+    if (m_bAllStarted == false || m_nPairsLive != nWanted || m_nPairsStale != 0)
+        return;
+
+    if (m_tConverged < 0)
+        m_tConverged = m_tNow;
+    for (const auto tStart : m_vChurnPending)
+        m_vChurnConvergence.push_back(ToSeconds(m_tNow - tStart));
+    m_vChurnPending.clear();
+}
+
+string Simulator::MulticastKey(const string& strName, unsigned short usType)
+{
+    string strKey(strName);
+    transform(begin(strKey), end(strKey), begin(strKey), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+    return strKey + '/' + to_string(usType);
+}
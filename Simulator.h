@@ -0,0 +1,189 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <queue>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <functional>
+
+#include "ServiceRegistry.h"
+
+using namespace std;
+
+// Runs many hosts on one simulated network segment in a single thread, to see how much traffic the
+// responder and query rules make with a thousand hosts and more. There are no sockets and no real
+// time: a virtual multicast bus delivers every packet to all other hosts after a latency, some get
+// lost, and a virtual clock jumps from one event to the next. Packets are built and decoded with
+// DnsProtokol, so their sizes are real. The hosts answer through the code mDnsServer answers with:
+// ServiceRegistry::PrepareAnswers picks the records and the one second multicast rule, FindConflicts
+// looks at every packet, only the clock behind the multicast checks is the virtual one. A change in
+// the answer path shows up in the numbers. The browsing hosts query for the services like ServiceBrowser.
+// All random choices come from one generator, the same seed gives the same run.
+class Simulator
+{
+public:
+    typedef struct
+    {
+        size_t nHosts;                      // every host announces one _http._tcp service
+        double dBrowserShare;               // share of the hosts browsing for the services, 0..1
+        uint64_t nSeed;
+        double dLoss;                       // probability a receiver misses a packet, 0..1
+        chrono::microseconds tLatency;      // fixed part of the delivery delay
+        chrono::microseconds tJitter;       // random part on top of it, 0..tJitter
+        chrono::seconds tStartSpread;       // the hosts start at random times within this
+        chrono::seconds tDuration;
+        double dChurnPerMinute;             // hosts leaving per minute, each comes back after tDowntime
+        chrono::seconds tDowntime;
+    }CONFIG;
+
+    typedef struct
+    {
+        uint64_t nPackets;
+        uint64_t nBytes;                    // DNS payload, without IP and UDP headers
+        uint64_t nQueries;
+        uint64_t nResponses;
+        uint64_t nSuppressed;               // records PrepareAnswers did not multicast again within the minimum interval
+        uint64_t nConflicts;                // reported by FindConflicts, the names are unique so this stays 0 unless the path is broken
+        uint64_t nDelivered;
+        uint64_t nLost;
+        uint64_t nAnswered;                 // browse queries that got an answer
+        double dLatencyAvgMs;               // browse query to the first answer
+        double dLatencyP95Ms;
+        double dLatencyMaxMs;
+        double dConvergenceSec;             // from the start until every browser knew every service, < 0 if never
+        size_t nChurnEvents;
+        size_t nChurnConverged;             // the caches got right again after the event
+        double dChurnConvergenceAvgSec;
+        double dChurnConvergenceMaxSec;
+    }REPORT;
+
+public:
+    static CONFIG DefaultConfig();
+
+    explicit Simulator(const CONFIG& Config);
+    virtual ~Simulator();
+
+    REPORT Run();
+
+private:
+    typedef int64_t SIMTIME;                // virtual microseconds since the start
+
+    typedef struct
+    {
+        string strName;                     // lower case
+        unsigned short usType;
+        unsigned short usClass;
+        uint32_t nTtl;
+        string strRData;                    // canonical
+        string strText;                     // RDATA as decoded, the instance name of a PTR
+    }SIMRECORD;
+
+    typedef struct                          // a packet decoded once when sent, every receiver works on the same copy
+    {
+        size_t nFrom;
+        bool bSolicited;                    // an answer to a query, not an announcement
+        vector<unsigned char> vData;        // as sent, FindConflicts reads the RDATA from it
+        unique_ptr<DnsProtokol> pDecoded;   // of vData
+        vector<SIMRECORD> vRecords;         // answers and additional records of a response
+    }SIMPACKET;
+
+    typedef struct
+    {
+        string strInstance;
+        SIMTIME tExpire;
+        uint32_t nTtl;
+    }CACHEENTRY;
+
+    typedef struct HOST
+    {
+        size_t nIndex;
+        bool bBrowser;
+        bool bUp;
+        bool bProbed;
+        uint64_t nGeneration;               // counts up when the host goes up or down, timers of an earlier life are ignored
+        ServiceRegistry Registry;
+        vector<ServiceRegistry::RECORD> vRecords;       // announced
+        vector<ServiceRegistry::RECORD> vAnswerRecords; // answered with, vRecords and the NSEC records as in mDnsServer
+        unordered_map<string, SIMTIME> maLastMulticast; // MulticastKey -> virtual time
+        map<string, CACHEENTRY> maCache;    // browser only, _http._tcp PTR records by canonical RDATA
+        SIMTIME tQueryInterval;
+        SIMTIME tQuerySent;                 // the last browse query, < 0 once it is answered
+    }HOST;
+
+    typedef struct
+    {
+        SIMTIME tWhen;
+        uint64_t nSequence;                 // events at the same time run in the order they were scheduled
+        function<void()> fnAction;
+    }EVENT;
+
+    struct EVENTORDER
+    {
+        bool operator()(const EVENT& e1, const EVENT& e2) const { return e1.tWhen != e2.tWhen ? e1.tWhen > e2.tWhen : e1.nSequence > e2.nSequence; }
+    };
+
+private:
+    void Schedule(SIMTIME tWhen, function<void()> fnAction);
+    void ScheduleHost(HOST& Host, SIMTIME tWhen, function<void(HOST&)> fnAction);
+    SIMTIME RandomDelay(SIMTIME tMin, SIMTIME tMax);
+    bool Chance(double dProbability);
+
+    void StartHost(HOST& Host);
+    void StopHost(HOST& Host);
+    void Churn();
+    void SendProbe(HOST& Host);
+    void SendAnnouncement(HOST& Host, bool bGoodbye);
+    void SendBrowseQuery(HOST& Host);
+    // nTo is the host a unicast answer goes to, SIZE_MAX for multicast
+    void Send(HOST& Host, bool bResponse, vector<DnsProtokol::QUESTIONITEM>& QdList, vector<DnsProtokol::ANSWERITEM>& AnList, vector<DnsProtokol::ANSWERITEM>& NsList, vector<DnsProtokol::ANSWERITEM>& ArList, bool bSolicited, size_t nTo = SIZE_MAX);
+    void Receive(HOST& Host, SIMPACKET& Packet);
+    void AnswerQuestions(HOST& Host, SIMPACKET& Packet);
+    void ReceiveResponse(HOST& Host, const SIMPACKET& Packet);
+    void Learn(HOST& Host, const SIMRECORD& Record);
+    void Forget(HOST& Host, const string& strRData);
+    void CheckConvergence();
+
+    static string MulticastKey(const string& strName, unsigned short usType);
+    static double ToSeconds(SIMTIME tTime) { return tTime / 1000000.0; }
+
+private:
+    CONFIG          m_Config;
+    mt19937_64      m_Rng;                  // its output is defined by the standard, unlike the distributions
+    SIMTIME         m_tNow;
+    uint64_t        m_nSequence;
+    priority_queue<EVENT, vector<EVENT>, EVENTORDER> m_Events;
+    vector<unique_ptr<HOST>> m_vHosts;
+    unordered_map<string, size_t> m_maInstances;    // canonical PTR RDATA -> host announcing it
+
+    // Convergence, a pair is a browser knowing the service of another host
+    vector<size_t>  m_vKnownBy;             // per host, browsers knowing its service
+    uint64_t        m_nPairsLive;           // known services of hosts that are up
+    uint64_t        m_nPairsStale;          // known services of hosts that are down
+    uint64_t        m_nLiveHosts;
+    uint64_t        m_nLiveBrowsers;
+    bool            m_bAllStarted;
+    SIMTIME         m_tConverged;
+    vector<SIMTIME> m_vChurnPending;        // start of the events not converged yet
+    size_t          m_nChurnEvents;
+    vector<double>  m_vChurnConvergence;
+    vector<double>  m_vLatencies;           // ms
+
+    REPORT          m_Report;
+};
@@ -0,0 +1,261 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <set>
+
+#if defined (_WIN32) || defined (_WIN64)
+#include <Windows.h>
+#endif
+#include "TrafficAnalytics.h"
+
+TrafficAnalytics::TrafficAnalytics() : m_tInterval(60), m_bEnabled(false), m_bStop(true)
+{
+}
+
+TrafficAnalytics::~TrafficAnalytics()
+{
+    Stop();
+}
+
+bool TrafficAnalytics::Start(const string& strFile, chrono::seconds tInterval)
+{
+    if (m_bEnabled == true || strFile.empty() == true || tInterval.count() <= 0)
+        return false;
+
+    m_strFile = strFile;
+    m_tInterval = tInterval;
+    {
+        lock_guard<mutex> lock(m_mxCounters);
+        m_maCounters.clear();
+        m_tPeriodStart = chrono::system_clock::now();
+    }
+    if (WriteSnapshot() == false)   // the file can be written, and the dashboard sees we are running
+        return false;
+
+    m_bStop = false;
+    m_bEnabled = true;
+    m_thWorker = thread(&TrafficAnalytics::Worker, this);
+    return true;
+}
+
+void TrafficAnalytics::Stop()
+{
+    {
+        lock_guard<mutex> lock(m_mxWorker);
+        m_bStop = true;
+        m_cvWorker.notify_all();
+    }
+    if (m_thWorker.joinable() == true)
+        m_thWorker.join();
+
+    if (m_bEnabled == true)
+        WriteSnapshot();
+    m_bEnabled = false;
+}
+
+bool TrafficAnalytics::IsEnabled() const
+{
+    return m_bEnabled;
+}
+
+void TrafficAnalytics::AddPacket(uint32_t nInterface, const string& strSource, DnsProtokol& dnsProto)
+{
+    auto fnLower = [](string strName) { transform(begin(strName), end(strName), begin(strName), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); }); return strName; };
+
+    // The service instances of a response: the targets of PTR records of a service type and the owners of SRV records, each once
+    set<string> setServices;
+    if (dnsProto.m_DnsHeader.QR == 1)
+    {
+        auto fnServices = [&](const DnsProtokol::RRECORDS* pRecords, unsigned short nCount)
+        {
+            for (unsigned short n = 0; n < nCount; ++n)
+            {
+                const string strName = fnLower(string(begin(pRecords[n].LABEL), end(pRecords[n].LABEL)));
+                if (pRecords[n].TTL == 0)
+                    continue;   // a goodbye announces nothing
+                if (pRecords[n].TYPE == 12 && strName != "_services._dns-sd._udp.local" && (strName.find("._tcp.") != string::npos || strName.find("._udp.") != string::npos))
+                    setServices.insert(fnLower(string(begin(pRecords[n].RDATA), end(pRecords[n].RDATA))));
+                else if (pRecords[n].TYPE == 33)
+                    setServices.insert(strName);
+            }
+        };
+        fnServices(dnsProto.m_pAnswers.get(), dnsProto.m_DnsHeader.ANCOUNT);
+        fnServices(dnsProto.m_pExtraRec.get(), dnsProto.m_DnsHeader.ARCOUNT);
+    }
+
+    lock_guard<mutex> lock(m_mxCounters);
+    if (m_maCounters.size() >= MAXINTERFACES && m_maCounters.find(nInterface) == end(m_maCounters))
+        nInterface = 0;
+    COUNTERS& Counters = m_maCounters[nInterface];
+
+    ++Counters.nPackets;
+    ++(dnsProto.m_DnsHeader.QR == 1 ? Counters.nResponses : Counters.nQueries);
+    Counters.Sketches[SOURCE].Add(strSource);
+    for (short n = 0; dnsProto.m_DnsHeader.QR == 0 && n < dnsProto.m_DnsHeader.QDCOUNT; ++n)
+    {
+        const auto& Question = dnsProto.m_pQuestions.get()[n];
+        Counters.Sketches[QUERYNAME].Add(fnLower(string(begin(Question.LABEL), end(Question.LABEL))));
+        Counters.Sketches[QUERYTYPE].Add(TypeName(Question.QTYPE));
+    }
+    for (const auto& strService : setServices)
+        Counters.Sketches[SERVICE].Add(strService);
+}
+
+map<uint32_t, TrafficAnalytics::COUNTERS> TrafficAnalytics::GetCounters() const
+{
+    lock_guard<mutex> lock(m_mxCounters);
+    return m_maCounters;
+}
+
+TrafficAnalytics::COUNTERS TrafficAnalytics::Merge(const map<uint32_t, COUNTERS>& maCounters)
+{
+    COUNTERS All = {};
+    for (const auto& item : maCounters)
+    {
+        All.nPackets += item.second.nPackets;
+        All.nQueries += item.second.nQueries;
+        All.nResponses += item.second.nResponses;
+        for (size_t n = 0; n < DIMENSIONS; ++n)
+            All.Sketches[n].Merge(item.second.Sketches[n]);
+    }
+    return All;
+}
+
+string TrafficAnalytics::ToJson(const map<uint32_t, COUNTERS>& maCounters, chrono::system_clock::time_point tStart, chrono::system_clock::time_point tEnd)
+{
+    string strJson = "{\"start\":" + JsonTime(tStart) + ",\"end\":" + JsonTime(tEnd) + ",\"interfaces\":[";
+    for (auto it = begin(maCounters); it != end(maCounters); ++it)
+        strJson += (it != begin(maCounters) ? ",{\"interface\":" : "{\"interface\":") + to_string(it->first) + "," + JsonCounters(it->second) + "}";
+    strJson += "],\"all\":{" + JsonCounters(Merge(maCounters)) + "}}\n";
+    return strJson;
+}
+
+void TrafficAnalytics::Worker()
+{
+    unique_lock<mutex> lock(m_mxWorker);
+    auto tNext = chrono::steady_clock::now() + m_tInterval;
+    while (m_bStop == false)
+    {
+        m_cvWorker.wait_until(lock, tNext, [&]() { return m_bStop; });
+        if (m_bStop == true)
+            break;
+        lock.unlock();
+        WriteSnapshot();
+        lock.lock();
+        tNext += m_tInterval;
+    }
+}
+
+bool TrafficAnalytics::WriteSnapshot()
+{
+    // The counting of the next period starts with the snapshot taken
+    map<uint32_t, COUNTERS> maCounters;
+    chrono::system_clock::time_point tStart;
+    const auto tEnd = chrono::system_clock::now();
+    {
+        lock_guard<mutex> lock(m_mxCounters);
+        maCounters.swap(m_maCounters);
+        tStart = m_tPeriodStart;
+        m_tPeriodStart = tEnd;
+    }
+    const string strJson = ToJson(maCounters, tStart, tEnd);
+
+    // Written next to it and renamed, a reader never sees half a file
+    const string strTmpFile = m_strFile + ".tmp";
+    {
+        ofstream fout(strTmpFile, ios::binary | ios::trunc);
+        fout.write(strJson.data(), strJson.size());
+        fout.close();
+        if (fout.fail() == true)
+        {
+            remove(strTmpFile.c_str());
+            return false;
+        }
+    }
+
+#if defined (_WIN32) || defined (_WIN64)
+    return MoveFileExA(strTmpFile.c_str(), m_strFile.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+    return rename(strTmpFile.c_str(), m_strFile.c_str()) == 0;
+#endif
+}
+
+string TrafficAnalytics::TypeName(unsigned short usType)
+{
+    switch (usType)
+    {
+    case 1:   return "A";
+    case 12:  return "PTR";
+    case 16:  return "TXT";
+    case 28:  return "AAAA";
+    case 33:  return "SRV";
+    case 47:  return "NSEC";
+    case 255: return "ANY";
+    default:  return "TYPE" + to_string(usType);   // RFC 3597 5
+    }
+}
+
+string TrafficAnalytics::JsonString(const string& strText)
+{
+    // Names may hold any byte, everything not printable ASCII is escaped
+    string strJson = "\"";
+    for (const auto c : strText)
+    {
+        const unsigned char uc = static_cast<unsigned char>(c);
+        if (uc == '"' || uc == '\\')
+            strJson += string("\\") + c;
+        else if (uc < 0x20 || uc >= 0x7f)
+        {
+            char szEscape[8];
+            snprintf(szEscape, sizeof(szEscape), "\\u%04x", uc);
+            strJson += szEscape;
+        }
+        else
+            strJson += c;
+    }
+    return strJson + "\"";
+}
+
+string TrafficAnalytics::JsonCounters(const COUNTERS& Counters)
+{
+    static const char* const szNames[DIMENSIONS] = { "query_names", "query_types", "sources", "services" };
+
+    string strJson = "\"packets\":" + to_string(Counters.nPackets) + ",\"queries\":" + to_string(Counters.nQueries) + ",\"responses\":" + to_string(Counters.nResponses);
+    for (size_t n = 0; n < DIMENSIONS; ++n)
+    {
+        strJson += string(",\"") + szNames[n] + "\":{\"total\":" + to_string(Counters.Sketches[n].Total()) + ",\"top\":[";
+        const CountMinSketch::TOPLIST vTop = Counters.Sketches[n].GetTop();
+        for (size_t i = 0; i < vTop.size(); ++i)
+            strJson += (i > 0 ? ",[" : "[") + JsonString(vTop[i].first) + "," + to_string(vTop[i].second) + "]";
+        strJson += "]}";
+    }
+    return strJson;
+}
+
+string TrafficAnalytics::JsonTime(chrono::system_clock::time_point tTime)
+{
+    const time_t tSeconds = chrono::system_clock::to_time_t(tTime);
+    struct tm tmUtc;
+#if defined (_WIN32) || defined (_WIN64)
+    gmtime_s(&tmUtc, &tSeconds);
+#else
+    gmtime_r(&tSeconds, &tmUtc);
+#endif
+    char szTime[32];
+    strftime(szTime, sizeof(szTime), "\"%Y-%m-%dT%H:%M:%SZ\"", &tmUtc);
+    return szTime;
+}
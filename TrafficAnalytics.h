@@ -0,0 +1,85 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "DnsProtokol.h"
+#include "CountMinSketch.h"
+
+using namespace std;
+
+// Who asks for what and who announces what on each interface, in fixed memory. Every decoded packet
+// goes into four sketches: the names and the types asked for, the hosts sending, and the service
+// instances announced. The sketches of all interfaces are merged for the machine as a whole. Every
+// interval a snapshot is written to a file as JSON and the counting starts over.
+class TrafficAnalytics
+{
+public:
+    enum { QUERYNAME, QUERYTYPE, SOURCE, SERVICE, DIMENSIONS };
+
+    typedef struct
+    {
+        uint64_t nPackets;
+        uint64_t nQueries;
+        uint64_t nResponses;
+        CountMinSketch Sketches[DIMENSIONS];
+    }COUNTERS;
+
+    static const size_t MAXINTERFACES = 64;     // the packets of more interfaces are counted under interface 0
+
+public:
+    TrafficAnalytics();
+    virtual ~TrafficAnalytics();
+
+    bool Start(const string& strFile, chrono::seconds tInterval);
+    // Writes the last snapshot
+    void Stop();
+    bool IsEnabled() const;
+
+    // strSource is the address of the sender without the port
+    void AddPacket(uint32_t nInterface, const string& strSource, DnsProtokol& dnsProto);
+    map<uint32_t, COUNTERS> GetCounters() const;
+
+    static COUNTERS Merge(const map<uint32_t, COUNTERS>& maCounters);
+    static string ToJson(const map<uint32_t, COUNTERS>& maCounters, chrono::system_clock::time_point tStart, chrono::system_clock::time_point tEnd);
+
+private:
+    void Worker();
+    bool WriteSnapshot();
+
+    static string TypeName(unsigned short usType);
+    static string JsonString(const string& strText);
+    static string JsonCounters(const COUNTERS& Counters);
+    static string JsonTime(chrono::system_clock::time_point tTime);
+
+private:
+    string               m_strFile;
+    chrono::seconds      m_tInterval;
+    atomic<bool>         m_bEnabled;
+
+    mutable mutex        m_mxCounters;      // guards the two members below
+    map<uint32_t, COUNTERS> m_maCounters;
+    chrono::system_clock::time_point m_tPeriodStart;
+
+    mutex                m_mxWorker;
+    condition_variable   m_cvWorker;
+    thread               m_thWorker;
+    bool                 m_bStop;
+};
@@ -0,0 +1,94 @@
+/* Copyright (C) 2016-2020 Thomas Hauck - All Rights Reserved.
+
+   Distributed under MIT license.
+   See file LICENSE for detail or copy at https://opensource.org/licenses/MIT
+
+   The author would be happy if changes and
+   improvements were reported back to him.
+
+   Author:  Thomas Hauck
+   Email:   Thomas@fam-hauck.de
+*/
+
+// The benchmark and the simulated network, a program of their own: PacketBench replaces the global
+// operator new to count the allocations, that must not end up in the server
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+
+#include "PacketBench.h"
+#include "Simulator.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#include <fcntl.h>
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+
+using namespace std;
+
+int main(int argc, const char* argv[])
+{
+#if defined(_WIN32) || defined(_WIN64)
+    _setmode(_fileno(stdout), _O_U16TEXT);
+#endif
+
+    // -bench <packets> counts the heap allocations of decoding and answering a query, exit code 1 if the arena paths allocate
+    for (int n = 1; n + 1 < argc; ++n)
+    {
+        if (string(argv[n]) == "-bench")
+        {
+            const PacketBench::REPORT Report = PacketBench::Run(static_cast<size_t>(atoi(argv[n + 1])));
+            wcout << L"Packets: " << Report.nPackets << L", " << fixed << setprecision(2) << Report.dMicroseconds << L" us each" << endl;
+            wcout << L"Heap allocations per packet: decode " << Report.dDecodeAllocs << L", records and answers " << Report.dRecordAllocs << L", encode " << Report.dEncodeAllocs << endl;
+            wcout << L"Arena blocks from the heap after the warm-up: " << Report.nArenaHeapBlocks << endl;
+            return PacketBench::Passed(Report) == true ? 0 : 1;
+        }
+    }
+
+    // -sim <hosts> runs the simulated network, the other options tune it
+    Simulator::CONFIG SimConfig = Simulator::DefaultConfig();
+    bool bSimulate = false;
+    for (int n = 1; n + 1 < argc; ++n)
+    {
+        const string strOption(argv[n]);
+        if (strOption == "-sim")
+        {
+            bSimulate = true;
+            SimConfig.nHosts = static_cast<size_t>(atoi(argv[++n]));
+        }
+        else if (strOption == "-seed")
+            SimConfig.nSeed = strtoull(argv[++n], nullptr, 10);
+        else if (strOption == "-loss")          // 0..1
+            SimConfig.dLoss = atof(argv[++n]);
+        else if (strOption == "-latency")       // microseconds
+            SimConfig.tLatency = chrono::microseconds(atoi(argv[++n]));
+        else if (strOption == "-churn")         // hosts leaving per minute
+            SimConfig.dChurnPerMinute = atof(argv[++n]);
+        else if (strOption == "-duration")      // seconds
+            SimConfig.tDuration = chrono::seconds(atoi(argv[++n]));
+    }
+
+    if (bSimulate == false)
+    {
+        wcout << L"mDnsBench -bench <packets>" << endl;
+        wcout << L"mDnsBench -sim <hosts> [-seed <n>] [-loss <0..1>] [-latency <us>] [-churn <per minute>] [-duration <s>]" << endl;
+        return 2;
+    }
+
+    const Simulator::REPORT Report = Simulator(SimConfig).Run();
+    wcout << L"Hosts: " << SimConfig.nHosts << L", seed " << SimConfig.nSeed << L", " << SimConfig.tDuration.count() << L" s" << endl;
+    wcout << L"Packets: " << Report.nPackets << L" (" << Report.nQueries << L" queries, " << Report.nResponses << L" responses), " << Report.nBytes << L" bytes, " << fixed << setprecision(1) << Report.nPackets / static_cast<double>(SimConfig.tDuration.count()) << L" per second" << endl;
+    wcout << L"Deliveries: " << Report.nDelivered << L", lost " << Report.nLost << endl;
+    wcout << L"Multicasts suppressed: " << Report.nSuppressed << L", conflicts " << Report.nConflicts << endl;
+    wcout << L"Answer latency: " << Report.nAnswered << L" queries, avg " << Report.dLatencyAvgMs << L" ms, p95 " << Report.dLatencyP95Ms << L" ms, max " << Report.dLatencyMaxMs << L" ms" << endl;
+    if (Report.dConvergenceSec < 0)
+        wcout << L"Convergence: not reached" << endl;
+    else
+        wcout << L"Convergence: " << setprecision(2) << Report.dConvergenceSec << L" s" << endl;
+    if (Report.nChurnEvents > 0)
+        wcout << L"Churn: " << Report.nChurnEvents << L" events, " << Report.nChurnConverged << L" converged, avg " << setprecision(2) << Report.dChurnConvergenceAvgSec << L" s, max " << Report.dChurnConvergenceMaxSec << L" s" << endl;
+    return 0;
+}
@@ -23,9 +23,24 @@
 #include <condition_variable>
 #include <map>
 #include <atomic>
+#include <deque>
+#include <set>
 
 #include "socketlib/SocketLib.h"
 #include "DnsProtokol.h"
+#include "NameFilter.h"
+#include "ServiceRegistry.h"
+#include "Responder.h"
+#include "InterfaceSource.h"
+#include "RecordCache.h"
+#include "CacheSnapshot.h"
+#include "ServiceBrowser.h"
+#include "RateLimiter.h"
+#include "DnsGateway.h"
+#include "Reflector.h"
+#include "TrafficAnalytics.h"
+#include "PacketCapture.h"
+#include "ServiceConfig.h"
 
 #if defined(_WIN32) || defined(_WIN64)
 #include <Ws2tcpip.h>
@@ -118,8 +133,25 @@ private:
 
 class mDnsServer
 {
+    // The shared_ptr does not own the socket, it counts the threads working with it, see AddInterface and FreeSocket
+    typedef vector<pair<shared_ptr<UdpSocket>, tuple<int, string, uint32_t>>> SOCKETLIST;
+    typedef map<UdpSocket*, pair<shared_ptr<UdpSocket>, tuple<int, string, uint32_t>>> SOCKETMAP;
+
 public:
-    mDnsServer()
+    typedef struct
+    {
+        uint64_t nPacketsReceived;
+        uint64_t nPrefilterRejects;     // queries for names we do not own, dropped undecoded
+        uint64_t nRateLimited;          // queries dropped because their source sent too many
+        uint64_t nMulticastSuppressed;  // records not multicast again within the minimum interval
+    }STATISTICS;
+
+    mDnsServer() : m_nPacketsReceived(0), m_nPrefilterRejects(0), m_nRateLimited(0), m_QueryLimiter(20.0, 40.0, 1024)
+        , m_Responder(m_Registry, bind(&mDnsServer::SendPacket, this, _1, _2, _3, _4, _5), bind(&mDnsServer::NameRenamed, this, _1, _2), bind(&mDnsServer::WakeProbe, this), true)
+        , m_bStopProbe(false), m_bWakeProbe(false), m_Browser(m_Cache, bind(&Responder::SendQuestion, &m_Responder, _1, _2))
+        , m_nGatewayPort(0), m_Gateway(m_Cache, bind(&Responder::SendQuestion, &m_Responder, _1, _2), bind(&Responder::GetLocalRecords, &m_Responder, _1))
+        , m_Reflector(m_Cache, bind(&mDnsServer::SendReflected, this, _1, _2, _3))
+        , m_nCaptureFileBytes(0), m_nCaptureFiles(1)
     {
     }
 
@@ -127,79 +159,309 @@ public:
     {
     }
 
-    void Start()
+    void SetInterfaceSource(unique_ptr<InterfaceSource> pInterfaceSource)
     {
-        BaseSocket::EnumIpAddresses([&](int adrFamily, const string& strIpAddr, int nInterfaceIndex, void*) -> int
-        {
-            wcout << strIpAddr.c_str() << endl;//OutputDebugStringA(strIpAddr.c_str()); OutputDebugStringA("\r\n");
+        m_pInterfaceSource = move(pInterfaceSource);
+    }
 
-            pair<map<unique_ptr<UdpSocket>, tuple<int, string, uint32_t>>::iterator, bool>paRet = m_maSockets.emplace(make_unique<UdpSocket>(), make_tuple(adrFamily, strIpAddr, nInterfaceIndex));
-            if (paRet.second == true)
-            {
-                paRet.first->first->BindErrorFunction(static_cast<function<void(BaseSocket* const)>>(bind(&mDnsServer::SocketError, this, _1)));
-                paRet.first->first->BindCloseFunction(static_cast<function<void(BaseSocket* const)>>(bind(&mDnsServer::SocketCloseing, this, _1)));
-                paRet.first->first->BindFuncBytesReceived(static_cast<function<void(UdpSocket* const)>>(bind(&mDnsServer::DatenEmpfangen, this, _1)));
-                if (get<0>(paRet.first->second) == AF_INET)
-                {
-                    if (paRet.first->first->Create(strIpAddr.c_str(), 5353, "0.0.0.0") == false)
-                        wcout << L"Error creating Socket: " << strIpAddr.c_str() << endl;
-                    if (paRet.first->first->AddToMulticastGroup("224.0.0.251", strIpAddr.c_str(), nInterfaceIndex) == false)
-                        wcout << L"Error joining Multicastgroup: " << strIpAddr.c_str() << endl;
-                }
-                else if (get<0>(paRet.first->second) == AF_INET6)
-                {
-                    if (paRet.first->first->Create(strIpAddr.c_str(), 5353, "::") == false)
-                        wcout << L"Error creating Socket: " << strIpAddr.c_str() << endl;
-                    if (paRet.first->first->AddToMulticastGroup("FF02::FB", strIpAddr.c_str(), nInterfaceIndex) == false)
-                        wcout << L"Error joining Multicastgroup: " << strIpAddr.c_str() << endl;
-                }
-            }
+    STATISTICS GetStatistics() const
+    {
+        return { m_nPacketsReceived, m_nPrefilterRejects, m_nRateLimited, m_Responder.GetMulticastSuppressed() };
+    }
+
+    ServiceBrowser& GetBrowser()
+    {
+        return m_Browser;
+    }
 
-            return 0;
-        }, 0);
+    // Ordinary unicast DNS queries for .local names are answered on this port, 0 = off
+    void SetGatewayPort(unsigned short nPort)
+    {
+        m_nGatewayPort = nPort;
+    }
 
+    // Queries and answers are forwarded between these interfaces (names or indices), at least two are needed
+    bool SetReflectorInterfaces(const vector<string>& vInterfaces)
+    {
+        return m_Reflector.SetInterfaces(vInterfaces);
+    }
+
+    // Who asks for what is counted and written to this file every minute, empty = off
+    void SetAnalyticsFile(const string& strFile)
+    {
+        m_strAnalyticsFile = strFile;
+    }
+
+    // The services are read from this file instead of the built in one and reloaded when it changes
+    void SetServiceFile(const string& strFile)
+    {
+        m_strServiceFile = strFile;
+    }
+
+    // The packets received and sent are written to this pcapng file, rotated after nMaxFileBytes, empty = off
+    void SetCaptureFile(const string& strFile, uint64_t nMaxFileBytes, size_t nMaxFiles)
+    {
+        m_strCaptureFile = strFile;
+        m_nCaptureFileBytes = nMaxFileBytes;
+        m_nCaptureFiles = nMaxFiles;
+    }
+
+    // Sampling and name filter can be changed while the capture runs
+    PacketCapture& GetCapture()
+    {
+        return m_Capture;
+    }
+
+    // The cache is saved to this file from time to time and on Stop, and read back on Start. Without a file it is not kept
+    void SetCacheFile(const string& strFile)
+    {
+        m_strCacheFile = strFile;
+    }
+
+    // False if the service file can not be read, nothing is started then
+    bool Start()
+    {
         // https://www.iana.org/assignments/service-names-port-numbers/service-names-port-numbers.txt
-        for (const auto& item : m_maSockets)
+        m_vSearchNames = { "_services._dns-sd._udp.local", "_benzinger._tcp.local" };
+
+        m_Registry.SetHostName(GetHostName());
+        if (m_strServiceFile.empty() == true)
+            m_Registry.AddService({ "HTTP2SERV", "_http._tcp.local", 80, {} });
+        else
         {
-            //if (item.second.first == AF_INET6)
+            vector<ServiceRegistry::SERVICE> vServices;
+            string strError;
+            if (ServiceConfig::Load(m_strServiceFile, vServices, strError) == false)
             {
-                m_maTimer.emplace(new RandIntervalTimer(), make_pair(item.first.get(), "_services._dns-sd._udp.local"));
-                m_maTimer.emplace(new RandIntervalTimer(), make_pair(item.first.get(), "_benzinger._tcp.local"));
+                wcout << L"Error in the service file: " << strError.c_str() << endl;
+                return false;
             }
+            m_Registry.SetProbed(m_Registry.SetServices(vServices).vProbe);    // nothing is ours before the first round, it probes them all
+        }
+
+        // Queries not asking for one of these names are dropped before they are decoded
+        m_NameFilter.Clear();
+        for (const auto& strName : m_Registry.GetOwnedNames())
+            m_NameFilter.Add(strName);
+        for (const auto& strName : m_vSearchNames)
+            m_NameFilter.Add(strName);
+
+        if (m_strCacheFile.empty() == false)
+        {
+            unique_ptr<CacheSnapshot> pSnapshot = make_unique<CacheSnapshot>();
+            if (pSnapshot->Open(m_strCacheFile) == true)
+                m_Cache.AttachSnapshot(move(pSnapshot));
+            m_SnapshotTimer.Start(&mDnsServer::SaveCache, this);
+        }
+
+        m_Browser.Start();
+        if (m_strCaptureFile.empty() == false && m_Capture.Start(m_strCaptureFile, m_nCaptureFileBytes, m_nCaptureFiles) == false)
+            wcout << L"Error writing the capture file: " << m_strCaptureFile.c_str() << endl;
+        if (m_strAnalyticsFile.empty() == false && m_Analytics.Start(m_strAnalyticsFile, chrono::seconds(60)) == false)
+            wcout << L"Error writing the analytics file: " << m_strAnalyticsFile.c_str() << endl;
+        if (m_nGatewayPort != 0 && m_Gateway.Start(m_nGatewayPort, chrono::milliseconds(500)) == false)
+            wcout << L"Error starting the DNS gateway on port " << m_nGatewayPort << endl;
+
+        // Probe our unique records and announce everything, one thread drives all interfaces at the same time
+        m_bStopProbe = false;
+        m_thProbe = thread(&mDnsServer::ProbeAndAnnounce, this);
+        m_Responder.Start();
+        if (m_strServiceFile.empty() == false)
+            m_ServiceConfig.Start(m_strServiceFile, chrono::seconds(1), bind(&mDnsServer::ServicesChanged, this, _1), [](const string& strError) { wcout << L"Error in the service file: " << strError.c_str() << endl; });
+
+        // The interface source reports the addresses we have now and later the ones coming and going
+        if (m_pInterfaceSource == nullptr)
+            m_pInterfaceSource = CreateInterfaceSource();
+        if (m_pInterfaceSource->Start(bind(&mDnsServer::InterfaceChanged, this, _1, _2, _3, _4)) == false)
+        {
+            wcout << L"Error starting the interface watcher, using the current addresses only" << endl;
+            m_pInterfaceSource = make_unique<EnumIpInterfaceSource>();
+            m_pInterfaceSource->Start(bind(&mDnsServer::InterfaceChanged, this, _1, _2, _3, _4));
         }
-        for (auto& item : m_maTimer)
-            item.first->Start(&mDnsServer::SendSrvSearch, this, item.second.second, item.second.first);
 
 //        SendSrvSearch("b._dns - sd._udp.local");
 //        SendSrvSearch("db._dns - sd._udp.local");
 //        SendSrvSearch("r._dns - sd._udp.local");
 //        SendSrvSearch("dr._dns - sd._udp.local");
 //        SendSrvSearch("lb._dns - sd._udp.local");
+        return true;
     }
 
     void Stop()
     {
-        while (m_maTimer.size())
+        m_ServiceConfig.Stop();
+        if (m_pInterfaceSource != nullptr)
+            m_pInterfaceSource->Stop();
+
+        m_Gateway.Stop();
+        m_Browser.Stop();
+        m_Analytics.Stop();
+        m_SnapshotTimer.Stop();
+
+        m_mxProbe.lock();
+        m_bStopProbe = true;
+        m_cvProbe.notify_all();
+        m_mxProbe.unlock();
+        if (m_thProbe.joinable() == true)
+            m_thProbe.join();
+
+        m_Responder.Stop();     // Goodbye packets, TTL 0 for all our records, one packet per interface
+
+        // The timer threads and the socket threads call into us, so they are stopped without holding the lock
+        map<RandIntervalTimer*, pair<UdpSocket*, string>> maTimer;
+        SOCKETMAP maSockets;
+        m_mxSockets.lock();
+        maTimer.swap(m_maTimer);
+        maSockets.swap(m_maSockets);
+        m_mxSockets.unlock();
+
+        while (maTimer.size())
         {
-            delete m_maTimer.begin()->first;
-            m_maTimer.erase(m_maTimer.begin());
+            delete maTimer.begin()->first;
+            maTimer.erase(maTimer.begin());
         }
 
-        while (m_maSockets.size())
+        for (auto& item : maSockets)
+            CloseSocket(item.first, item.second.second);
+        for (auto& item : maSockets)
+            FreeSocket(move(item.second.first));
+        maSockets.clear();
+        m_Capture.Stop();       // after the sockets, the goodbyes are in the file too
+
+        if (m_strCacheFile.empty() == false)
+            SaveCache();
+
+        const STATISTICS Stats = GetStatistics();
+        wcout << L"Prefilter: " << Stats.nPrefilterRejects << L" of " << Stats.nPacketsReceived << L" packets dropped (" << fixed << setprecision(1) << (Stats.nPacketsReceived > 0 ? 100.0 * Stats.nPrefilterRejects / Stats.nPacketsReceived : 0.0) << L"%)" << endl;
+        wcout << L"Rate limit: " << Stats.nRateLimited << L" queries dropped, " << Stats.nMulticastSuppressed << L" records not multicast again" << endl;
+        if (m_nGatewayPort != 0)
         {
-            if (get<0>(m_maSockets.begin()->second) == AF_INET)
-            {
-                if (m_maSockets.begin()->first->RemoveFromMulticastGroup("224.0.0.251", get<1>(m_maSockets.begin()->second).c_str(), get<2>(m_maSockets.begin()->second)) == false)
-                    wcout << L"Error leaving Multicastgroup: " << get<1>(m_maSockets.begin()->second).c_str() << endl;
-            }
-            else if (get<0>(m_maSockets.begin()->second) == AF_INET6)
+            const DnsGateway::STATISTICS GwStats = m_Gateway.GetStatistics();
+            wcout << L"Gateway: " << GwStats.nQueries << L" queries, " << GwStats.nAnsweredAtOnce << L" answered at once, " << GwStats.nMulticastQueries << L" multicast queries, " << GwStats.nTimeouts << L" timeouts, " << GwStats.nDropped << L" dropped, " << GwStats.nRateLimited << L" rate limited" << endl;
+        }
+        if (m_Reflector.IsEnabled() == true)
+        {
+            const Reflector::STATISTICS RfStats = m_Reflector.GetStatistics();
+            wcout << L"Reflector: " << RfStats.nForwarded << L" packets forwarded, " << RfStats.nAnsweredFromCache << L" queries answered from the cache, " << RfStats.nDuplicates << L" own reflections dropped, " << RfStats.nRateLimited << L" rate limited" << endl;
+        }
+        if (m_strCaptureFile.empty() == false)
+        {
+            const PacketCapture::STATISTICS CpStats = m_Capture.GetStatistics();
+            wcout << L"Capture: " << CpStats.nWritten << L" packets written, " << CpStats.nSampledOut << L" sampled out, " << CpStats.nFiltered << L" filtered, " << CpStats.nDropped << L" dropped, " << CpStats.nRotations << L" rotations" << endl;
+        }
+    }
+
+    void InterfaceChanged(bool bAdded, int adrFamily, const string& strIpAddr, int nInterfaceIndex)
+    {
+        if (bAdded == true)
+            AddInterface(adrFamily, strIpAddr, nInterfaceIndex);
+        else
+            RemoveInterface(adrFamily, strIpAddr, nInterfaceIndex);
+    }
+
+    void AddInterface(int adrFamily, const string& strIpAddr, int nInterfaceIndex)
+    {
+        wcout << strIpAddr.c_str() << endl;//OutputDebugStringA(strIpAddr.c_str()); OutputDebugStringA("\r\n");
+
+        // The entry in m_maSockets and every thread working with the socket hold a copy of pUse. When the last one
+        // lets it go the socket is not used anymore, FreeSocket waits for that before it deletes the socket
+        UdpSocket* pUdpSocket = new UdpSocket();
+        shared_ptr<UdpSocket> pUse(pUdpSocket, [this](UdpSocket* pReleased)
+        {
+            lock_guard<mutex> lock(m_mxSockets);
+            m_setReleasedSockets.insert(pReleased);
+            m_cvSockets.notify_all();
+        });
+        m_mxSockets.lock();
+        m_maSockets.emplace(pUdpSocket, make_pair(move(pUse), make_tuple(adrFamily, strIpAddr, nInterfaceIndex)));
+        m_mxSockets.unlock();
+
+        pUdpSocket->BindErrorFunction(static_cast<function<void(BaseSocket* const)>>(bind(&mDnsServer::SocketError, this, _1)));
+        pUdpSocket->BindCloseFunction(static_cast<function<void(BaseSocket* const)>>(bind(&mDnsServer::SocketCloseing, this, _1)));
+        pUdpSocket->BindFuncBytesReceived(static_cast<function<void(UdpSocket* const)>>(bind(&mDnsServer::DatenEmpfangen, this, _1)));
+        if (adrFamily == AF_INET)
+        {
+            if (pUdpSocket->Create(strIpAddr.c_str(), 5353, "0.0.0.0") == false)
+                wcout << L"Error creating Socket: " << strIpAddr.c_str() << endl;
+            if (pUdpSocket->AddToMulticastGroup("224.0.0.251", strIpAddr.c_str(), nInterfaceIndex) == false)
+                wcout << L"Error joining Multicastgroup: " << strIpAddr.c_str() << endl;
+        }
+        else if (adrFamily == AF_INET6)
+        {
+            if (pUdpSocket->Create(strIpAddr.c_str(), 5353, "::") == false)
+                wcout << L"Error creating Socket: " << strIpAddr.c_str() << endl;
+            if (pUdpSocket->AddToMulticastGroup("FF02::FB", strIpAddr.c_str(), nInterfaceIndex) == false)
+                wcout << L"Error joining Multicastgroup: " << strIpAddr.c_str() << endl;
+        }
+
+        vector<RandIntervalTimer*> vTimer;
+        m_mxSockets.lock();
+        for (const auto& strName : m_vSearchNames)
+        {
+            vTimer.push_back(new RandIntervalTimer());
+            m_maTimer.emplace(vTimer.back(), make_pair(pUdpSocket, strName));
+        }
+        m_mxSockets.unlock();
+        for (size_t n = 0; n < vTimer.size(); ++n)
+            vTimer[n]->Start(&mDnsServer::SendSrvSearch, this, m_vSearchNames[n], pUdpSocket);
+
+        // Only the new interface is probed and announced, the others did not change
+        m_Responder.AddSocket(reinterpret_cast<Responder::SOCKETID>(pUdpSocket), Responder::SOCKETINFO(adrFamily, strIpAddr, nInterfaceIndex));
+    }
+
+    void RemoveInterface(int adrFamily, const string& strIpAddr, int nInterfaceIndex)
+    {
+        wcout << L"Address removed: " << strIpAddr.c_str() << endl;
+
+        UdpSocket* pUdpSocket = nullptr;
+        shared_ptr<UdpSocket> pUse;
+        tuple<int, string, uint32_t> tuInfo;
+        vector<RandIntervalTimer*> vTimer;
+        m_mxSockets.lock();
+        const auto& pItem = find_if(begin(m_maSockets), end(m_maSockets), [&](const auto& it) { return get<0>(it.second.second) == adrFamily && get<1>(it.second.second) == strIpAddr; });
+        if (pItem != end(m_maSockets))
+        {
+            pUdpSocket = pItem->first;
+            pUse = move(pItem->second.first);
+            tuInfo = pItem->second.second;
+            m_maSockets.erase(pItem);   // no new user gets it from now on
+        }
+        for (auto it = begin(m_maTimer); it != end(m_maTimer);)
+        {
+            if (it->second.first == pUdpSocket)
             {
-                if (m_maSockets.begin()->first->RemoveFromMulticastGroup("FF02::FB", get<1>(m_maSockets.begin()->second).c_str(), get<2>(m_maSockets.begin()->second)) == false)
-                    wcout << L"Error leaving Multicastgroup: " << get<1>(m_maSockets.begin()->second).c_str() << endl;
+                vTimer.push_back(it->first);
+                it = m_maTimer.erase(it);
             }
-            m_maSockets.begin()->first->Close();
-            m_maSockets.erase(m_maSockets.begin());
+            else
+                ++it;
         }
+        m_mxSockets.unlock();
+
+        if (pUdpSocket == nullptr)
+            return;
+
+        for (auto& pTimer : vTimer)
+            delete pTimer;
+
+        // The goodbye for the address record goes out on an interface still alive on the same link
+        m_Responder.RemoveSocket(reinterpret_cast<Responder::SOCKETID>(pUdpSocket));
+
+        CloseSocket(pUdpSocket, tuInfo);
+        FreeSocket(move(pUse));
+    }
+
+    // Deletes the socket once the receive callback or a sending thread in the middle of using it is done. The caller
+    // must not hold m_mxSockets or be one of these users, a receive callback waiting for its own socket never ends
+    void FreeSocket(shared_ptr<UdpSocket> pUse)
+    {
+        UdpSocket* pUdpSocket = pUse.get();
+        pUse.reset();       // may be the last user, its deleter takes m_mxSockets
+        unique_lock<mutex> lock(m_mxSockets);
+        m_cvSockets.wait(lock, [&]() { return m_setReleasedSockets.find(pUdpSocket) != end(m_setReleasedSockets); });
+        m_setReleasedSockets.erase(pUdpSocket);
+        lock.unlock();
+        delete pUdpSocket;
     }
 
 
@@ -216,22 +478,67 @@ public:
 
     void DatenEmpfangen(UdpSocket* pUdpSocket)
     {
+        // Counted as a user until we return, a removed socket is not touched anymore, FreeSocket may delete it
+        shared_ptr<UdpSocket> pUse;
+        tuple<int, string, uint32_t> tuInfo;
+        if (GetSocketInfo(pUdpSocket, tuInfo, &pUse) == false)
+            return;
+
+        DnsArena::Scope ArenaScope;     // everything for this packet comes from the thread arena, released when we leave
         size_t nAvalible = pUdpSocket->GetBytesAvailible();
 
-        auto spBuffer = make_unique<unsigned char[]>(nAvalible + 1);
+        auto spBuffer = MakeArenaArray<unsigned char>(nAvalible + 1);
 
         string strFrom;
         size_t nRead = pUdpSocket->Read(spBuffer.get(), nAvalible, strFrom);
 
         if (nRead > 0 && nRead < 9999)
         {
+            ++m_nPacketsReceived;
+
+            // The capture sees every packet, also the ones dropped below. We only know the group it was sent to
+            if (m_Capture.IsEnabled() == true)
+                m_Capture.Capture(PacketCapture::INBOUND, get<2>(tuInfo), strFrom.c_str(), get<0>(tuInfo) == AF_INET6 ? "[FF02::FB]:5353" : "224.0.0.251:5353", spBuffer.get(), nRead);
+
+            // On a reflected interface every packet may have to be forwarded, none is dropped early
+            const bool bReflected = m_Reflector.IsEnabled() == true && m_Reflector.IsReflected(get<2>(tuInfo)) == true;
+            const auto fnDropped = [&]() -> bool
+            {
+                if (bReflected == false && DnsProtokol::IsUnwantedQuery(spBuffer.get(), nRead, [this](const char* szName, size_t nLen, unsigned short) { return m_NameFilter.MayContain(szName, nLen); }) == true)
+                {
+                    ++m_nPrefilterRejects;
+                    return true;
+                }
+
+                // Every query costs us work and maybe a multicast, no single source gets more than its share
+                if (nRead > 2 && (spBuffer[2] & 0x80) == 0 && m_QueryLimiter.Allow(Responder::SourceAddress(strFrom)) == false)
+                {
+                    ++m_nRateLimited;
+                    return true;
+                }
+                return false;
+            };
+
+            // The analytics count all traffic, also the packets dropped by the prefilter and the limiter, they are decoded for it.
+            // Dropped is dropped all the same, nothing of them reaches the responder
+            const bool bAnalytics = m_Analytics.IsEnabled();
+            if (bAnalytics == false && fnDropped() == true)
+                return;
+
             DnsProtokol dnsProto(spBuffer.get(), nRead);
 
+            if (bAnalytics == true)
+            {
+                if (dnsProto.m_strLastErrMsg.empty() == true)
+                    m_Analytics.AddPacket(get<2>(tuInfo), Responder::SourceAddress(strFrom), dnsProto);
+                if (fnDropped() == true)
+                    return;
+            }
+
             wstringstream strOutput;
             const auto tNow = chrono::system_clock::to_time_t(chrono::system_clock::now());
-            const auto& pItem = find_if(begin(m_maSockets), end(m_maSockets), [&pUdpSocket](const auto& it) { return it.first.get() == pUdpSocket; });
             strOutput << put_time(localtime(&tNow), L"%a, %d %b %Y %H:%M:%S") << " - ";
-            strOutput << strFrom.c_str() << L" on Interface: " << (pItem != end(m_maSockets) ? get<1>(pItem->second).c_str() : "") << endl;
+            strOutput << strFrom.c_str() << L" on Interface: " << get<1>(tuInfo).c_str() << endl;
 
             if (dnsProto.m_strLastErrMsg.empty() == true)
             {
@@ -239,7 +546,7 @@ public:
                 strOutput << L"hat " << dnsProto.m_DnsHeader.QDCOUNT << L" fragen, " << dnsProto.m_DnsHeader.ANCOUNT << L" RRs Antworten, " << dnsProto.m_DnsHeader.NSCOUNT << L" NS Antworten, " << dnsProto.m_DnsHeader.ARCOUNT << L" AR Antworten" << endl;
 
                 for (short n = 0; n < dnsProto.m_DnsHeader.QDCOUNT; ++n)
-                    strOutput << dnsProto.m_pQuestions.get()[n].LABEL.c_str() << L" -> QTYPE: " << dnsProto.m_pQuestions.get()[n].QTYPE << L" -> QCLASS: " << dnsProto.m_pQuestions.get()[n].QCLASS << endl;
+                    strOutput << dnsProto.m_pQuestions.get()[n].LABEL.c_str() << L" -> QTYPE: " << dnsProto.m_pQuestions.get()[n].QTYPE << L" -> QCLASS: " << dnsProto.m_pQuestions.get()[n].QCLASS << (dnsProto.m_pQuestions.get()[n].QU == true ? L" (QU)" : L"") << endl;
 
                 for (short n = 0; n < dnsProto.m_DnsHeader.ANCOUNT; ++n)
                     strOutput << dnsProto.m_pAnswers.get()[n].LABEL.c_str() << L" -> TYPE: " << dnsProto.m_pAnswers.get()[n].TYPE << L" -> CLASS: " << dnsProto.m_pAnswers.get()[n].CLASS << L" -> TTL: " << dnsProto.m_pAnswers.get()[n].TTL << L" -> RDLENGTH: " << dnsProto.m_pAnswers.get()[n].RDLENGTH << L" -> RDATA: " << dnsProto.m_pAnswers.get()[n].RDATA.c_str() << endl;
@@ -253,61 +560,28 @@ public:
                 if (dnsProto.m_nBytesDecodet != nRead)
                     strOutput << L"Error, extraction records and Bytes read do not match" << endl;
 
-                for (short n = 0; n < dnsProto.m_DnsHeader.QDCOUNT; ++n)
+                // Our own multicasts come back to us, they are no conflict, not cached and our own probes are not answered
+                const bool bOwnPacket = m_Responder.IsOwnAddress(strFrom);
+
+                if (dnsProto.m_DnsHeader.QR == 1 && bOwnPacket == false)
                 {
-                    if (dnsProto.m_pQuestions.get()[n].LABEL == "_services._dns-sd._udp.local" && dnsProto.m_pQuestions.get()[n].QTYPE == 12)
+                    for (short n = 0; n < dnsProto.m_DnsHeader.ANCOUNT; ++n)
                     {
-                        vector<DnsProtokol::ANSWERITEM> AnList, NsList, ArList;
-                        DnsProtokol::IDxSTRING PtrData1 = { 0, "_opcua-tcp._tcp.local" };
-                        AnList.push_back({ { 0, dnsProto.m_pQuestions.get()[n].LABEL }, &PtrData1, 12, 1, 1400 });  // PTR Record auf Instance
-                        DnsProtokol::IDxSTRING PtrData2 = { 0, "_http._tcp.local" };
-                        AnList.push_back({ { 0, dnsProto.m_pQuestions.get()[n].LABEL }, &PtrData2, 12, 1, 1500 });  // PTR Record auf Instance
-                        DnsProtokol::IDxSTRING PtrData3 = { 0, "_teamviewer._tcp.local" };
-                        AnList.push_back({ { 0, dnsProto.m_pQuestions.get()[n].LABEL }, &PtrData3, 12, 1, 1600 });  // PTR Record auf Instance
-                        SendAnswer(AnList, NsList, ArList, pUdpSocket);
+                        const auto& Record = dnsProto.m_pAnswers.get()[n];
+                        m_Cache.Add(Record.LABEL.c_str(), Record.TYPE, Record.CLASS, dnsProto.GetCanonicalRData(spBuffer.get(), nRead, Record), Record.TTL, get<2>(tuInfo));
                     }
-                    else if (dnsProto.m_pQuestions.get()[n].LABEL == "_http._tcp.local" && dnsProto.m_pQuestions.get()[n].QTYPE == 12)
+                    for (short n = 0; n < dnsProto.m_DnsHeader.ARCOUNT; ++n)
                     {
-                        struct in_addr addrV4 = { 0 };
-                        struct in6_addr addrV6 = { 0 };
-                        string strHostname(512, 0);
-
-                        if (gethostname(&strHostname[0], 512) == 0)
-                            strHostname.erase(strHostname.find_last_not_of('\0') + 1);
-                        strHostname += string(".local");
-
-                        const auto& pItem = find_if(begin(m_maSockets), end(m_maSockets), [&pUdpSocket](const auto& it) { return it.first.get() == pUdpSocket; });
-                        if (pItem != m_maSockets.end())
-                        {
-                            if (get<0>(pItem->second) == AF_INET)
-                                inet_pton(AF_INET, get<1>(pItem->second).c_str(), &addrV4.s_addr);
-                            else if (get<0>(pItem->second) == AF_INET6)
-                                inet_pton(AF_INET6, get<1>(pItem->second).c_str(), &addrV6);
-                        }
-
-                        string strServiceName = "HTTP2SERV." + dnsProto.m_pQuestions.get()[n].LABEL;
-                        vector<DnsProtokol::ANSWERITEM> AnList, NsList, ArList;
-
-                        DnsProtokol::IDxSTRING PtrData = { 0, strServiceName };
-                        AnList.push_back({ { 0, dnsProto.m_pQuestions.get()[n].LABEL }, &PtrData, 12, 1, 182 });    // PTR Record auf Instance
-
-                        vector<string> vTxtData;// = { "Token1=Hallo World", "Token2=this are your", "Token3=Paramters to report" };
-                        AnList.push_back({ { 0, strServiceName }, &vTxtData, 16, 1, 182 });             // TXT Record der Instance
-
-                        DnsProtokol::SRVDATA SrvData = { 0, 0, 80,{ 0, strHostname } };
-                        AnList.push_back({ { 0, strServiceName }, &SrvData, 33, 1, 182 });              // SRV Record der Instance
-
-                        if (addrV4.s_addr != 0)
-                            ArList.push_back({ { 0, strHostname }, &addrV4.s_addr, 1, 1, 182 });         // IP4 Record
-                        if (*(reinterpret_cast<uint32_t*>(&addrV6)) != 0
-                            || *(reinterpret_cast<uint32_t*>(&addrV6) + 1) != 0
-                            || *(reinterpret_cast<uint32_t*>(&addrV6) + 2) != 0
-                            || *(reinterpret_cast<uint32_t*>(&addrV6) + 3) != 0)
-                            ArList.push_back({ { 0, strHostname }, &addrV6, 28, 1, 182 });              // IP6 Record
-
-                        SendAnswer(AnList, NsList, ArList, pUdpSocket);
+                        const auto& Record = dnsProto.m_pExtraRec.get()[n];
+                        if (Record.TYPE != 41)  // OPT is no record
+                            m_Cache.Add(Record.LABEL.c_str(), Record.TYPE, Record.CLASS, dnsProto.GetCanonicalRData(spBuffer.get(), nRead, Record), Record.TTL, get<2>(tuInfo));
                     }
                 }
+
+                m_Responder.HandlePacket(dnsProto, spBuffer.get(), nRead, reinterpret_cast<Responder::SOCKETID>(pUdpSocket), tuInfo, strFrom, bOwnPacket);
+
+                if (bReflected == true && bOwnPacket == false)
+                    m_Reflector.Process(spBuffer.get(), nRead, dnsProto, strFrom, get<0>(tuInfo), get<2>(tuInfo));
             }
             else
                 strOutput << dnsProto.m_strLastErrMsg.c_str();
@@ -319,54 +593,212 @@ public:
 
     void SendSrvSearch(string strSrvName, UdpSocket* pUdpSocket)   // _services._tcp.local
     {
+        DnsArena::Scope ArenaScope;
         DnsProtokol dnsProto;
         size_t nBufLen = 0;
         if (dnsProto.BuildSearch(strSrvName, nullptr, nBufLen) != 0)
             return;
 
-        string pBuffer(nBufLen, 0);
+        auto pBuffer = MakeArenaArray<char>(nBufLen);
         size_t nSendSize = dnsProto.BuildSearch(strSrvName, &pBuffer[0], nBufLen);
 
         if (nBufLen != 0)
             wcout << L"Something went wrong in the buffer size calculation" << endl;
 
-        const auto& pItem = find_if(begin(m_maSockets), end(m_maSockets), [&pUdpSocket](const auto& it) { return it.first.get() == pUdpSocket; });
-        if (pItem != m_maSockets.end())
+        SendMulticast(&pBuffer[0], nSendSize, pUdpSocket);
+    }
+
+private:
+    // The Responder::SENDER, the packet is dropped if the socket was removed meanwhile
+    void SendPacket(Responder::SOCKETID nSocket, const Responder::SOCKETINFO& Info, const char* pBuffer, size_t nSize, const string& strTo)
+    {
+        UdpSocket* pUdpSocket = reinterpret_cast<UdpSocket*>(nSocket);
+        shared_ptr<UdpSocket> pUse;
+        tuple<int, string, uint32_t> tuInfo;
+        if (GetSocketInfo(pUdpSocket, tuInfo, &pUse) == false || tuInfo != Info)
+            return;
+
+        if (strTo.empty() == true)
+            SendMulticast(pBuffer, nSize, pUdpSocket);
+        else
         {
-            if (get<0>(pItem->second) == AF_INET)
-                pUdpSocket->Write(&pBuffer[0], nSendSize, "224.0.0.251:5353");
-            else if (get<0>(pItem->second) == AF_INET6)
-                pUdpSocket->Write(&pBuffer[0], nSendSize, "[FF02::FB]:5353");
+            pUdpSocket->Write(pBuffer, nSize, strTo);
+            CaptureSent(Info, pBuffer, nSize, strTo.c_str());
         }
     }
 
-    void SendAnswer(vector<DnsProtokol::ANSWERITEM>& AnList, vector<DnsProtokol::ANSWERITEM>& NsList, vector<DnsProtokol::ANSWERITEM>& ArList, UdpSocket* pUdpSocket)
+    void NameRenamed(const string& strName, const string& strNewName)
     {
-        DnsProtokol dnsProto;
-        size_t nBufLen = 0;
-        if (dnsProto.BuildAnswer(AnList, NsList, ArList, nullptr, nBufLen) != 0)
-            return;
+        if (strNewName.empty() == false)
+        {
+            m_NameFilter.Add(strNewName);
+            wcout << L"Name conflict: " << strName.c_str() << L" renamed to " << strNewName.c_str() << endl;
+        }
+    }
 
-        string pBuffer(nBufLen, 0);
-        size_t nSendSize = dnsProto.BuildAnswer(AnList, NsList, ArList, &pBuffer[0], nBufLen);
+    // The Responder::WAKEUP, ProbeAndAnnounce looks at the time of the next step again
+    void WakeProbe()
+    {
+        lock_guard<mutex> lock(m_mxProbe);
+        m_bWakeProbe = true;
+        m_cvProbe.notify_all();
+    }
 
-        if (nBufLen != 0)
-            wcout << L"Something went wrong in the buffer size calculation" << endl;
+    void SendMulticast(const char* pBuffer, size_t nSendSize, UdpSocket* pUdpSocket)
+    {
+        tuple<int, string, uint32_t> tuInfo;
+        if (GetSocketInfo(pUdpSocket, tuInfo) == true)
+        {
+            if (get<0>(tuInfo) == AF_INET)
+                pUdpSocket->Write(pBuffer, nSendSize, "224.0.0.251:5353");
+            else if (get<0>(tuInfo) == AF_INET6)
+                pUdpSocket->Write(pBuffer, nSendSize, "[FF02::FB]:5353");
+            CaptureSent(tuInfo, pBuffer, nSendSize, get<0>(tuInfo) == AF_INET6 ? "[FF02::FB]:5353" : "224.0.0.251:5353");
+        }
+    }
+
+    // tuInfo of the socket it was sent on
+    void CaptureSent(const tuple<int, string, uint32_t>& tuInfo, const char* pBuffer, size_t nSendSize, const char* szTo)
+    {
+        if (m_Capture.IsEnabled() == true)
+            m_Capture.CaptureSent(get<2>(tuInfo), get<1>(tuInfo).c_str(), 5353, szTo, pBuffer, nSendSize);
+    }
+
+    // One socket of the interface and address family is enough, they all reach the same link
+    void SendReflected(uint32_t nInterface, int adrFamily, const string& strPacket)
+    {
+        for (const auto& item : GetSockets())
+        {
+            if (get<2>(item.second) == nInterface && get<0>(item.second) == adrFamily)
+            {
+                SendMulticast(strPacket.data(), strPacket.size(), item.first.get());
+                break;
+            }
+        }
+    }
+
+    // pUse, if given, gets a copy of the use count of the socket, see AddInterface
+    bool GetSocketInfo(UdpSocket* pUdpSocket, tuple<int, string, uint32_t>& tuInfo, shared_ptr<UdpSocket>* pUse = nullptr)
+    {
+        lock_guard<mutex> lock(m_mxSockets);
+        const auto& pItem = m_maSockets.find(pUdpSocket);
+        if (pItem == end(m_maSockets))
+            return false;
+        tuInfo = pItem->second.second;
+        if (pUse != nullptr)
+            *pUse = pItem->second.first;
+        return true;
+    }
+
+    SOCKETLIST GetSockets()
+    {
+        lock_guard<mutex> lock(m_mxSockets);
+        SOCKETLIST vSockets;
+        for (const auto& item : m_maSockets)
+            vSockets.emplace_back(item.second.first, item.second.second);
+        return vSockets;
+    }
 
-        // send it on his way
-        const auto& pItem = find_if(begin(m_maSockets), end(m_maSockets), [&pUdpSocket](const auto& it) { return it.first.get() == pUdpSocket; });
-        if (pItem != m_maSockets.end())
+    void CloseSocket(UdpSocket* pUdpSocket, const tuple<int, string, uint32_t>& tuInfo)
+    {
+        if (get<0>(tuInfo) == AF_INET)
+        {
+            if (pUdpSocket->RemoveFromMulticastGroup("224.0.0.251", get<1>(tuInfo).c_str(), get<2>(tuInfo)) == false)
+                wcout << L"Error leaving Multicastgroup: " << get<1>(tuInfo).c_str() << endl;
+        }
+        else if (get<0>(tuInfo) == AF_INET6)
         {
-            if (get<0>(pItem->second) == AF_INET)
-                pUdpSocket->Write(&pBuffer[0], nSendSize, "224.0.0.251:5353");
-            else if (get<0>(pItem->second) == AF_INET6)
-                pUdpSocket->Write(&pBuffer[0], nSendSize, "[FF02::FB]:5353");
+            if (pUdpSocket->RemoveFromMulticastGroup("FF02::FB", get<1>(tuInfo).c_str(), get<2>(tuInfo)) == false)
+                wcout << L"Error leaving Multicastgroup: " << get<1>(tuInfo).c_str() << endl;
+        }
+        pUdpSocket->Close();
+    }
+
+    // Runs the steps of the responder when they are due, probing and announcing, RFC 6762 8
+    void ProbeAndAnnounce()
+    {
+        unique_lock<mutex> lock(m_mxProbe);
+        while (m_bStopProbe == false)
+        {
+            m_bWakeProbe = false;
+            const auto tNext = m_Responder.NextStep();
+            if (tNext == Responder::TIMEPOINT::max())
+                m_cvProbe.wait(lock, [&]() { return m_bStopProbe == true || m_bWakeProbe == true; });
+            else
+                m_cvProbe.wait_until(lock, tNext, [&]() { return m_bStopProbe == true || m_bWakeProbe == true; });
+            if (m_bStopProbe == true)
+                break;
+
+            lock.unlock();
+            m_Responder.Step(chrono::steady_clock::now());
+            lock.lock();
         }
     }
 
+    // Called by the service file watcher. Only what changed goes out: goodbyes for the records gone, announcements
+    // for new data of names we have, and the new instances are probed before anybody gets an answer with them
+    void ServicesChanged(const vector<ServiceRegistry::SERVICE>& vServices)
+    {
+        ServiceRegistry::CHANGES Changes = m_Registry.SetServices(vServices);
+        for (const auto& strName : m_Registry.GetOwnedNames())
+            m_NameFilter.Add(strName);
+        wcout << L"Services reloaded: " << Changes.vProbe.size() << L" new, " << Changes.vGoodbye.size() << L" records gone, " << Changes.vAnnounce.size() << L" records changed" << endl;
+        m_Responder.ServicesChanged(Changes, vServices);
+    }
+
+    void SaveCache()
+    {
+        m_Cache.AdoptSnapshot();    // the file of the last run is replaced now, it must not be mapped anymore
+        if (CacheSnapshot::Write(m_strCacheFile, m_Cache.GetAll()) == false)
+            wcout << L"Error writing the cache file: " << m_strCacheFile.c_str() << endl;
+    }
+
+    static string GetHostName()
+    {
+        string strHostname(512, 0);
+
+        if (gethostname(&strHostname[0], 512) == 0)
+            strHostname.erase(strHostname.find_last_not_of('\0') + 1);
+        return strHostname + string(".local");
+    }
+
 private:
-    map<unique_ptr<UdpSocket>, tuple<int, string, uint32_t>> m_maSockets;
+    mutex m_mxSockets;      // guards m_maSockets, m_maTimer and m_setReleasedSockets, never held while calling into a socket or timer
+    condition_variable m_cvSockets;
+    SOCKETMAP m_maSockets;
     map<RandIntervalTimer*, pair<UdpSocket*, string>> m_maTimer;
+    set<UdpSocket*> m_setReleasedSockets;   // removed sockets nobody uses anymore, FreeSocket deletes them
+    unique_ptr<InterfaceSource> m_pInterfaceSource;
+    vector<string>   m_vSearchNames;
+    NameFilter       m_NameFilter;
+    atomic<uint64_t> m_nPacketsReceived;
+    atomic<uint64_t> m_nPrefilterRejects;
+    atomic<uint64_t> m_nRateLimited;
+    RateLimiter      m_QueryLimiter;    // per source address, 20 queries a second, bursts up to 40
+    ServiceRegistry  m_Registry;
+    Responder        m_Responder;
+
+    thread             m_thProbe;
+    mutex              m_mxProbe;           // guards the two members below
+    condition_variable m_cvProbe;
+    bool               m_bStopProbe;
+    bool               m_bWakeProbe;
+
+    RecordCache        m_Cache;
+    ServiceBrowser     m_Browser;
+    string             m_strCacheFile;
+    unsigned short     m_nGatewayPort;
+    DnsGateway         m_Gateway;
+    RandIntervalTimer  m_SnapshotTimer;
+    Reflector          m_Reflector;
+    string             m_strAnalyticsFile;
+    TrafficAnalytics   m_Analytics;
+    string             m_strServiceFile;
+    ServiceConfig      m_ServiceConfig;
+    string             m_strCaptureFile;
+    uint64_t           m_nCaptureFileBytes;
+    size_t             m_nCaptureFiles;
+    PacketCapture      m_Capture;
 };
 
 
@@ -382,7 +814,58 @@ int main(int argc, const char* argv[])
     //locale::global(std::locale(""));
 
     mDnsServer mDnsSrv;
-    mDnsSrv.Start();
+    for (int n = 1; n + 1 < argc; ++n)
+    {
+        if (string(argv[n]) == "-cache")   // -cache <file>, keep the record cache in this file over restarts
+            mDnsSrv.SetCacheFile(argv[++n]);
+        else if (string(argv[n]) == "-g")   // -g <port>, answer unicast DNS queries for .local names
+            mDnsSrv.SetGatewayPort(static_cast<unsigned short>(atoi(argv[++n])));
+        else if (string(argv[n]) == "-r")   // -r <if1,if2,...>, forward queries and answers between these interfaces
+        {
+            vector<string> vInterfaces;
+            stringstream ssList(argv[++n]);
+            for (string strInterface; getline(ssList, strInterface, ',');)
+                vInterfaces.push_back(strInterface);
+            if (mDnsSrv.SetReflectorInterfaces(vInterfaces) == false)
+                wcout << L"Unknown interface in the reflector list: " << argv[n] << endl;
+        }
+        else if (string(argv[n]) == "-a")   // -a <file>, count the traffic and write a JSON snapshot to the file every minute
+            mDnsSrv.SetAnalyticsFile(argv[++n]);
+        else if (string(argv[n]) == "-s")   // -s <file>, advertise the services of this file, reloaded when it changes
+            mDnsSrv.SetServiceFile(argv[++n]);
+        else if (string(argv[n]) == "-c")   // -c <file>, write the packets to a pcapng file, 10 MB each, the last 5 files are kept
+            mDnsSrv.SetCaptureFile(argv[++n], 10 * 1024 * 1024, 5);
+        else if (string(argv[n]) == "-csample")   // -csample <n>, capture only every n-th packet
+            mDnsSrv.GetCapture().SetSampling(static_cast<uint32_t>(atoi(argv[++n])));
+        else if (string(argv[n]) == "-cfilter")   // -cfilter <name1,name2,...>, capture only packets with these names or names below them
+        {
+            vector<string> vNames;
+            stringstream ssList(argv[++n]);
+            for (string strName; getline(ssList, strName, ',');)
+                vNames.push_back(strName);
+            mDnsSrv.GetCapture().SetNameFilter(vNames);
+        }
+    }
+    if (mDnsSrv.Start() == false)
+        return 1;
+
+    ServiceBrowser& Browser = mDnsSrv.GetBrowser();
+    const ServiceBrowser::LOOKUPID nBrowseId = Browser.Browse("_http._tcp.local", [&Browser](const string& strInstance, bool bAdded)
+    {
+        wcout << (bAdded == true ? L"Service found: " : L"Service gone: ") << strInstance.c_str() << endl;
+        if (bAdded == true)
+        {
+            Browser.Resolve(strInstance, chrono::seconds(3), [](bool bResolved, const ServiceBrowser::RESOLVED& Result)
+            {
+                wcout << Result.strInstance.c_str() << (bResolved == true ? L" -> " : L" -> not resolved") << Result.strHost.c_str();
+                for (const auto& strAddr : Result.vAddresses)
+                    wcout << L" " << strAddr.c_str();
+                if (bResolved == true)
+                    wcout << L" Port: " << Result.nPort;
+                wcout << endl;
+            });
+        }
+    });
 
 #if defined(_WIN32) || defined(_WIN64)
     //while (::_kbhit() == 0)
@@ -392,6 +875,7 @@ int main(int argc, const char* argv[])
     getchar();
 #endif
 
+    Browser.Cancel(nBrowseId);
     mDnsSrv.Stop();
 
     return 0;